@@ -0,0 +1,113 @@
+/*
+ * chunkq.h - unbounded queue of read chunks, one producer and many consumers
+ *
+ * fqc reads its input in 1 MB chunks on one thread and counts newlines on
+ * the others; this is the linked list with a mutex and a condition variable
+ * that connects them. An empty chunk (0 bytes) marks the end of the input.
+ *
+ *   chunkq_init()    an empty queue
+ *   chunkq_push()    append a chunk, the queue takes over its buffer; returns the depth
+ *   chunkq_pop()     wait for the next chunk, 0 once the producer is done
+ *   chunkq_finish()  the producer is done, wake up all consumers
+ *   chunkq_destroy() free the queue and any chunk left in it
+ */
+#ifndef N50_CHUNKQ_H
+#define N50_CHUNKQ_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct {
+    char *buffer;
+    int bytes_read;
+} Chunk;
+
+typedef struct ChunkNode {
+    Chunk chunk;
+    struct ChunkNode *next;
+} ChunkNode;
+
+typedef struct {
+    ChunkNode *head;
+    ChunkNode *tail;
+    int depth;              // chunks in the queue
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int producer_done;
+} ChunkQueue;
+
+static inline void chunkq_init(ChunkQueue *queue) {
+    queue->head = queue->tail = NULL;
+    queue->depth = 0;
+    queue->producer_done = 0;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+}
+
+// Returns the number of chunks queued, this one included, or -1 if memory
+// ran out (the buffer is not taken over then)
+static inline int chunkq_push(ChunkQueue *queue, char *buffer, int bytes_read) {
+    ChunkNode *new_node = (ChunkNode *)malloc(sizeof(ChunkNode));
+    if (new_node == NULL) return -1;
+    new_node->chunk.buffer = buffer;
+    new_node->chunk.bytes_read = bytes_read;
+    new_node->next = NULL;
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->tail == NULL) {
+        queue->head = new_node;
+        queue->tail = new_node;
+    } else {
+        queue->tail->next = new_node;
+        queue->tail = new_node;
+    }
+    int depth = ++queue->depth;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+    return depth;
+}
+
+// Returns 1 and fills `chunk` (the caller frees its buffer), or 0 when the
+// queue is empty and the producer is done
+static inline int chunkq_pop(ChunkQueue *queue, Chunk *chunk) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->head == NULL && !queue->producer_done) {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+    if (queue->head == NULL) {
+        pthread_mutex_unlock(&queue->mutex);
+        return 0;
+    }
+    ChunkNode *node = queue->head;
+    queue->head = queue->head->next;
+    queue->depth--;
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    *chunk = node->chunk;
+    free(node);
+    return 1;
+}
+
+static inline void chunkq_finish(ChunkQueue *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    queue->producer_done = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static inline void chunkq_destroy(ChunkQueue *queue) {
+    while (queue->head) {
+        ChunkNode *node = queue->head;
+        queue->head = node->next;
+        free(node->chunk.buffer);
+        free(node);
+    }
+    queue->tail = NULL;
+    queue->depth = 0;
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->cond);
+}
+
+#endif
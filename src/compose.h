@@ -0,0 +1,209 @@
+/*
+ * compose.h - base composition kernel
+ *
+ * Counts, in one pass over a sequence buffer:
+ *   gc     G, C (either case)
+ *   at     A, T (either case)
+ *   n      N (either case)
+ *   lower  any lowercase letter (soft-masked bases)
+ *   eol    '\n' and '\r', so multi-line FASTA buffers can be scanned as is
+ * Everything else (other IUPAC codes, gaps) is `len - gc - at - n - eol`.
+ *
+ * On x86-64 the kernel is picked at runtime from AVX-512BW, AVX2 and SSE2
+ * (always available there); other platforms use the scalar version.
+ */
+#ifndef N50_COMPOSE_H
+#define N50_COMPOSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define COMPOSE_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    uint64_t gc;
+    uint64_t at;
+    uint64_t n;
+    uint64_t lower;
+    uint64_t eol;
+} compose_t;
+
+typedef void (*compose_fn)(const char *s, size_t len, compose_t *c);
+
+static inline void compose_add(compose_t *dst, const compose_t *src) {
+    dst->gc += src->gc;
+    dst->at += src->at;
+    dst->n += src->n;
+    dst->lower += src->lower;
+    dst->eol += src->eol;
+}
+
+static inline void compose_scalar(const char *s, size_t len, compose_t *c) {
+    uint64_t gc = 0, at = 0, n = 0, lower = 0, eol = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char b = (unsigned char)s[i];
+        unsigned char l = b | 0x20;
+        gc += (l == 'g') | (l == 'c');
+        at += (l == 'a') | (l == 't');
+        n += (l == 'n');
+        lower += (unsigned char)(b - 'a') <= 'z' - 'a';
+        eol += (b == '\n') | (b == '\r');
+    }
+    c->gc += gc;
+    c->at += at;
+    c->n += n;
+    c->lower += lower;
+    c->eol += eol;
+}
+
+#ifdef COMPOSE_X86
+
+// Per-byte counters are 0xFF masks subtracted from 8-bit accumulators, which
+// are folded into 64-bit sums with SAD before they can overflow (255 steps).
+
+__attribute__((target("sse2")))
+static inline uint64_t compose_fold_sse2(__m128i acc) {
+    __m128i sad = _mm_sad_epu8(acc, _mm_setzero_si128());
+    return (uint64_t)_mm_cvtsi128_si64(sad) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sad, sad));
+}
+
+__attribute__((target("sse2")))
+static void compose_sse2(const char *s, size_t len, compose_t *c) {
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i g = _mm_set1_epi8('g'), cc = _mm_set1_epi8('c');
+    const __m128i a = _mm_set1_epi8('a'), t = _mm_set1_epi8('t');
+    const __m128i n = _mm_set1_epi8('n');
+    const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    const __m128i az = _mm_set1_epi8('z' - 'a');
+    size_t i = 0;
+    while (i + 16 <= len) {
+        __m128i acc_gc = _mm_setzero_si128(), acc_at = _mm_setzero_si128();
+        __m128i acc_n = _mm_setzero_si128(), acc_lower = _mm_setzero_si128();
+        __m128i acc_eol = _mm_setzero_si128();
+        for (int k = 0; k < 255 && i + 16 <= len; k++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            __m128i l = _mm_or_si128(v, case_bit);
+            __m128i off = _mm_sub_epi8(v, a);
+            acc_gc = _mm_sub_epi8(acc_gc, _mm_or_si128(_mm_cmpeq_epi8(l, g), _mm_cmpeq_epi8(l, cc)));
+            acc_at = _mm_sub_epi8(acc_at, _mm_or_si128(_mm_cmpeq_epi8(l, a), _mm_cmpeq_epi8(l, t)));
+            acc_n = _mm_sub_epi8(acc_n, _mm_cmpeq_epi8(l, n));
+            acc_lower = _mm_sub_epi8(acc_lower, _mm_cmpeq_epi8(_mm_min_epu8(off, az), off));
+            acc_eol = _mm_sub_epi8(acc_eol, _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+        }
+        c->gc += compose_fold_sse2(acc_gc);
+        c->at += compose_fold_sse2(acc_at);
+        c->n += compose_fold_sse2(acc_n);
+        c->lower += compose_fold_sse2(acc_lower);
+        c->eol += compose_fold_sse2(acc_eol);
+    }
+    compose_scalar(s + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t compose_fold_avx2(__m256i acc) {
+    __m256i sad = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+    return (uint64_t)_mm256_extract_epi64(sad, 0) + (uint64_t)_mm256_extract_epi64(sad, 1) +
+           (uint64_t)_mm256_extract_epi64(sad, 2) + (uint64_t)_mm256_extract_epi64(sad, 3);
+}
+
+__attribute__((target("avx2")))
+static void compose_avx2(const char *s, size_t len, compose_t *c) {
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i g = _mm256_set1_epi8('g'), cc = _mm256_set1_epi8('c');
+    const __m256i a = _mm256_set1_epi8('a'), t = _mm256_set1_epi8('t');
+    const __m256i n = _mm256_set1_epi8('n');
+    const __m256i lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    const __m256i az = _mm256_set1_epi8('z' - 'a');
+    size_t i = 0;
+    while (i + 32 <= len) {
+        __m256i acc_gc = _mm256_setzero_si256(), acc_at = _mm256_setzero_si256();
+        __m256i acc_n = _mm256_setzero_si256(), acc_lower = _mm256_setzero_si256();
+        __m256i acc_eol = _mm256_setzero_si256();
+        for (int k = 0; k < 255 && i + 32 <= len; k++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+            __m256i l = _mm256_or_si256(v, case_bit);
+            __m256i off = _mm256_sub_epi8(v, a);
+            acc_gc = _mm256_sub_epi8(acc_gc, _mm256_or_si256(_mm256_cmpeq_epi8(l, g), _mm256_cmpeq_epi8(l, cc)));
+            acc_at = _mm256_sub_epi8(acc_at, _mm256_or_si256(_mm256_cmpeq_epi8(l, a), _mm256_cmpeq_epi8(l, t)));
+            acc_n = _mm256_sub_epi8(acc_n, _mm256_cmpeq_epi8(l, n));
+            acc_lower = _mm256_sub_epi8(acc_lower, _mm256_cmpeq_epi8(_mm256_min_epu8(off, az), off));
+            acc_eol = _mm256_sub_epi8(acc_eol, _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)));
+        }
+        c->gc += compose_fold_avx2(acc_gc);
+        c->at += compose_fold_avx2(acc_at);
+        c->n += compose_fold_avx2(acc_n);
+        c->lower += compose_fold_avx2(acc_lower);
+        c->eol += compose_fold_avx2(acc_eol);
+    }
+    compose_sse2(s + i, len - i, c);
+}
+
+// With AVX-512BW comparisons produce 64-bit masks that are counted directly
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static void compose_avx512(const char *s, size_t len, compose_t *c) {
+    const __m512i case_bit = _mm512_set1_epi8(0x20);
+    const __m512i g = _mm512_set1_epi8('g'), cc = _mm512_set1_epi8('c');
+    const __m512i a = _mm512_set1_epi8('a'), t = _mm512_set1_epi8('t');
+    const __m512i n = _mm512_set1_epi8('n');
+    const __m512i lf = _mm512_set1_epi8('\n'), cr = _mm512_set1_epi8('\r');
+    const __m512i az = _mm512_set1_epi8('z' - 'a');
+    uint64_t gc = 0, at = 0, nn = 0, lower = 0, eol = 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)(s + i));
+        __m512i l = _mm512_or_si512(v, case_bit);
+        gc += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(l, g) | _mm512_cmpeq_epi8_mask(l, cc));
+        at += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(l, a) | _mm512_cmpeq_epi8_mask(l, t));
+        nn += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(l, n));
+        lower += _mm_popcnt_u64(_mm512_cmple_epu8_mask(_mm512_sub_epi8(v, a), az));
+        eol += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, lf) | _mm512_cmpeq_epi8_mask(v, cr));
+    }
+    c->gc += gc;
+    c->at += at;
+    c->n += nn;
+    c->lower += lower;
+    c->eol += eol;
+    compose_avx2(s + i, len - i, c);
+}
+
+static inline compose_fn compose_resolve(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt")) return compose_avx512;
+    if (__builtin_cpu_supports("avx2")) return compose_avx2;
+    return compose_sse2;
+}
+
+#else
+
+static inline compose_fn compose_resolve(void) {
+    return compose_scalar;
+}
+
+#endif
+
+// Name of the kernel selected for this CPU
+static inline const char *compose_kernel_name(void) {
+    compose_fn fn = compose_resolve();
+#ifdef COMPOSE_X86
+    if (fn == compose_avx512) return "avx512bw";
+    if (fn == compose_avx2) return "avx2";
+    if (fn == compose_sse2) return "sse2";
+#endif
+    return fn == compose_scalar ? "scalar" : "unknown";
+}
+
+// Count the composition of `s` into `c` (counts are added, not reset)
+static inline void compose_count(const char *s, size_t len, compose_t *c) {
+    static compose_fn impl = NULL;
+    compose_fn fn = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+    if (!fn) {
+        fn = compose_resolve();
+        __atomic_store_n(&impl, fn, __ATOMIC_RELAXED);
+    }
+    fn(s, len, c);
+}
+
+#endif
@@ -8,6 +8,8 @@
 #include <errno.h>
 #include <getopt.h>
 
+#include "fxsrc.h"
+
 #define CHUNK_SIZE 1048576 // 1MB chunks
 #define NUM_THREADS 4
 
@@ -18,7 +20,7 @@ typedef enum {
 } FileFormat;
 
 typedef struct {
-    gzFile file;
+    fxsrc_t *file;
     size_t count;
     int thread_id;
     FileFormat format;
@@ -68,13 +70,12 @@ void *count_sequences(void *arg) {
 
     while (!global_error) {
         pthread_mutex_lock(&file_mutex);
-        bytes_read = gzread(data->file, buffer, CHUNK_SIZE);
-        int gz_err;
-        const char *gz_err_msg = gzerror(data->file, &gz_err);
+        bytes_read = (int)fxsrc_read(data->file, buffer, CHUNK_SIZE);
+        const char *err_msg = bytes_read < 0 ? fxsrc_error(data->file) : NULL;
         pthread_mutex_unlock(&file_mutex);
 
-        if (bytes_read < 0 || gz_err != Z_OK) {
-            fprintf(stderr, "Thread %d: gzread error: %s\n", data->thread_id, gz_err_msg);
+        if (bytes_read < 0) {
+            fprintf(stderr, "Thread %d: read error: %s\n", data->thread_id, err_msg);
             global_error = 1;
             break;
         }
@@ -109,6 +110,8 @@ void print_usage(const char *program_name) {
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  --fasta    Force FASTA format\n");
     fprintf(stderr, "  --fastq    Force FASTQ format\n");
+    fprintf(stderr, "  -x, --index Save an index next to a gzip file (FILE.gzidx) so that\n");
+    fprintf(stderr, "             later runs inflate it on several threads\n");
     fprintf(stderr, "  -h, --help Show this help message\n");
     fprintf(stderr, "\nFile format detection:\n");
     fprintf(stderr, "  .fq, .fq.gz, .fastq, .fastq.gz -> FASTQ\n");
@@ -118,10 +121,12 @@ void print_usage(const char *program_name) {
 int main(int argc, char **argv) {
     FileFormat format = FORMAT_AUTO;
     char *filename = NULL;
+    int build_index = 0;
     
     static struct option long_options[] = {
         {"fasta", no_argument, 0, 'a'},
         {"fastq", no_argument, 0, 'q'},
+        {"index", no_argument, 0, 'x'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -129,7 +134,7 @@ int main(int argc, char **argv) {
     int option_index = 0;
     int c;
     
-    while ((c = getopt_long(argc, argv, "aqh", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "aqxh", long_options, &option_index)) != -1) {
         switch (c) {
             case 'a':
                 format = FORMAT_FASTA;
@@ -137,6 +142,9 @@ int main(int argc, char **argv) {
             case 'q':
                 format = FORMAT_FASTQ;
                 break;
+            case 'x':
+                build_index = 1;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -161,8 +169,11 @@ int main(int argc, char **argv) {
         format = detect_format_from_extension(filename);
     }
 
-    gzFile file = gzopen(filename, "rb");
-    if (!file) {
+    fxsrc_t src;
+    fxsrc_t *file = &src;
+    // Parallel inflate only from an index, zlib on one thread otherwise
+    int inflate_threads = fxsrc_indexed(filename) ? NUM_THREADS : 1;
+    if (fxsrc_open_index(file, filename, inflate_threads, build_index) != 0) {
         fprintf(stderr, "Error: Cannot open file %s: %s\n", filename, strerror(errno));
         return 1;
     }
@@ -178,7 +189,7 @@ int main(int argc, char **argv) {
 
         if (pthread_create(&threads[i], NULL, count_sequences, &thread_data[i]) != 0) {
             fprintf(stderr, "Error creating thread %d: %s\n", i, strerror(errno));
-            gzclose(file);
+            fxsrc_close(file);
             return 1;
         }
     }
@@ -187,7 +198,7 @@ int main(int argc, char **argv) {
         pthread_join(threads[i], NULL);
     }
 
-    gzclose(file);
+    fxsrc_close(file);
 
     if (global_error) {
         fprintf(stderr, "An error occurred during processing. Results may be incomplete.\n");
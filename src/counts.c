@@ -8,28 +8,15 @@
 #include <errno.h>
 #include <stdatomic.h>
 
+#include "fxsrc.h"
+#include "chunkq.h"
+#include "trace.h"
+#include "hwcount.h"
+
 #define CHUNK_SIZE 1048576 // 1MB chunks
 #define NUM_THREADS 4
 #define MAX_THREADS 64
 
-typedef struct {
-    char *buffer;
-    int bytes_read;
-} Chunk;
-
-typedef struct ChunkNode {
-    Chunk chunk;
-    struct ChunkNode *next;
-} ChunkNode;
-
-typedef struct {
-    ChunkNode *head;
-    ChunkNode *tail;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    int producer_done;
-} ChunkQueue;
-
 typedef struct {
     ChunkQueue *queue;
     size_t newline_count;
@@ -39,13 +26,28 @@ typedef struct {
 pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
 atomic_int global_error = 0;
 
+// --hwcounters: every thread counts on its own and adds its counts here at the end
+int hwcounters = 0;
+pthread_mutex_t hw_mutex = PTHREAD_MUTEX_INITIALIZER;
+hwcount_sum_t hw_total;
+
+void hw_done(hwcount_t *hw, hwcount_sum_t *sum) {
+    pthread_mutex_lock(&hw_mutex);
+    hwcount_add(&hw_total, sum);
+    pthread_mutex_unlock(&hw_mutex);
+    hwcount_close(hw);
+}
+
 void *read_chunks(void *arg) {
-    gzFile file = ((void **)arg)[0];
+    fxsrc_t *file = ((void **)arg)[0];
     ChunkQueue *queue = ((void **)arg)[1];
     char *buffer;
     int bytes_read;
-    int gz_err;
-    const char *gz_err_msg;
+    trace_thread("producer");
+    hwcount_t hwc;
+    hwcount_t *hw = hwcounters && hwcount_open(&hwc) == 0 ? &hwc : NULL;
+    hwcount_sum_t hws;
+    memset(&hws, 0, sizeof(hws));
 
     while (1) {
         buffer = (char *)malloc(CHUNK_SIZE);
@@ -55,62 +57,38 @@ void *read_chunks(void *arg) {
             break;
         }
 
+        uint64_t span = trace_now();
+        if (hw) hwcount_lap(hw, &hws, PROF_OPEN);
         pthread_mutex_lock(&file_mutex);
-        bytes_read = gzread(file, buffer, CHUNK_SIZE);
-        gz_err_msg = gzerror(file, &gz_err);
+        bytes_read = (int)fxsrc_read(file, buffer, CHUNK_SIZE);
         pthread_mutex_unlock(&file_mutex);
+        if (hw) hwcount_lap(hw, &hws, PROF_DECOMPRESS);
+        if (bytes_read > 0) hws.bytes += bytes_read;
+        trace_span("read", span);
 
-        if (bytes_read < 0 || gz_err != Z_OK) {
-            fprintf(stderr, "Producer: gzread error: %s\n", gz_err_msg);
+        if (bytes_read < 0) {
+            fprintf(stderr, "Producer: read error: %s\n", fxsrc_error(file));
             atomic_store(&global_error, 1);
             free(buffer);
             break;
         }
 
-        Chunk *new_chunk = (Chunk *)malloc(sizeof(Chunk));
-        if (new_chunk == NULL) {
-            fprintf(stderr, "Producer: Memory allocation failed for chunk\n");
-            atomic_store(&global_error, 1);
-            free(buffer);
-            break;
-        }
-        new_chunk->buffer = buffer;
-        new_chunk->bytes_read = bytes_read;
-
-        pthread_mutex_lock(&queue->mutex);
-        ChunkNode *new_node = (ChunkNode *)malloc(sizeof(ChunkNode));
-        if (new_node == NULL) {
+        int depth = chunkq_push(queue, buffer, bytes_read);
+        if (depth < 0) {
             fprintf(stderr, "Producer: Memory allocation failed for chunk node\n");
             atomic_store(&global_error, 1);
             free(buffer);
-            free(new_chunk);
-            pthread_mutex_unlock(&queue->mutex);
             break;
         }
-        new_node->chunk = *new_chunk;
-        new_node->next = NULL;
-
-        if (queue->tail == NULL) {
-            queue->head = new_node;
-            queue->tail = new_node;
-        } else {
-            queue->tail->next = new_node;
-            queue->tail = new_node;
-        }
-        pthread_cond_signal(&queue->cond);
-        pthread_mutex_unlock(&queue->mutex);
-        
-        free(new_chunk); // Free the chunk structure after copying
+        trace_count("chunks", depth);
 
         if (bytes_read == 0) {
             break; // End of file
         }
     }
 
-    pthread_mutex_lock(&queue->mutex);
-    queue->producer_done = 1;
-    pthread_cond_broadcast(&queue->cond); // Wake up all consumers
-    pthread_mutex_unlock(&queue->mutex);
+    chunkq_finish(queue); // Wake up all consumers
+    if (hw) hw_done(hw, &hws);
 
     return NULL;
 }
@@ -121,31 +99,24 @@ void *count_newlines(void *arg) {
     ThreadData *data = (ThreadData *)arg;
     ChunkQueue *queue = data->queue;
     size_t local_count = 0;
+    trace_thread("consumer");
+    // Counting newlines is all the parsing fqc does
+    hwcount_t hwc;
+    hwcount_t *hw = hwcounters && hwcount_open(&hwc) == 0 ? &hwc : NULL;
+    hwcount_sum_t hws;
+    memset(&hws, 0, sizeof(hws));
 
-    while (1) {
-        pthread_mutex_lock(&queue->mutex);
-        while (queue->head == NULL && !queue->producer_done) {
-            pthread_cond_wait(&queue->cond, &queue->mutex);
-        }
-
-        if (queue->head == NULL && queue->producer_done) {
-            pthread_mutex_unlock(&queue->mutex);
-            break; // No more chunks and producer is done
-        }
-
-        ChunkNode *node = queue->head;
-        queue->head = queue->head->next;
-        if (queue->head == NULL) {
-            queue->tail = NULL;
-        }
-        pthread_mutex_unlock(&queue->mutex);
-
-        char *buffer = node->chunk.buffer;
-        int bytes_read = node->chunk.bytes_read;
+    Chunk chunk;
+    uint64_t span = trace_now();
+    while (chunkq_pop(queue, &chunk)) {
+        trace_span("wait", span);
+        span = trace_now();
+        if (hw) hwcount_lap(hw, &hws, PROF_OPEN);
+        char *buffer = chunk.buffer;
+        int bytes_read = chunk.bytes_read;
 
         if (bytes_read == 0) { // End of file chunk
             free(buffer);
-            free(node);
             break;
         }
 
@@ -161,16 +132,41 @@ void *count_newlines(void *arg) {
         }
 
         free(buffer);
-        free(node);
+        if (hw) hwcount_lap(hw, &hws, PROF_PARSE);
+        trace_span("count", span);
+        span = trace_now();
     }
+    trace_span("wait", span);
 
     data->newline_count = local_count;
+    if (hw) hw_done(hw, &hws);
     return NULL;
 }
 
 int main(int argc, char **argv) {
+    // -x saves an index next to a gzip file, later runs inflate it on several threads;
+    // --trace FILE writes a timeline of the producer and the consumers;
+    // --hwcounters prints the hardware counters of reading and counting
+    int build_index = 0;
+    const char *trace_path = NULL;
+    while (argc > 1) {
+        int shift = 1;
+        if (strcmp(argv[1], "-x") == 0 || strcmp(argv[1], "--index") == 0) {
+            build_index = 1;
+        } else if (strcmp(argv[1], "--hwcounters") == 0) {
+            hwcounters = 1;
+        } else if (argc > 2 && strcmp(argv[1], "--trace") == 0) {
+            trace_path = argv[2];
+            shift = 2;
+        } else {
+            break;
+        }
+        argv[shift] = argv[0];
+        argv += shift;
+        argc -= shift;
+    }
     if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: %s <fastq.gz file> [num_threads]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-x] [--trace FILE] [--hwcounters] <fastq.gz file> [num_threads]\n", argv[0]);
         return 1;
     }
 
@@ -184,21 +180,36 @@ int main(int argc, char **argv) {
     }
 
 
-    gzFile file = gzopen(argv[1], "rb");
-    if (!file) {
+    if (trace_path) {
+        trace_start("fqc");
+        trace_thread("main");
+    }
+    if (hwcounters) {
+        hwcount_t probe;
+        if (hwcount_open(&probe) != 0) {
+            fprintf(stderr, "Warning: hardware counters are not available (%s)\n", strerror(errno));
+            hwcounters = 0;
+        }
+        hwcount_close(&probe);
+    }
+
+    fxsrc_t src;
+    fxsrc_t *file = &src;
+    // Parallel inflate only from an index, zlib on this thread otherwise
+    int inflate_threads = fxsrc_indexed(argv[1]) ? num_threads : 1;
+    if (fxsrc_open_index(file, argv[1], inflate_threads, build_index) != 0) {
         fprintf(stderr, "Error: Cannot open file %s: %s\n", argv[1], strerror(errno));
         return 1;
     }
 
-    ChunkQueue queue = { .head = NULL, .tail = NULL, .producer_done = 0 };
-    pthread_mutex_init(&queue.mutex, NULL);
-    pthread_cond_init(&queue.cond, NULL);
+    ChunkQueue queue;
+    chunkq_init(&queue);
 
     pthread_t producer_thread;
     void *producer_args[2] = {file, &queue};
     if (pthread_create(&producer_thread, NULL, read_chunks, producer_args) != 0) {
         fprintf(stderr, "Error creating producer thread: %s\n", strerror(errno));
-        gzclose(file);
+        fxsrc_close(file);
         return 1;
     }
 
@@ -215,10 +226,7 @@ int main(int argc, char **argv) {
             
             // Signal producer to stop and join created threads
             atomic_store(&global_error, 1);
-            pthread_mutex_lock(&queue.mutex);
-            queue.producer_done = 1;
-            pthread_cond_broadcast(&queue.cond);
-            pthread_mutex_unlock(&queue.mutex);
+            chunkq_finish(&queue);
             
             pthread_join(producer_thread, NULL);
             
@@ -227,22 +235,23 @@ int main(int argc, char **argv) {
                 pthread_join(consumer_threads[j], NULL);
             }
             
-            gzclose(file);
-            pthread_mutex_destroy(&queue.mutex);
-            pthread_cond_destroy(&queue.cond);
+            fxsrc_close(file);
+            chunkq_destroy(&queue);
             return 1;
         }
     }
 
+    uint64_t span = trace_now();
     pthread_join(producer_thread, NULL);
     for (int i = 0; i < num_threads; i++) {
         pthread_join(consumer_threads[i], NULL);
     }
+    trace_span("join", span);
+    if (trace_path && trace_write(trace_path) != 0) fprintf(stderr, "Warning: cannot write the trace %s\n", trace_path);
 
-    gzclose(file);
+    fxsrc_close(file);
 
-    pthread_mutex_destroy(&queue.mutex);
-    pthread_cond_destroy(&queue.cond);
+    chunkq_destroy(&queue);
 
     if (atomic_load(&global_error)) {
         fprintf(stderr, "An error occurred during processing. Results may be incomplete.\n");
@@ -256,6 +265,10 @@ int main(int argc, char **argv) {
 
     size_t sequence_count = total_newlines / 4;
     printf("Total sequences: %zu\n", sequence_count);
+    if (hwcounters) {
+        fflush(stdout);
+        hwcount_print(stderr, &hw_total);
+    }
 
     return 0;
 }
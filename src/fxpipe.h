@@ -0,0 +1,718 @@
+/*
+ * fxpipe.h - statistics of one FASTA/FASTQ stream on several threads
+ *
+ * A single large file used to be read, parsed and counted by one thread.
+ * Here the work is split in three stages connected by bounded queues:
+ *
+ *   reader    pulls blocks of decompressed data from the source (which may
+ *             itself inflate on several threads, see fxsrc.h)
+ *   splitter  cuts the blocks into batches that end on a record start; the
+ *             record left over at the end of a block goes in front of the next,
+ *             or, when it outgrows that room, in a buffer of its own that the
+ *             next blocks are appended to until the record ends
+ *   workers   scan batches with fxscan.h into a length histogram and a base
+ *             composition of their own
+ *
+ * The batches are merged strictly in input order, and merging stops after
+ * a batch whose scan stopped early (malformed FASTQ), like the sequential
+ * loop does, so the result is the same as reading the file on one thread.
+ *
+ * A batch can only end where the sequential parser would start a record.
+ * For FASTA that is a line starting with '>'. For FASTQ, where a quality
+ * line may start with '@' too, it is a line starting with '@' that begins
+ * a 4-line record (header, sequence, '+', quality as long as the sequence)
+ * and follows another one. Multi-line FASTQ has no such lines and stays in
+ * one batch per block run, which is still correct, just not parallel.
+ *
+ * A file that is already in memory (uncompressed and mapped) needs no reader
+ * or splitter: it is cut into byte ranges of equal size, and every worker
+ * moves the start of its range forward to the first record start, using the
+ * same test, and scans up to the record start that begins the next range.
+ *
+ *   fxsplit_next()  offset of the first record start in a range of a buffer
+ *   fxsplit_last()  offset of the last record start in a buffer that is safe to cut at
+ *   fxpipe_scan()   add the records of a buffer to a histogram and a composition
+ *   fxpipe_run()    read a whole stream with `threads` workers
+ *   fxpipe_map()    the same for a buffer, split in byte ranges
+ *
+ * Records can be filtered by length (fxfilter_t): every batch and range counts
+ * the records it sees in a filter of its own, merged in order like the rest.
+ * Without a composition to count, only the lengths of the records are.
+ *
+ * With --trace (trace.h) the threads record their waits, the blocks they
+ * split and the batches they scan, and the depths of both queues. With
+ * --progress (progress.h) the records are counted per batch merged, and
+ * byte ranges add their bytes and records once scanned.
+ */
+#ifndef N50_FXPIPE_H
+#define N50_FXPIPE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fxscan.h"
+#include "lenhist.h"
+#include "compose.h"
+#include "trace.h"
+#include "progress.h"
+
+#define FXPIPE_BLOCK       (4 << 20)    // bytes the reader asks for at a time
+#define FXPIPE_HEAD        (1 << 20)    // room before a block for the record cut off the previous one
+#define FXPIPE_BLOCKS      4            // blocks read ahead of the splitter
+#define FXPIPE_MAX_THREADS 64
+#define FXPIPE_RANGES      4            // byte ranges per thread in fxpipe_map()
+
+/*
+ * Record boundaries
+ */
+
+// Length of the line [p, eol) as fxscan.h counts it, without a trailing '\r'
+static inline size_t fxsplit_line_len(const char *p, const char *eol) {
+    size_t l = eol - p;
+    if (l > 1 && p[l - 1] == '\r') l--;
+    return l;
+}
+
+// If a 4-line FASTQ record starts at `i`, the offset just past it, else 0
+static inline size_t fxsplit_frame(const char *buf, size_t len, size_t i) {
+    const char *end = buf + len;
+    const char *p = buf + i;
+    if (i >= len || *p != '@') return 0;
+    const char *eol = memchr(p, '\n', end - p);
+    if (!eol) return 0;
+    const char *seq = eol + 1;
+    const char *seq_eol = memchr(seq, '\n', end - seq);
+    if (!seq_eol || seq_eol + 1 >= end || seq_eol[1] != '+') return 0;
+    if (seq < seq_eol && (*seq == '>' || *seq == '@' || *seq == '+')) return 0;
+    const char *plus_eol = memchr(seq_eol + 1, '\n', end - seq_eol - 1);
+    if (!plus_eol) return 0;
+    const char *qual = plus_eol + 1;
+    const char *qual_eol = memchr(qual, '\n', end - qual);
+    if (!qual_eol) return 0;
+    if (fxsplit_line_len(seq, seq_eol) != fxsplit_line_len(qual, qual_eol)) return 0;
+    return qual_eol + 1 - buf;
+}
+
+// Start of the line `n` lines before the one starting at `i`, or -1
+static inline long fxsplit_back(const char *buf, size_t i, int n) {
+    while (n-- > 0) {
+        if (i == 0) return -1;
+        i--;                            // the '\n' ending the previous line
+        while (i > 0 && buf[i - 1] != '\n') i--;
+    }
+    return (long)i;
+}
+
+// Is `i` (at a line start) a record start the sequential parser also sees?
+static inline int fxsplit_is_record(const char *buf, size_t len, size_t i, int fastq) {
+    if (!fastq) return buf[i] == '>';
+    size_t next = fxsplit_frame(buf, len, i);
+    if (!next || (next < len && buf[next] != '@')) return 0;
+    long prev = fxsplit_back(buf, i, 4);
+    return prev >= 0 && fxsplit_frame(buf, len, prev) == i;
+}
+
+// Offset of the first record start in [from, to), or `len` if there is none
+// there. The record itself may run past `to`.
+static inline size_t fxsplit_next(const char *buf, size_t len, size_t from, size_t to, int fastq) {
+    if (from < 1) from = 1;
+    if (to > len) to = len;
+    size_t i = from;
+    while (i < to) {
+        if (buf[i - 1] == '\n' && (buf[i] == '>' || buf[i] == '@') && fxsplit_is_record(buf, len, i, fastq)) return i;
+        const char *eol = memchr(buf + i, '\n', to - i);
+        if (!eol) break;
+        i = eol + 1 - buf;
+    }
+    return len;
+}
+
+// Offset of the last record start in `buf` after offset 0, or 0 if there is
+// none. Starts before `from` are known not to qualify. `fastq` is 1 for
+// FASTQ, 0 for FASTA.
+static inline size_t fxsplit_last(const char *buf, size_t len, size_t from, int fastq) {
+    if (from < 1) from = 1;
+    for (size_t i = len; i-- > from;) {
+        if (buf[i - 1] != '\n' || (buf[i] != '>' && buf[i] != '@')) continue;
+        if (fxsplit_is_record(buf, len, i, fastq)) return i;
+    }
+    return 0;
+}
+
+/*
+ * Scanning
+ */
+
+typedef struct {
+    const char *p;
+    size_t left;
+} fxpipe_tail_t;
+
+// Hand out a buffer, then fail like a source that breaks off there
+static inline long fxpipe_tail_read(void *ctx, char *buf, size_t cap) {
+    fxpipe_tail_t *t = (fxpipe_tail_t *)ctx;
+    if (!t->left) return -1;
+    size_t n = t->left < cap ? t->left : cap;
+    memcpy(buf, t->p, n);
+    t->p += n;
+    t->left -= n;
+    return (long)n;
+}
+
+// Add the records of `buf` kept by `filter` (NULL keeps all) to `hist` and
+// `comp` (NULL skips the composition, which leaves only the lengths to count
+// and the bases unread). `broken` means the input ended with a read error right after `buf`.
+// Returns the last result of fxscan_next() (0 at the end, < 0 when it stopped
+// early) or -3 if memory ran out.
+static inline int fxpipe_scan(const char *buf, size_t len, int broken, fxfilter_t *filter, lenhist_t *hist,
+                              compose_t *comp) {
+    fxscan_t scan;
+    fxpipe_tail_t tail = {buf, len};
+    if (!broken) fxscan_init_buffer(&scan, buf, len);
+    else if (fxscan_init_reader(&scan, fxpipe_tail_read, &tail) != 0) return -3;
+    fxrec_t rec;
+    int ret;
+    while ((ret = fxscan_next(&scan, &rec)) > 0) {
+        if (filter && !fxfilter_keep(filter, rec.len)) continue;
+        if (lenhist_add(hist, rec.len) != 0) {
+            ret = -3;
+            break;
+        }
+        if (comp) compose_count(rec.seq, rec.bytes, comp);
+    }
+    fxscan_destroy(&scan);
+    return ret;
+}
+
+/*
+ * Pipeline
+ */
+
+typedef struct fxpipe_buf {
+    struct fxpipe_buf *next;    // in the free list
+    char *data;
+    size_t cap;
+    size_t start, len;          // bytes in use
+} fxpipe_buf_t;
+
+enum {
+    FXPIPE_EMPTY,
+    FXPIPE_PENDING,
+    FXPIPE_RUNNING,
+    FXPIPE_DONE
+};
+
+typedef struct {
+    fxpipe_buf_t *buf;
+    int state;
+    int broken;                 // last batch before a read error
+    int ret;                    // fxpipe_scan() result
+    lenhist_t hist;
+    compose_t comp;
+    fxfilter_t filter;
+} fxpipe_batch_t;
+
+typedef struct {
+    fxscan_read_fn read;
+    void *ctx;
+    lenhist_t *hist;            // merged results
+    compose_t *comp;
+    fxfilter_t *filter;         // NULL, or the filter and the merged counts of all records
+
+    fxpipe_buf_t *blocks[FXPIPE_BLOCKS];
+    int block_head, nblocks;
+    int eof, broken;            // no more blocks; the source failed
+    int broken_sent;            // the last batch was handed out marked broken
+    fxpipe_buf_t *free;
+
+    int nslots;
+    fxpipe_batch_t *slots;      // batch b lives in slots[b % nslots]
+    uint64_t emitted;           // batches handed to the workers
+    uint64_t merged;            // batches [0, merged) are merged
+    int split_done;
+    int stop;                   // a scan stopped early or memory ran out
+    int error;                  // memory ran out
+    int ret;                    // first nonzero scan result
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} fxpipe_t;
+
+// Callers hold the mutex
+static inline fxpipe_buf_t *fxpipe_buf_get(fxpipe_t *g) {
+    fxpipe_buf_t *b = g->free;
+    if (b) {
+        g->free = b->next;
+        return b;
+    }
+    b = malloc(sizeof(fxpipe_buf_t));
+    if (!b) return NULL;
+    b->data = malloc(FXPIPE_HEAD + FXPIPE_BLOCK);
+    if (!b->data) {
+        free(b);
+        return NULL;
+    }
+    b->cap = FXPIPE_HEAD + FXPIPE_BLOCK;
+    return b;
+}
+
+// Buffers of another size (long records) are not kept. Callers hold the mutex.
+static inline void fxpipe_buf_put(fxpipe_t *g, fxpipe_buf_t *b) {
+    if (!b) return;
+    if (b->cap != FXPIPE_HEAD + FXPIPE_BLOCK) {
+        free(b->data);
+        free(b);
+        return;
+    }
+    b->next = g->free;
+    g->free = b;
+}
+
+static void *fxpipe_reader(void *arg) {
+    fxpipe_t *g = (fxpipe_t *)arg;
+    trace_thread("reader");
+    for (;;) {
+        pthread_mutex_lock(&g->mutex);
+        uint64_t t = trace_now();
+        while (!g->stop && g->nblocks == FXPIPE_BLOCKS) pthread_cond_wait(&g->cond, &g->mutex);
+        trace_span("wait", t);
+        fxpipe_buf_t *b = g->stop ? NULL : fxpipe_buf_get(g);
+        if (!b) {
+            if (!g->stop) g->error = g->stop = 1;
+            g->eof = 1;
+            pthread_cond_broadcast(&g->cond);
+            pthread_mutex_unlock(&g->mutex);
+            return NULL;
+        }
+        pthread_mutex_unlock(&g->mutex);
+
+        b->start = FXPIPE_HEAD;
+        b->len = 0;
+        long n = 0;
+        while (b->len < FXPIPE_BLOCK && (n = g->read(g->ctx, b->data + FXPIPE_HEAD + b->len, FXPIPE_BLOCK - b->len)) > 0) {
+            b->len += n;
+        }
+
+        pthread_mutex_lock(&g->mutex);
+        if (b->len) {
+            g->blocks[(g->block_head + g->nblocks) % FXPIPE_BLOCKS] = b;
+            g->nblocks++;
+            trace_count("blocks", g->nblocks);
+        } else {
+            fxpipe_buf_put(g, b);
+        }
+        if (n <= 0) {
+            g->eof = 1;
+            g->broken = n < 0;
+        }
+        int eof = g->eof;
+        pthread_cond_broadcast(&g->cond);
+        pthread_mutex_unlock(&g->mutex);
+        if (eof) return NULL;
+    }
+}
+
+// Hand a batch to the workers. Returns -1 if the pipeline stopped.
+static inline int fxpipe_emit(fxpipe_t *g, fxpipe_buf_t *b, int broken) {
+    pthread_mutex_lock(&g->mutex);
+    uint64_t t = trace_now();
+    while (!g->stop && g->emitted - g->merged >= (uint64_t)g->nslots) pthread_cond_wait(&g->cond, &g->mutex);
+    trace_span("wait", t);
+    if (g->stop) {
+        fxpipe_buf_put(g, b);
+        pthread_mutex_unlock(&g->mutex);
+        return -1;
+    }
+    fxpipe_batch_t *s = &g->slots[g->emitted % g->nslots];
+    s->buf = b;
+    s->broken = broken;
+    s->state = FXPIPE_PENDING;
+    g->emitted++;
+    trace_count("batches", g->emitted - g->merged);
+    pthread_cond_broadcast(&g->cond);
+    pthread_mutex_unlock(&g->mutex);
+    return 0;
+}
+
+// Make `*carry` hold `n` more bytes
+static inline int fxpipe_carry_grow(char **carry, size_t *cap, size_t need) {
+    if (need <= *cap) return 0;
+    size_t c = *cap ? *cap : FXPIPE_HEAD;
+    while (c < need) c *= 2;
+    char *p = realloc(*carry, c);
+    if (!p) return -1;
+    *carry = p;
+    *cap = c;
+    return 0;
+}
+
+static void *fxpipe_splitter(void *arg) {
+    fxpipe_t *g = (fxpipe_t *)arg;
+    char *carry = NULL;             // start of a record the last block cut off
+    size_t carry_len = 0, carry_cap = 0;
+    int fastq = -1;                 // unknown until the first '>' or '@'
+    int oom = 0;
+    trace_thread("splitter");
+
+    for (;;) {
+        pthread_mutex_lock(&g->mutex);
+        uint64_t t = trace_now();
+        while (!g->stop && !g->nblocks && !g->eof) pthread_cond_wait(&g->cond, &g->mutex);
+        trace_span("wait", t);
+        if (g->stop || (!g->nblocks && g->eof)) {
+            int last = !g->stop && carry_len > 0;
+            int broken = g->broken;
+            fxpipe_buf_t *b = NULL;
+            if (last) {
+                // The carry becomes the last batch
+                b = malloc(sizeof(fxpipe_buf_t));
+                if (b) {
+                    b->data = carry;
+                    b->cap = carry_cap;
+                    b->start = 0;
+                    b->len = carry_len;
+                    carry = NULL;
+                } else {
+                    g->error = g->stop = 1;
+                }
+            }
+            pthread_mutex_unlock(&g->mutex);
+            if (b && fxpipe_emit(g, b, broken) == 0) g->broken_sent = broken;
+            break;
+        }
+        fxpipe_buf_t *b = g->blocks[g->block_head];
+        g->block_head = (g->block_head + 1) % FXPIPE_BLOCKS;
+        g->nblocks--;
+        trace_count("blocks", g->nblocks);
+        pthread_cond_broadcast(&g->cond);
+        pthread_mutex_unlock(&g->mutex);
+        t = trace_now();
+
+        int gathered = carry_len > FXPIPE_HEAD;
+        if (!gathered) {
+            b->start -= carry_len;
+            if (carry_len) memcpy(b->data + b->start, carry, carry_len);
+            b->len += carry_len;
+        } else {
+            // A record longer than the head room: append the block to the
+            // carry, which grows by doubling, and scan the carry in place
+            fxpipe_buf_t *w = malloc(sizeof(fxpipe_buf_t));
+            if (!w || fxpipe_carry_grow(&carry, &carry_cap, carry_len + b->len) != 0) {
+                free(w);
+                oom = 1;
+                pthread_mutex_lock(&g->mutex);
+                fxpipe_buf_put(g, b);
+                pthread_mutex_unlock(&g->mutex);
+                break;
+            }
+            memcpy(carry + carry_len, b->data + b->start, b->len);
+            w->data = carry;
+            w->cap = carry_cap;
+            w->start = 0;
+            w->len = carry_len + b->len;
+            carry = NULL;
+            carry_cap = 0;
+            pthread_mutex_lock(&g->mutex);
+            fxpipe_buf_put(g, b);
+            pthread_mutex_unlock(&g->mutex);
+            b = w;
+        }
+        const char *data = b->data + b->start;
+        // The carry was already searched, except for records its end cut short
+        size_t from = carry_len;
+        if (fastq == 1) {
+            while (from > 0 && data[from - 1] != '\n') from--;
+            long prev = fxsplit_back(data, from, 4);
+            from = prev < 0 ? 0 : (size_t)prev;
+        }
+
+        if (fastq < 0) {
+            for (size_t i = carry_len; i < b->len; i++) {
+                if (data[i] == '>' || data[i] == '@') {
+                    fastq = data[i] == '@';
+                    break;
+                }
+            }
+        }
+        carry_len = 0;
+        size_t cut = fastq < 0 ? 0 : fxsplit_last(data, b->len, from, fastq);
+        if (!cut && gathered) {
+            // Still the same record: the whole buffer stays the carry, uncopied
+            carry = b->data;
+            carry_cap = b->cap;
+            carry_len = b->len;
+            free(b);
+            trace_span("split", t);
+            continue;
+        }
+        size_t tail = cut ? b->len - cut : b->len;
+        if (fxpipe_carry_grow(&carry, &carry_cap, tail) != 0) {
+            oom = 1;
+            pthread_mutex_lock(&g->mutex);
+            fxpipe_buf_put(g, b);
+            pthread_mutex_unlock(&g->mutex);
+            break;
+        }
+        memcpy(carry, data + b->len - tail, tail);
+        carry_len = tail;
+        trace_span("split", t);
+        if (!cut) {
+            pthread_mutex_lock(&g->mutex);
+            fxpipe_buf_put(g, b);
+            pthread_mutex_unlock(&g->mutex);
+            continue;
+        }
+        b->len = cut;
+        if (fxpipe_emit(g, b, 0) != 0) break;
+    }
+    free(carry);
+
+    pthread_mutex_lock(&g->mutex);
+    if (oom) g->error = g->stop = 1;
+    g->split_done = 1;
+    pthread_cond_broadcast(&g->cond);
+    pthread_mutex_unlock(&g->mutex);
+    return NULL;
+}
+
+// Merge the batches that are done, in order. Callers hold the mutex.
+static inline void fxpipe_merge(fxpipe_t *g) {
+    while (g->merged < g->emitted) {
+        fxpipe_batch_t *s = &g->slots[g->merged % g->nslots];
+        if (s->state != FXPIPE_DONE) break;
+        if (!g->stop) {
+            if (lenhist_merge(g->hist, &s->hist) != 0 || s->ret == -3) g->error = 1;
+            if (g->comp) compose_add(g->comp, &s->comp);
+            if (g->filter) {
+                g->filter->seqs += s->filter.seqs;
+                g->filter->bases += s->filter.bases;
+                progress_add(0, 0, s->filter.seqs, s->filter.bases);
+            } else {
+                progress_add(0, 0, s->hist.n, s->hist.total);
+            }
+            if (s->ret != 0) {
+                g->stop = 1;                // the sequential loop ends here too
+                g->ret = s->ret;
+            }
+        }
+        lenhist_reset(&s->hist);
+        memset(&s->comp, 0, sizeof(s->comp));
+        fxpipe_buf_put(g, s->buf);
+        s->buf = NULL;
+        s->state = FXPIPE_EMPTY;
+        g->merged++;
+    }
+    pthread_cond_broadcast(&g->cond);
+}
+
+static void *fxpipe_worker(void *arg) {
+    fxpipe_t *g = (fxpipe_t *)arg;
+    trace_thread("scan worker");
+    pthread_mutex_lock(&g->mutex);
+    for (;;) {
+        fxpipe_batch_t *s = NULL;
+        for (uint64_t b = g->merged; b < g->emitted && !g->stop; b++) {
+            if (g->slots[b % g->nslots].state == FXPIPE_PENDING) {
+                s = &g->slots[b % g->nslots];
+                break;
+            }
+        }
+        if (!s) {
+            if (g->stop || (g->split_done && g->merged == g->emitted)) break;
+            uint64_t t = trace_now();
+            pthread_cond_wait(&g->cond, &g->mutex);
+            trace_span("wait", t);
+            continue;
+        }
+        s->state = FXPIPE_RUNNING;
+        if (g->filter) fxfilter_init(&s->filter, g->filter->min, g->filter->max);
+        pthread_mutex_unlock(&g->mutex);
+
+        uint64_t t = trace_now();
+        s->ret = fxpipe_scan(s->buf->data + s->buf->start, s->buf->len, s->broken, g->filter ? &s->filter : NULL,
+                             &s->hist, g->comp ? &s->comp : NULL);
+        trace_span("scan", t);
+
+        pthread_mutex_lock(&g->mutex);
+        s->state = FXPIPE_DONE;
+        fxpipe_merge(g);
+        trace_count("batches", g->emitted - g->merged);
+    }
+    pthread_cond_broadcast(&g->cond);
+    pthread_mutex_unlock(&g->mutex);
+    return NULL;
+}
+
+// Read the stream `read(ctx)` to its end and add the records kept by `filter`
+// (NULL keeps all) to `hist` and `comp` (NULL for none), as a loop over fxscan_next() would.
+// Returns what that loop ends with (0 at the end, -1 on malformed FASTQ, -2
+// on a read error), or -3 if memory or threads ran out.
+static inline int fxpipe_run(fxscan_read_fn read, void *ctx, int threads, fxfilter_t *filter, lenhist_t *hist,
+                             compose_t *comp) {
+    if (threads > FXPIPE_MAX_THREADS) threads = FXPIPE_MAX_THREADS;
+    if (threads < 1) threads = 1;
+    fxpipe_t g;
+    memset(&g, 0, sizeof(g));
+    g.read = read;
+    g.ctx = ctx;
+    g.hist = hist;
+    g.comp = comp;
+    g.filter = filter;
+    g.nslots = 2 * threads;
+    g.slots = calloc(g.nslots, sizeof(fxpipe_batch_t));
+    if (!g.slots) return -3;
+    for (int i = 0; i < g.nslots; i++) lenhist_init(&g.slots[i].hist);
+    pthread_mutex_init(&g.mutex, NULL);
+    pthread_cond_init(&g.cond, NULL);
+
+    pthread_t reader, splitter, workers[FXPIPE_MAX_THREADS];
+    int nworkers = 0, have_reader = 0, have_splitter = 0;
+    have_reader = pthread_create(&reader, NULL, fxpipe_reader, &g) == 0;
+    have_splitter = have_reader && pthread_create(&splitter, NULL, fxpipe_splitter, &g) == 0;
+    while (have_splitter && nworkers < threads && pthread_create(&workers[nworkers], NULL, fxpipe_worker, &g) == 0) {
+        nworkers++;
+    }
+    if (!have_splitter || nworkers == 0) {
+        pthread_mutex_lock(&g.mutex);
+        g.error = g.stop = 1;
+        pthread_cond_broadcast(&g.cond);
+        pthread_mutex_unlock(&g.mutex);
+    }
+    if (have_reader) pthread_join(reader, NULL);
+    if (have_splitter) pthread_join(splitter, NULL);
+    for (int i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+
+    for (int i = 0; i < g.nslots; i++) {
+        lenhist_free(&g.slots[i].hist);
+        fxpipe_buf_put(&g, g.slots[i].buf);
+    }
+    for (int i = 0; i < g.nblocks; i++) fxpipe_buf_put(&g, g.blocks[(g.block_head + i) % FXPIPE_BLOCKS]);
+    while (g.free) {
+        fxpipe_buf_t *b = g.free;
+        g.free = b->next;
+        free(b->data);
+        free(b);
+    }
+    free(g.slots);
+    pthread_mutex_destroy(&g.mutex);
+    pthread_cond_destroy(&g.cond);
+    if (g.error || !have_splitter) return -3;
+    // A read error with nothing left to scan, e.g. before the first byte, ends the loop too
+    if (g.ret == 0 && g.broken && !g.broken_sent) return -2;
+    return g.ret;
+}
+
+/*
+ * Byte ranges of a buffer
+ */
+
+typedef struct {
+    int ret;                    // fxpipe_scan() result
+    lenhist_t hist;
+    compose_t comp;
+    fxfilter_t filter;
+} fxpipe_range_t;
+
+typedef struct {
+    const char *buf;
+    size_t len;
+    size_t width;               // bytes per range, the last one takes the rest
+    int fastq;
+    const fxfilter_t *filter;   // limits of the filter, NULL for none
+    int compose;                // count the composition of the ranges
+    int nranges;
+    int next;                   // next range to scan
+    fxpipe_range_t *ranges;
+    pthread_mutex_t mutex;
+} fxpipe_map_t;
+
+static void *fxpipe_map_worker(void *arg) {
+    fxpipe_map_t *m = (fxpipe_map_t *)arg;
+    trace_thread("range worker");
+    for (;;) {
+        pthread_mutex_lock(&m->mutex);
+        int k = m->next < m->nranges ? m->next++ : -1;
+        pthread_mutex_unlock(&m->mutex);
+        if (k < 0) return NULL;
+
+        // Range k owns the records that start in it
+        size_t lo = (size_t)k * m->width;
+        size_t hi = k + 1 < m->nranges ? lo + m->width : m->len;
+        size_t start = k == 0 ? 0 : fxsplit_next(m->buf, m->len, lo, hi, m->fastq);
+        if (start >= hi) continue;
+        size_t end = k + 1 < m->nranges ? fxsplit_next(m->buf, m->len, hi, m->len, m->fastq) : m->len;
+        fxpipe_range_t *r = &m->ranges[k];
+        uint64_t t = trace_now();
+        if (m->filter) fxfilter_init(&r->filter, m->filter->min, m->filter->max);
+        r->ret = fxpipe_scan(m->buf + start, end - start, 0, m->filter ? &r->filter : NULL, &r->hist,
+                             m->compose ? &r->comp : NULL);
+        trace_span("scan", t);
+        if (m->filter) progress_add(end - start, end - start, r->filter.seqs, r->filter.bases);
+        else progress_add(end - start, end - start, r->hist.n, r->hist.total);
+    }
+}
+
+// Add the records of the whole buffer `buf` kept by `filter` to `hist` and
+// `comp` (NULL for none) with up to `threads` threads. Returns the same as fxpipe_run().
+static inline int fxpipe_map(const char *buf, size_t len, int threads, fxfilter_t *filter, lenhist_t *hist,
+                             compose_t *comp) {
+    if (threads > FXPIPE_MAX_THREADS) threads = FXPIPE_MAX_THREADS;
+    if (threads < 1) threads = 1;
+    fxpipe_map_t m;
+    memset(&m, 0, sizeof(m));
+    m.buf = buf;
+    m.len = len;
+    m.fastq = -1;
+    m.filter = filter;
+    m.compose = comp != NULL;
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '>' || buf[i] == '@') {
+            m.fastq = buf[i] == '@';
+            break;
+        }
+    }
+    // Small inputs, and inputs without any record, are not worth splitting
+    size_t nranges = (size_t)threads * FXPIPE_RANGES;
+    if (nranges > len / FXPIPE_BLOCK) nranges = len / FXPIPE_BLOCK;
+    if (nranges < 1 || m.fastq < 0) nranges = 1;
+    m.nranges = (int)nranges;
+    m.width = len / nranges;
+    m.ranges = calloc(nranges, sizeof(fxpipe_range_t));
+    if (!m.ranges) return -3;
+    for (int k = 0; k < m.nranges; k++) lenhist_init(&m.ranges[k].hist);
+    pthread_mutex_init(&m.mutex, NULL);
+
+    pthread_t workers[FXPIPE_MAX_THREADS];
+    int nworkers = 0;
+    if (threads > m.nranges) threads = m.nranges;
+    while (nworkers < threads - 1 && pthread_create(&workers[nworkers], NULL, fxpipe_map_worker, &m) == 0) {
+        nworkers++;
+    }
+    fxpipe_map_worker(&m);
+    for (int i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+
+    // Merge in order, stopping where the sequential loop would
+    int ret = 0;
+    for (int k = 0; k < m.nranges; k++) {
+        fxpipe_range_t *r = &m.ranges[k];
+        if (ret != -3 && lenhist_merge(hist, &r->hist) != 0) ret = -3;
+        if (comp) compose_add(comp, &r->comp);
+        if (filter) {
+            filter->seqs += r->filter.seqs;
+            filter->bases += r->filter.bases;
+        }
+        lenhist_free(&r->hist);
+        if (r->ret != 0) {
+            if (ret == 0) ret = r->ret;
+            for (k++; k < m.nranges; k++) lenhist_free(&m.ranges[k].hist);
+            break;
+        }
+    }
+    free(m.ranges);
+    pthread_mutex_destroy(&m.mutex);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * fxscan.h - zero-copy FASTA/FASTQ record scanner for statistics
+ *
+ * kseq copies every name, sequence and quality byte into its own strings.
+ * For statistics we only need the length of each sequence and its bytes
+ * once, so this scanner finds records with memchr() over the input block
+ * and hands out the sequence as a span of the block itself: for multi-line
+ * FASTA the span still contains the line breaks, which compose_count()
+ * counts separately. Names and qualities are skipped, never copied.
+ *
+ * Input is either a whole buffer (e.g. a memory mapped file) or a read
+ * callback. In the second case the partial record at the end of a block is
+ * moved to the front of the buffer before reading more, so every record is
+ * contiguous; the buffer grows if a single record does not fit. A caller
+ * that keeps records for later can set `flush`, which is called before the
+ * buffer is moved, while every record handed out so far is still valid.
+ *
+ * Parsing follows kseq: a record starts at '>' or '@', sequence lines run
+ * until a line starting with '>', '@' or '+', a trailing '\r' is not part
+ * of the sequence, and FASTQ quality lines are read until they are at least
+ * as long as the sequence.
+ *
+ * A length filter (fxfilter_t) lets a record loop skip records that are too
+ * short or too long before their bases are looked at, while it counts every
+ * record, so one pass gives the statistics of the records kept and the
+ * totals of the whole input.
+ */
+#ifndef N50_FXSCAN_H
+#define N50_FXSCAN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FXSCAN_BUFSIZE (1 << 20)
+#define FXSCAN_MAX_READ (1 << 30)
+
+// Fill `buf` with up to `cap` bytes: returns the number of bytes, 0 at EOF, < 0 on error
+typedef long (*fxscan_read_fn)(void *ctx, char *buf, size_t cap);
+
+typedef struct {
+    const char *seq;    // sequence bytes, line breaks included for multi-line FASTA
+    size_t bytes;       // size of the span starting at seq
+    uint64_t len;       // number of bases
+} fxrec_t;
+
+typedef struct {
+    uint64_t min, max;  // records outside [min, max] are skipped
+    uint64_t seqs;      // records seen, kept or not
+    uint64_t bases;
+} fxfilter_t;
+
+static inline void fxfilter_init(fxfilter_t *f, uint64_t min, uint64_t max) {
+    f->min = min;
+    f->max = max;
+    f->seqs = f->bases = 0;
+}
+
+// Count a record of `len` bases, return whether it is kept
+static inline int fxfilter_keep(fxfilter_t *f, uint64_t len) {
+    f->seqs++;
+    f->bases += len;
+    return len >= f->min && len <= f->max;
+}
+
+enum {
+    FXSCAN_FIND,        // looking for the next '>' or '@'
+    FXSCAN_HEADER,      // inside the header line
+    FXSCAN_SEQ,         // at the start of a sequence line
+    FXSCAN_PLUS,        // inside the '+' line of a FASTQ record
+    FXSCAN_QUAL         // at the start of a quality line
+};
+
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t pos;             // parse position
+    size_t end;             // end of valid data
+    int eof;                // no more data after `end`
+    int owned;              // buf was allocated by the scanner
+    fxscan_read_fn read;
+    void *ctx;
+    uint64_t consumed;      // input bytes dropped from the front of buf so far
+    void (*flush)(void *ctx);   // optional, called before the buffer is moved or refilled
+    void *flush_ctx;
+
+    // Record being parsed, offsets are relative to buf
+    int stage;
+    size_t rec;             // start of the record, kept across refills
+    size_t seq_start, seq_end;
+    uint64_t len, qual, qual_lines;
+} fxscan_t;
+
+// Scan a complete in-memory input, e.g. a memory mapped file
+static inline void fxscan_init_buffer(fxscan_t *s, const char *buf, size_t size) {
+    memset(s, 0, sizeof(*s));
+    s->buf = (char *)buf;
+    s->cap = s->end = size;
+    s->eof = 1;
+}
+
+// Scan an input delivered block by block by `read`. Returns -1 on allocation failure.
+static inline int fxscan_init_reader(fxscan_t *s, fxscan_read_fn read, void *ctx) {
+    memset(s, 0, sizeof(*s));
+    s->buf = malloc(FXSCAN_BUFSIZE);
+    if (!s->buf) return -1;
+    s->cap = FXSCAN_BUFSIZE;
+    s->owned = 1;
+    s->read = read;
+    s->ctx = ctx;
+    return 0;
+}
+
+static inline void fxscan_destroy(fxscan_t *s) {
+    if (s->owned) free(s->buf);
+    s->buf = NULL;
+}
+
+// Input bytes parsed so far
+static inline uint64_t fxscan_offset(const fxscan_t *s) {
+    return s->consumed + s->pos;
+}
+
+// Move the current record to the front of the buffer and read more data.
+// Returns 0 on success (possibly setting eof) and -1 on error.
+static inline int fxscan_fill(fxscan_t *s) {
+    if (s->eof) return 0;
+    if (s->flush) s->flush(s->flush_ctx);
+    size_t keep = s->rec;
+    if (keep > 0) {
+        memmove(s->buf, s->buf + keep, s->end - keep);
+        s->end -= keep;
+        s->pos -= keep;
+        s->seq_start -= keep;
+        s->seq_end -= keep;
+        s->rec = 0;
+        s->consumed += keep;
+    }
+    if (s->end == s->cap) {
+        char *buf = realloc(s->buf, s->cap * 2);
+        if (!buf) return -1;
+        s->buf = buf;
+        s->cap *= 2;
+    }
+    size_t room = s->cap - s->end;
+    long n = s->read(s->ctx, s->buf + s->end, room < FXSCAN_MAX_READ ? room : FXSCAN_MAX_READ);
+    if (n < 0) return -1;
+    if (n == 0) s->eof = 1;
+    s->end += n;
+    return 0;
+}
+
+static inline void fxscan_emit(fxscan_t *s, fxrec_t *r) {
+    r->seq = s->buf + s->seq_start;
+    r->bytes = s->seq_end - s->seq_start;
+    r->len = s->len;
+}
+
+// Length of the line starting at `pos`, without the trailing '\r' kseq drops
+static inline size_t fxscan_line(const fxscan_t *s, const char *eol, uint64_t before) {
+    size_t l = eol - (s->buf + s->pos);
+    if (l && s->buf[s->pos + l - 1] == '\r' && before + l > 1) l--;
+    return l;
+}
+
+// Next record: returns 1 and fills `r`, 0 at the end of the input, -1 on a
+// malformed FASTQ record (quality shorter than the sequence) and -2 on a
+// read or allocation error. The span in `r` is valid until the next call.
+static inline int fxscan_next(fxscan_t *s, fxrec_t *r) {
+    for (;;) {
+        const char *p = s->buf + s->pos;
+        size_t avail = s->end - s->pos;
+        const char *eol;
+
+        if (avail == 0 && !s->eof) {
+            if (s->stage == FXSCAN_FIND) s->rec = s->pos;
+            if (fxscan_fill(s) != 0) return -2;
+            continue;
+        }
+
+        switch (s->stage) {
+        case FXSCAN_FIND: {
+            size_t i = 0;
+            while (i < avail && p[i] != '>' && p[i] != '@') i++;
+            s->pos += i;
+            s->rec = s->pos;
+            if (i == avail) {
+                if (s->eof) return 0;
+                continue;
+            }
+            s->pos++;
+            s->stage = FXSCAN_HEADER;
+            break;
+        }
+
+        case FXSCAN_HEADER:
+            eol = memchr(p, '\n', avail);
+            if (!eol) {
+                if (!s->eof) {
+                    if (fxscan_fill(s) != 0) return -2;
+                    continue;
+                }
+                // A lone '>' or '@' at the very end is not a record
+                if (avail == 0) {
+                    s->stage = FXSCAN_FIND;
+                    return 0;
+                }
+                // Header without a newline at the end of the input
+                s->pos = s->end;
+                s->seq_start = s->seq_end = s->pos;
+                s->len = 0;
+                s->stage = FXSCAN_FIND;
+                fxscan_emit(s, r);
+                return 1;
+            }
+            s->pos = eol - s->buf + 1;
+            s->seq_start = s->seq_end = s->pos;
+            s->len = 0;
+            s->stage = FXSCAN_SEQ;
+            break;
+
+        case FXSCAN_SEQ:
+            if (avail == 0) {
+                // FASTA record ending at the end of the input
+                s->stage = FXSCAN_FIND;
+                fxscan_emit(s, r);
+                return 1;
+            }
+            if (*p == '>' || *p == '@') {
+                // The header of the next record ends this FASTA record
+                fxscan_emit(s, r);
+                s->rec = s->pos;
+                s->pos++;
+                s->stage = FXSCAN_HEADER;
+                return 1;
+            }
+            if (*p == '+') {
+                s->pos++;
+                s->stage = FXSCAN_PLUS;
+                break;
+            }
+            if (*p == '\n') {
+                s->pos++;
+                break;
+            }
+            eol = memchr(p, '\n', avail);
+            if (!eol) {
+                if (!s->eof) {
+                    if (fxscan_fill(s) != 0) return -2;
+                    continue;
+                }
+                eol = s->buf + s->end;
+            }
+            s->len += fxscan_line(s, eol, s->len);
+            s->seq_end = eol - s->buf;
+            s->pos = eol < s->buf + s->end ? s->seq_end + 1 : s->end;
+            break;
+
+        case FXSCAN_PLUS:
+            eol = memchr(p, '\n', avail);
+            if (!eol) {
+                if (!s->eof) {
+                    if (fxscan_fill(s) != 0) return -2;
+                    continue;
+                }
+                return -1;  // no quality line
+            }
+            s->pos = eol - s->buf + 1;
+            s->qual = s->qual_lines = 0;
+            s->stage = FXSCAN_QUAL;
+            break;
+
+        case FXSCAN_QUAL:
+            if (s->qual_lines && s->qual >= s->len) {
+                s->stage = FXSCAN_FIND;
+                if (s->qual != s->len) return -1;
+                fxscan_emit(s, r);
+                return 1;
+            }
+            if (avail == 0) {
+                s->stage = FXSCAN_FIND;
+                if (s->qual != s->len) return -1;
+                fxscan_emit(s, r);
+                return 1;
+            }
+            eol = memchr(p, '\n', avail);
+            if (!eol) {
+                if (!s->eof) {
+                    if (fxscan_fill(s) != 0) return -2;
+                    continue;
+                }
+                eol = s->buf + s->end;
+            }
+            s->qual += fxscan_line(s, eol, s->qual);
+            s->qual_lines++;
+            s->pos = eol < s->buf + s->end ? (size_t)(eol - s->buf) + 1 : s->end;
+            break;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ * fxsrc.h - open FASTA/FASTQ inputs, memory mapping uncompressed files
+ *
+ * Going through gzread() for a plain file means a copy through zlib's
+ * transparent mode and many small reads. Here the first two bytes of a
+ * regular file are checked for the gzip magic (1f 8b): compressed files
+ * keep the zlib path, everything else is mmap()ed and read in place.
+ * STDIN, pipes and files that cannot be mapped fall back to zlib, which
+ * handles both plain and compressed streams. With more than one thread, a
+ * gzip file is mapped too and inflated in parallel: BGZF files by gzpar.h,
+ * other files by gzspec.h, handing over to gzpar.h for any members that
+ * follow the first one (concatenated gzip). A gzip file with an index saved
+ * by gzidx.h is inflated from its access points instead, and on request a
+ * file without one is read sequentially while its index is built. Whichever
+ * way a gzip file is read, one that is corrupt or cut short ends with a read
+ * error (-1) after the data before the damage, as gzread() reports it.
+ *
+ *   fxsrc_open()       open a path ("-" for STDIN) using up to `threads`
+ *   fxsrc_open_index() the same, building the gzip index if `build` is set
+ *   fxsrc_indexed()    whether a gzip file has an index that can be used
+ *   fxsrc_scan_init()  start an fxscan_t on it, zero-copy when mapped
+ *   fxsrc_read()       block reader for any source (fxscan_read_fn)
+ *   fxsrc_error()      why fxsrc_read() returned -1, for messages
+ *   fxsrc_kread()      the same with the signature kseq expects
+ *   fxsrc_gets()       gzgets() equivalent (single-threaded sources only)
+ *   fxsrc_offset()     bytes of the file consumed so far, compressed for gzip
+ */
+#ifndef N50_FXSRC_H
+#define N50_FXSRC_H
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "fxscan.h"
+#include "gzpar.h"
+#include "gzspec.h"
+#include "gzidx.h"
+
+typedef enum {
+    FXSRC_GZ,       // read through zlib (compressed, or not seekable)
+    FXSRC_MAP,      // uncompressed regular file, memory mapped
+    FXSRC_PGZ       // gzip regular file, memory mapped and inflated by gzspec/gzpar/gzidx
+} fxsrc_kind_t;
+
+typedef struct {
+    fxsrc_kind_t kind;
+    gzFile gz;
+    gzpar_t *par;
+    gzspec_t *spec;         // first member of a gzip file that is not BGZF
+    gzidx_reader_t *idx;    // gzip file with an index
+    gzidx_build_t *build;   // gzip file whose index is being built
+    char *path;             // where the index goes
+    int threads;
+    const char *map;
+    size_t size;            // file size, 0 if unknown (STDIN)
+    size_t pos;             // read position in the mapping
+    const char *error;      // a read error of fxsrc_read() itself
+} fxsrc_t;
+
+// zlib on `fd`, closed on failure. gzdopen() only fails when memory runs
+// out, and does not always set errno then.
+static inline int fxsrc_gzdopen(fxsrc_t *src, int fd) {
+    src->gz = gzdopen(fd, "r");
+    if (src->gz) return 0;
+    if (fd != STDIN_FILENO) close(fd);
+    errno = ENOMEM;
+    return -1;
+}
+
+// Returns 0 on success, -1 with errno set if the file cannot be opened
+static inline int fxsrc_open_index(fxsrc_t *src, const char *path, int threads, int build) {
+    memset(src, 0, sizeof(*src));
+    src->kind = FXSRC_GZ;
+    if (strcmp(path, "-") == 0) {
+        return fxsrc_gzdopen(src, STDIN_FILENO);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        unsigned char magic[2] = {0, 0};
+        src->size = st.st_size;
+        if (pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+            void *map = threads > 1 || build ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            if (map != MAP_FAILED) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                gzidx_t *idx = NULL;
+                if (threads > 1 && gzpar_bgzf_size(map, st.st_size)) {
+                    src->par = gzpar_open(map, st.st_size, threads);
+                } else if (threads > 1 && (idx = gzidx_load(path, &st)) != NULL) {
+                    src->idx = gzidx_open(map, st.st_size, idx, threads);
+                } else if (build) {
+                    src->path = strdup(path);
+                    if (src->path) src->build = gzidx_build_open(map, st.st_size, &st);
+                } else {
+                    src->spec = gzspec_open(map, st.st_size, threads);
+                }
+                if (src->par || src->spec || src->idx || src->build) {
+                    src->threads = threads;
+                    src->kind = FXSRC_PGZ;
+                    src->map = map;
+                    close(fd);
+                    return 0;
+                }
+                free(src->path);
+                src->path = NULL;
+                munmap(map, st.st_size);
+            }
+            return fxsrc_gzdopen(src, fd);
+        }
+        if (st.st_size == 0) {
+            src->kind = FXSRC_MAP;
+            close(fd);
+            return 0;
+        }
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+            madvise(map, st.st_size, MADV_HUGEPAGE);
+#endif
+            src->kind = FXSRC_MAP;
+            src->map = map;
+            close(fd);
+            return 0;
+        }
+    }
+    return fxsrc_gzdopen(src, fd);
+}
+
+static inline int fxsrc_indexed(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+    gzidx_t *idx = gzidx_load(path, &st);
+    gzidx_free(idx);
+    return idx != NULL;
+}
+
+static inline int fxsrc_open(fxsrc_t *src, const char *path, int threads) {
+    return fxsrc_open_index(src, path, threads, 0);
+}
+
+static inline void fxsrc_close(fxsrc_t *src) {
+    if (src->kind == FXSRC_PGZ) {
+        gzspec_close(src->spec);
+        gzpar_close(src->par);
+        gzidx_close(src->idx);
+        gzidx_build_close(src->build);
+        free(src->path);
+    }
+    if (src->kind != FXSRC_GZ) {
+        if (src->map) munmap((void *)src->map, src->size);
+    } else if (src->gz) {
+        gzclose(src->gz);
+    }
+    memset(src, 0, sizeof(*src));
+}
+
+static inline long fxsrc_read(void *ctx, char *buf, size_t cap) {
+    fxsrc_t *src = (fxsrc_t *)ctx;
+    if (src->kind == FXSRC_GZ) {
+        if (cap > INT32_MAX) cap = INT32_MAX;
+        int n = gzread(src->gz, buf, (unsigned)cap);
+        if (n == 0) {
+            // A truncated file reads to its end, then gzerror() tells
+            int err;
+            gzerror(src->gz, &err);
+            if (err != Z_OK) return -1;
+        }
+        return n;
+    }
+    if (src->kind == FXSRC_PGZ) {
+        if (src->idx) return gzidx_read(src->idx, buf, cap);
+        if (src->build) {
+            long n = gzidx_build_read(src->build, buf, cap);
+            if (n == 0 && src->path && gzidx_build_save(src->build, src->path) != 0) {
+                fprintf(stderr, "Warning: cannot write the index of %s\n", src->path);
+            }
+            if (n == 0) {
+                free(src->path);
+                src->path = NULL;
+            }
+            return n;
+        }
+        if (src->spec) {
+            long n = gzspec_read(src->spec, buf, cap);
+            if (n != 0) return n;
+            // Members after the first one are left to gzpar
+            size_t end = gzspec_end(src->spec);
+            gzspec_close(src->spec);
+            src->spec = NULL;
+            if (src->size - end < 2 || (unsigned char)src->map[end] != 0x1f || (unsigned char)src->map[end + 1] != 0x8b) return 0;
+            src->par = gzpar_open(src->map + end, src->size - end, src->threads);
+            if (!src->par) {
+                src->error = "out of memory";
+                return -1;
+            }
+        }
+        return src->par ? gzpar_read(src->par, buf, cap) : 0;
+    }
+    size_t n = src->size - src->pos;
+    if (n > cap) n = cap;
+    memcpy(buf, src->map + src->pos, n);
+    src->pos += n;
+    return (long)n;
+}
+
+static inline const char *fxsrc_error(const fxsrc_t *src) {
+    if (src->error) return src->error;
+    if (src->kind == FXSRC_GZ && src->gz) {
+        int err;
+        const char *msg = gzerror(src->gz, &err);
+        if (err == Z_ERRNO) return strerror(errno);
+        // Without the "<fd:N>: " zlib puts in front
+        const char *colon = strstr(msg, ": ");
+        return colon ? colon + 2 : msg;
+    }
+    if (src->idx) return gzidx_error(src->idx);
+    if (src->build) return gzidx_build_error(src->build);
+    if (src->spec) return gzspec_error(src->spec);
+    if (src->par) return gzpar_error(src->par);
+    return "read error";
+}
+
+static inline int fxsrc_kread(fxsrc_t *src, void *buf, int size) {
+    return (int)fxsrc_read(src, (char *)buf, size);
+}
+
+// Read a line of at most len - 1 bytes, like gzgets()
+static inline char *fxsrc_gets(fxsrc_t *src, char *buf, int len) {
+    if (src->kind == FXSRC_GZ) return gzgets(src->gz, buf, len);
+    if (src->kind != FXSRC_MAP) return NULL;
+    if (len < 1 || src->pos >= src->size) return NULL;
+    size_t n = src->size - src->pos;
+    if (n > (size_t)len - 1) n = len - 1;
+    const char *eol = memchr(src->map + src->pos, '\n', n);
+    if (eol) n = eol - (src->map + src->pos) + 1;
+    memcpy(buf, src->map + src->pos, n);
+    buf[n] = '\0';
+    src->pos += n;
+    return buf;
+}
+
+// Position in the file on disk, for progress reports. Parallel inflaters only
+// know the start of the chunk being read, so it moves a chunk at a time. Only
+// the thread that reads the source may call it.
+static inline size_t fxsrc_offset(const fxsrc_t *src) {
+    size_t off = 0;
+    if (src->kind == FXSRC_GZ) {
+        z_off_t o = src->gz ? gzoffset(src->gz) : -1;
+        off = o > 0 ? (size_t)o : 0;
+    } else if (src->kind == FXSRC_MAP) {
+        off = src->pos;
+    } else if (src->idx) {
+        const gzidx_t *idx = src->idx->idx;
+        off = src->idx->current < idx->npoints ? idx->points[src->idx->current].in_bit >> 3 : src->size;
+    } else if (src->build) {
+        off = src->build->z.next_in - src->build->data;
+    } else if (src->spec) {
+        off = (src->spec->data - src->spec->file) + (src->spec->expected >> 3);
+    } else if (src->par) {
+        size_t in = src->par->current * src->par->range;
+        off = (src->par->data - (const unsigned char *)src->map) + (in < src->par->size ? in : src->par->size);
+    } else {
+        off = src->size;
+    }
+    return off < src->size || !src->size ? off : src->size;
+}
+
+// Scan records straight from the mapping, or block by block otherwise
+static inline int fxsrc_scan_init(fxsrc_t *src, fxscan_t *scan) {
+    if (src->kind == FXSRC_MAP) {
+        fxscan_init_buffer(scan, src->map, src->size);
+        return 0;
+    }
+    return fxscan_init_reader(scan, fxsrc_read, src);
+}
+
+#endif
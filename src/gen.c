@@ -4,6 +4,9 @@
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <stdint.h>
+
+#include "radix.h"
 
 /*
  * DNA Sequence Generator
@@ -89,6 +92,10 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "OK\n");
         long long total_length; // Change to long long
         int N50 = calculate_n50(contig_lengths, num_seqs, &total_length);
+        if (N50 < 0) {
+            free(contig_lengths);
+            return 1;
+        }
         fprintf(stderr, "\tTotal length: %lld\n", total_length); // Use %lld for long long
         fprintf(stderr, "\tN50: %d\n", N50);
         char outfile[MAX_FILENAME_LEN];
@@ -129,14 +136,15 @@ void gen_ctg_len(int min_len, int max_len, int num_seqs, int *lengths) {
     }
 }
 
-int compare_ints(const void *a, const void *b) {
-    return (*(int*)b - *(int*)a);
-}
 long long calculate_n50(const int *lengths, int num_seqs, long long *total_length) {
     int sorted_lengths[num_seqs];
     memcpy(sorted_lengths, lengths, sizeof(int) * num_seqs);
     
-    qsort(sorted_lengths, num_seqs, sizeof(int), compare_ints);
+    // Lengths are never negative, sort them as unsigned
+    if (radix_sort_u32_desc((uint32_t *)sorted_lengths, num_seqs, 0) != 0) {
+        perror("malloc");
+        return -1;
+    }
     
     *total_length = 0;
     for (int i = 0; i < num_seqs; i++) {
@@ -0,0 +1,658 @@
+/*
+ * gzidx.h - random-access index of a gzip file, saved next to it
+ *
+ * Like zran.c in the zlib sources: while a gzip file is read sequentially,
+ * the decoder stops at deflate block boundaries and every few megabytes of
+ * compressed input records an access point, i.e. the bit position in the
+ * file, the offset in the output and the 32 KB of output before it (the
+ * window back-references may reach into). The windows are stored deflated,
+ * about 20 KB each for FASTQ: half a percent of a large file.
+ *
+ * With an index, the ranges between access points are independent: each is
+ * inflated by a worker from its bit position with its window as dictionary,
+ * into a buffer of the exact size the index gives, and gzidx_read() returns
+ * the ranges in order. Members that start inside a range are decoded by the
+ * same worker. The CRC and length in each gzip trailer are checked both while
+ * the index is built and when reading from it: a worker sums up the output of
+ * its range before the first member end and after the last one, and the
+ * reader joins those parts with crc32_combine() for members that run over
+ * several ranges. A corrupt or truncated file makes the read functions
+ * return -1 once the data before the damage has been read; it gets no index.
+ * An index is only used for a file of the same size, modification time and
+ * status change time, to the nanosecond.
+ *
+ *   gzidx_build_open()   start reading a mapped gzip file, recording access points
+ *   gzidx_build_read()   next decompressed bytes, in order
+ *   gzidx_build_save()   write the index once gzidx_build_read() returned 0
+ *   gzidx_build_error()  why gzidx_build_read() returned -1
+ *   gzidx_build_close()  free the builder
+ *   gzidx_load()         read the index of a file, NULL if missing or stale
+ *   gzidx_open()         start `threads` workers on a mapped file and its index
+ *   gzidx_read()         next decompressed bytes, in order
+ *   gzidx_error()        why gzidx_read() returned -1
+ *   gzidx_close()        stop the workers and free everything, index included
+ */
+#ifndef N50_GZIDX_H
+#define N50_GZIDX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define GZIDX_SUFFIX      ".gzidx"
+#define GZIDX_MAGIC       "N50GZI02"
+#define GZIDX_SPAN        (4 << 20)     // compressed bytes between access points at most
+#define GZIDX_MIN_SPAN    (1 << 20)     // and at least
+#define GZIDX_WINDOW      32768
+#define GZIDX_MAX_THREADS 64
+
+typedef struct {
+    uint64_t in_bit;        // bit position in the file, 0 for the gzip header of the file
+    uint64_t out;           // output bytes before the point
+    uint32_t wlen;          // window bytes, less than 32 KB near the start of a member
+    unsigned char *window;
+} gzidx_point_t;
+
+typedef struct {
+    uint64_t file_size;
+    int64_t mtime, mtime_ns;    // modification time of the file
+    int64_t ctime, ctime_ns;    // and of its last status change
+    uint64_t total;         // output bytes of the whole file
+    uint64_t npoints, cap;
+    gzidx_point_t *points;
+} gzidx_t;
+
+static inline void gzidx_free(gzidx_t *idx) {
+    if (!idx) return;
+    for (uint64_t i = 0; i < idx->npoints; i++) free(idx->points[i].window);
+    free(idx->points);
+    free(idx);
+}
+
+static inline int gzidx_add(gzidx_t *idx, uint64_t in_bit, uint64_t out, const unsigned char *window, uint32_t wlen) {
+    if (idx->npoints == idx->cap) {
+        uint64_t cap = idx->cap ? idx->cap * 2 : 64;
+        gzidx_point_t *p = realloc(idx->points, cap * sizeof(gzidx_point_t));
+        if (!p) return -1;
+        idx->points = p;
+        idx->cap = cap;
+    }
+    gzidx_point_t *p = &idx->points[idx->npoints];
+    p->in_bit = in_bit;
+    p->out = out;
+    p->wlen = wlen;
+    p->window = NULL;
+    if (wlen) {
+        p->window = malloc(wlen);
+        if (!p->window) return -1;
+        memcpy(p->window, window, wlen);
+    }
+    idx->npoints++;
+    return 0;
+}
+
+// Record the times of the file the index is for
+static inline void gzidx_stamp(gzidx_t *idx, const struct stat *st) {
+#ifdef __APPLE__
+    idx->mtime = (int64_t)st->st_mtimespec.tv_sec;
+    idx->mtime_ns = (int64_t)st->st_mtimespec.tv_nsec;
+    idx->ctime = (int64_t)st->st_ctimespec.tv_sec;
+    idx->ctime_ns = (int64_t)st->st_ctimespec.tv_nsec;
+#else
+    idx->mtime = (int64_t)st->st_mtim.tv_sec;
+    idx->mtime_ns = (int64_t)st->st_mtim.tv_nsec;
+    idx->ctime = (int64_t)st->st_ctim.tv_sec;
+    idx->ctime_ns = (int64_t)st->st_ctim.tv_nsec;
+#endif
+}
+
+static inline char *gzidx_path(const char *path) {
+    size_t n = strlen(path);
+    char *p = malloc(n + sizeof(GZIDX_SUFFIX));
+    if (p) {
+        memcpy(p, path, n);
+        memcpy(p + n, GZIDX_SUFFIX, sizeof(GZIDX_SUFFIX));
+    }
+    return p;
+}
+
+/*
+ * Building
+ */
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t span;
+    z_stream z;
+    int in_member;          // between a gzip header and its trailer
+    uint64_t last_bit;      // position of the last access point
+    uint64_t member_out;    // output of the current member
+    unsigned char window[GZIDX_WINDOW];
+    gzidx_t *idx;
+    int done, error;
+    const char *msg;        // cause of the error
+} gzidx_build_t;
+
+static inline void gzidx_build_fail(gzidx_build_t *b, const char *msg) {
+    b->error = 1;
+    b->msg = msg;
+}
+
+static inline gzidx_build_t *gzidx_build_open(const void *data, size_t size, const struct stat *st) {
+    gzidx_build_t *b = calloc(1, sizeof(gzidx_build_t));
+    if (!b) return NULL;
+    b->idx = calloc(1, sizeof(gzidx_t));
+    if (!b->idx || inflateInit2(&b->z, 16 + MAX_WBITS) != Z_OK) {
+        free(b->idx);
+        free(b);
+        return NULL;
+    }
+    b->data = (const unsigned char *)data;
+    b->size = size;
+    b->span = size / 64;
+    if (b->span > GZIDX_SPAN) b->span = GZIDX_SPAN;
+    if (b->span < GZIDX_MIN_SPAN) b->span = GZIDX_MIN_SPAN;
+    b->z.next_in = (unsigned char *)b->data;
+    b->z.avail_in = size < UINT_MAX ? size : UINT_MAX;
+    b->in_member = 1;
+    b->idx->file_size = size;
+    gzidx_stamp(b->idx, st);
+    if (gzidx_add(b->idx, 0, 0, NULL, 0) != 0) gzidx_build_fail(b, "out of memory");
+    return b;
+}
+
+static inline void gzidx_build_window(gzidx_build_t *b, const unsigned char *p, size_t n) {
+    if (n >= GZIDX_WINDOW) {
+        memcpy(b->window, p + n - GZIDX_WINDOW, GZIDX_WINDOW);
+    } else {
+        memmove(b->window, b->window + n, GZIDX_WINDOW - n);
+        memcpy(b->window + GZIDX_WINDOW - n, p, n);
+    }
+    b->member_out += n;
+}
+
+static inline long gzidx_build_read(void *ctx, char *buf, size_t cap) {
+    gzidx_build_t *b = (gzidx_build_t *)ctx;
+    size_t done = 0;
+    while (done < cap && !b->done && !b->error) {
+        size_t in = b->z.next_in - b->data;
+        if (b->z.avail_in == 0 && in < b->size) {
+            b->z.avail_in = b->size - in < UINT_MAX ? b->size - in : UINT_MAX;
+        }
+        if (!b->in_member) {
+            // Another member, or trailing bytes gzread() would ignore too
+            if (b->size - in < 2 || b->data[in] != 0x1f || b->data[in + 1] != 0x8b || inflateReset(&b->z) != Z_OK) {
+                b->done = 1;
+                break;
+            }
+            b->in_member = 1;
+            b->member_out = 0;
+        }
+        b->z.next_out = (unsigned char *)buf + done;
+        b->z.avail_out = cap - done < UINT_MAX ? cap - done : UINT_MAX;
+        int ret = inflate(&b->z, Z_BLOCK);
+        size_t n = (char *)b->z.next_out - (buf + done);
+        gzidx_build_window(b, (unsigned char *)buf + done, n);
+        done += n;
+        b->idx->total += n;
+        in = b->z.next_in - b->data;
+        if (ret == Z_STREAM_END) {
+            b->in_member = 0;
+        } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+            uint64_t bit = (uint64_t)in * 8 - (b->z.data_type & 7);
+            if ((b->z.data_type & 128) && !(b->z.data_type & 64) && bit - b->last_bit >= (uint64_t)b->span * 8) {
+                uint32_t wlen = b->member_out < GZIDX_WINDOW ? (uint32_t)b->member_out : GZIDX_WINDOW;
+                if (gzidx_add(b->idx, bit, b->idx->total, b->window + GZIDX_WINDOW - wlen, wlen) != 0) {
+                    gzidx_build_fail(b, "out of memory");
+                }
+                b->last_bit = bit;
+            } else if (n == 0 && b->z.avail_in == 0 && in >= b->size) {
+                gzidx_build_fail(b, "unexpected end of file");
+            }
+        } else {
+            gzidx_build_fail(b, b->z.msg ? b->z.msg : "invalid compressed data");
+        }
+    }
+    if (b->error && done == 0) return -1;
+    return (long)done;
+}
+
+// Write the index next to the file `path`. Returns 0 on success.
+static inline int gzidx_build_save(gzidx_build_t *b, const char *path) {
+    if (!b->done || b->error) return -1;
+    gzidx_t *idx = b->idx;
+    char *ipath = gzidx_path(path);
+    if (!ipath) return -1;
+    char *tmp = malloc(strlen(ipath) + 32);
+    FILE *fp = NULL;
+    if (tmp) {
+        sprintf(tmp, "%s.%ld", ipath, (long)getpid());
+        fp = fopen(tmp, "wb");
+    }
+    int ok = fp != NULL;
+    unsigned char *z = NULL;
+    uLong zcap = compressBound(GZIDX_WINDOW);
+    if (ok) z = malloc(zcap);
+    ok = ok && z;
+    ok = ok && fwrite(GZIDX_MAGIC, 8, 1, fp) == 1;
+    ok = ok && fwrite(&idx->file_size, 8, 1, fp) == 1;
+    ok = ok && fwrite(&idx->mtime, 8, 1, fp) == 1 && fwrite(&idx->mtime_ns, 8, 1, fp) == 1;
+    ok = ok && fwrite(&idx->ctime, 8, 1, fp) == 1 && fwrite(&idx->ctime_ns, 8, 1, fp) == 1;
+    ok = ok && fwrite(&idx->total, 8, 1, fp) == 1;
+    ok = ok && fwrite(&idx->npoints, 8, 1, fp) == 1;
+    for (uint64_t i = 0; ok && i < idx->npoints; i++) {
+        gzidx_point_t *p = &idx->points[i];
+        uLongf zlen = zcap;
+        if (p->wlen && compress2(z, &zlen, p->window, p->wlen, Z_BEST_SPEED) != Z_OK) ok = 0;
+        uint32_t clen = p->wlen ? (uint32_t)zlen : 0;
+        ok = ok && fwrite(&p->in_bit, 8, 1, fp) == 1;
+        ok = ok && fwrite(&p->out, 8, 1, fp) == 1;
+        ok = ok && fwrite(&p->wlen, 4, 1, fp) == 1;
+        ok = ok && fwrite(&clen, 4, 1, fp) == 1;
+        ok = ok && (clen == 0 || fwrite(z, clen, 1, fp) == 1);
+    }
+    if (fp && fclose(fp) != 0) ok = 0;
+    if (ok && rename(tmp, ipath) != 0) ok = 0;
+    if (!ok && fp) unlink(tmp);
+    free(z);
+    free(tmp);
+    free(ipath);
+    return ok ? 0 : -1;
+}
+
+static inline const char *gzidx_build_error(const gzidx_build_t *b) {
+    return b->msg ? b->msg : "read error";
+}
+
+static inline void gzidx_build_close(gzidx_build_t *b) {
+    if (!b) return;
+    inflateEnd(&b->z);
+    gzidx_free(b->idx);
+    free(b);
+}
+
+/*
+ * Loading
+ */
+
+// The index of `path`, if there is one for this very file (`st`)
+static inline gzidx_t *gzidx_load(const char *path, const struct stat *st) {
+    char *ipath = gzidx_path(path);
+    if (!ipath) return NULL;
+    FILE *fp = fopen(ipath, "rb");
+    free(ipath);
+    if (!fp) return NULL;
+
+    gzidx_t now;
+    gzidx_stamp(&now, st);
+    gzidx_t *idx = calloc(1, sizeof(gzidx_t));
+    unsigned char *z = malloc(compressBound(GZIDX_WINDOW));
+    char magic[8];
+    uint64_t npoints = 0;
+    int ok = idx && z;
+    ok = ok && fread(magic, 8, 1, fp) == 1 && memcmp(magic, GZIDX_MAGIC, 8) == 0;
+    ok = ok && fread(&idx->file_size, 8, 1, fp) == 1 && idx->file_size == (uint64_t)st->st_size;
+    ok = ok && fread(&idx->mtime, 8, 1, fp) == 1 && fread(&idx->mtime_ns, 8, 1, fp) == 1;
+    ok = ok && fread(&idx->ctime, 8, 1, fp) == 1 && fread(&idx->ctime_ns, 8, 1, fp) == 1;
+    ok = ok && idx->mtime == now.mtime && idx->mtime_ns == now.mtime_ns &&
+         idx->ctime == now.ctime && idx->ctime_ns == now.ctime_ns;
+    ok = ok && fread(&idx->total, 8, 1, fp) == 1;
+    ok = ok && fread(&npoints, 8, 1, fp) == 1 && npoints > 0;
+    for (uint64_t i = 0; ok && i < npoints; i++) {
+        uint64_t in_bit, out;
+        uint32_t wlen, clen;
+        ok = fread(&in_bit, 8, 1, fp) == 1 && fread(&out, 8, 1, fp) == 1 &&
+             fread(&wlen, 4, 1, fp) == 1 && fread(&clen, 4, 1, fp) == 1;
+        ok = ok && wlen <= GZIDX_WINDOW && clen <= compressBound(GZIDX_WINDOW) && in_bit < idx->file_size * 8;
+        ok = ok && out <= idx->total && (i == 0 || out >= idx->points[i - 1].out);
+        ok = ok && (clen == 0 || fread(z, clen, 1, fp) == 1);
+        ok = ok && gzidx_add(idx, in_bit, out, NULL, 0) == 0;
+        if (ok && wlen) {
+            gzidx_point_t *p = &idx->points[i];
+            uLongf len = wlen;
+            p->window = malloc(wlen);
+            p->wlen = wlen;
+            ok = p->window && uncompress(p->window, &len, z, clen) == Z_OK && len == wlen;
+        }
+    }
+    fclose(fp);
+    free(z);
+    if (!ok) {
+        gzidx_free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+/*
+ * Parallel reading
+ */
+
+enum {
+    GZIDX_IDLE,
+    GZIDX_PENDING,
+    GZIDX_RUNNING,
+    GZIDX_DONE,
+    GZIDX_FAILED
+};
+
+typedef struct {
+    uint64_t index;         // range number: from points[index] to the next one
+    int state;
+    unsigned char *buf;
+    size_t len, cap;
+    const char *msg;        // why the range FAILED
+    // CRC of the output before the first member end (all of it if no member
+    // ends here) and after the last one, and the trailer of that first member
+    uLong head_crc, tail_crc;
+    size_t head_len, tail_len;
+    int ends;
+    uint32_t trailer_crc, trailer_len;
+} gzidx_slot_t;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    gzidx_t *idx;
+
+    int nslots;
+    gzidx_slot_t *slots;    // range r lives in slots[r % nslots]
+    uint64_t current;       // range being read
+    uint64_t admitted;      // ranges [current, admitted) are scheduled
+    size_t read_pos;        // in the current range
+
+    uLong crc;              // of the member open at the end of the ranges read
+    uint64_t member_len;
+
+    int quit;
+    int error;
+    const char *msg;        // cause of the error
+    int nthreads, alive;
+    pthread_t threads[GZIDX_MAX_THREADS];
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond, data_cond;
+} gzidx_reader_t;
+
+static inline uint32_t gzidx_le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uLong gzidx_crc(uLong crc, const unsigned char *p, size_t n) {
+    for (size_t off = 0; off < n; off += 1 << 30) {
+        size_t len = n - off < (1 << 30) ? n - off : (1 << 30);
+        crc = crc32(crc, p + off, (uInt)len);
+    }
+    return crc;
+}
+
+static inline int gzidx_fail(gzidx_slot_t *s, const char *msg) {
+    s->msg = msg;
+    return -1;
+}
+
+// Inflate the range of slot `s` into its buffer, which has room for exactly its output
+static inline int gzidx_inflate(gzidx_reader_t *g, z_stream *z, gzidx_slot_t *s) {
+    const gzidx_point_t *p = &g->idx->points[s->index];
+    unsigned char *out = s->buf;
+    size_t len = s->len;
+    size_t byte = p->in_bit >> 3;
+    unsigned bits = p->in_bit & 7;
+    int raw = p->in_bit != 0;
+    s->ends = 0;
+    if (inflateReset2(z, raw ? -MAX_WBITS : 16 + MAX_WBITS) != Z_OK) return gzidx_fail(s, "out of memory");
+    if (raw) {
+        if (bits) {
+            inflatePrime(z, 8 - bits, g->data[byte] >> bits);
+            byte++;
+        }
+        if (p->wlen && inflateSetDictionary(z, p->window, p->wlen) != Z_OK) return gzidx_fail(s, "invalid index");
+    }
+    z->next_in = (unsigned char *)g->data + byte;
+    z->avail_in = g->size - byte < UINT_MAX ? g->size - byte : UINT_MAX;
+    z->next_out = out;
+    size_t done = 0, last = 0;
+    while (done < len) {
+        size_t in = z->next_in - g->data;
+        if (z->avail_in == 0 && in < g->size) z->avail_in = g->size - in < UINT_MAX ? g->size - in : UINT_MAX;
+        z->avail_out = len - done < UINT_MAX ? len - done : UINT_MAX;
+        int ret = inflate(z, Z_NO_FLUSH);
+        done = z->next_out - out;
+        if (ret == Z_STREAM_END) {
+            // A raw stream stops at its trailer, zlib reads past it otherwise
+            in = z->next_in - g->data;
+            if (raw) in += 8;
+            if (in > g->size) return gzidx_fail(s, "unexpected end of file");
+            if (!s->ends) {
+                s->ends = 1;
+                s->head_len = done;
+                s->trailer_crc = gzidx_le32(g->data + in - 8);
+                s->trailer_len = gzidx_le32(g->data + in - 4);
+            }
+            last = done;
+            if (done == len) break;
+            // The range goes on in the next member
+            if (in + 2 > g->size || g->data[in] != 0x1f || g->data[in + 1] != 0x8b) return gzidx_fail(s, "invalid index");
+            if (inflateReset2(z, 16 + MAX_WBITS) != Z_OK) return gzidx_fail(s, "out of memory");
+            raw = 0;
+            z->next_in = (unsigned char *)g->data + in;
+            z->avail_in = g->size - in < UINT_MAX ? g->size - in : UINT_MAX;
+        } else if (ret == Z_BUF_ERROR && done < len) {
+            return gzidx_fail(s, "unexpected end of file");
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            return gzidx_fail(s, z->msg ? z->msg : "invalid compressed data");
+        }
+    }
+    // zlib checks the members that start and end here, the reader the others
+    if (!s->ends) {
+        s->head_len = len;
+        last = len;
+    }
+    s->head_crc = gzidx_crc(0, out, s->head_len);
+    s->tail_len = len - last;
+    s->tail_crc = gzidx_crc(0, out + last, s->tail_len);
+    return 0;
+}
+
+// Carry the CRC of the open member over range `s`, checking the trailer of
+// a member that ends in it. Callers hold the mutex.
+static inline void gzidx_check(gzidx_reader_t *g, const gzidx_slot_t *s) {
+    g->crc = crc32_combine(g->crc, s->head_crc, (z_off_t)s->head_len);
+    g->member_len += s->head_len;
+    if (s->ends) {
+        if (g->crc != s->trailer_crc) {
+            g->error = 1;
+            g->msg = "incorrect data check";
+        } else if ((uint32_t)g->member_len != s->trailer_len) {
+            g->error = 1;
+            g->msg = "incorrect length check";
+        }
+        g->crc = s->tail_crc;
+        g->member_len = s->tail_len;
+    }
+    if (s->index + 1 == g->idx->npoints && g->member_len && !g->error) {
+        g->error = 1;
+        g->msg = "unexpected end of file";
+    }
+}
+
+static inline size_t gzidx_range_len(const gzidx_reader_t *g, uint64_t r) {
+    uint64_t end = r + 1 < g->idx->npoints ? g->idx->points[r + 1].out : g->idx->total;
+    return end - g->idx->points[r].out;
+}
+
+static void *gzidx_worker(void *arg) {
+    gzidx_reader_t *g = (gzidx_reader_t *)arg;
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    int zok = inflateInit2(&z, -MAX_WBITS) == Z_OK;
+
+    pthread_mutex_lock(&g->mutex);
+    if (!zok) {
+        if (--g->alive == 0) {
+            g->error = 1;
+            g->msg = "out of memory";
+        }
+        pthread_cond_signal(&g->data_cond);
+        pthread_mutex_unlock(&g->mutex);
+        return NULL;
+    }
+    while (!g->quit) {
+        gzidx_slot_t *s = NULL;
+        for (uint64_t r = g->current; r < g->admitted; r++) {
+            if (g->slots[r % g->nslots].state == GZIDX_PENDING) {
+                s = &g->slots[r % g->nslots];
+                break;
+            }
+        }
+        if (!s) {
+            pthread_cond_wait(&g->work_cond, &g->mutex);
+            continue;
+        }
+        s->state = GZIDX_RUNNING;
+        pthread_mutex_unlock(&g->mutex);
+
+        // Only this worker touches the slot until it is DONE
+        int ok = 1;
+        size_t len = gzidx_range_len(g, s->index);
+        if (len > s->cap) {
+            unsigned char *b = realloc(s->buf, len);
+            if (b) {
+                s->buf = b;
+                s->cap = len;
+            } else {
+                s->msg = "out of memory";
+                ok = 0;
+            }
+        }
+        s->len = len;
+        ok = ok && gzidx_inflate(g, &z, s) == 0;
+
+        pthread_mutex_lock(&g->mutex);
+        s->state = ok ? GZIDX_DONE : GZIDX_FAILED;
+        pthread_cond_signal(&g->data_cond);
+    }
+    pthread_mutex_unlock(&g->mutex);
+    inflateEnd(&z);
+    return NULL;
+}
+
+// Schedule ranges up to the size of the window. Callers hold the mutex.
+static inline void gzidx_admit(gzidx_reader_t *g) {
+    while (g->admitted < g->idx->npoints && g->admitted < g->current + g->nslots) {
+        gzidx_slot_t *s = &g->slots[g->admitted % g->nslots];
+        s->index = g->admitted++;
+        s->state = GZIDX_PENDING;
+    }
+    pthread_cond_broadcast(&g->work_cond);
+}
+
+static inline long gzidx_read(void *ctx, char *buf, size_t cap) {
+    gzidx_reader_t *g = (gzidx_reader_t *)ctx;
+    size_t done = 0;
+    while (done < cap && g->current < g->idx->npoints) {
+        gzidx_slot_t *s = &g->slots[g->current % g->nslots];
+        pthread_mutex_lock(&g->mutex);
+        while (s->state != GZIDX_DONE && s->state != GZIDX_FAILED && !g->error) {
+            pthread_cond_wait(&g->data_cond, &g->mutex);
+        }
+        if (s->state == GZIDX_FAILED) {
+            g->error = 1;
+            g->msg = s->msg;
+        } else if (g->read_pos == 0 && !g->error) {
+            gzidx_check(g, s);
+        }
+        int error = g->error;
+        pthread_mutex_unlock(&g->mutex);
+        if (error) break;
+
+        size_t n = s->len - g->read_pos;
+        if (n > cap - done) n = cap - done;
+        memcpy(buf + done, s->buf + g->read_pos, n);
+        g->read_pos += n;
+        done += n;
+        if (g->read_pos == s->len) {
+            pthread_mutex_lock(&g->mutex);
+            s->state = GZIDX_IDLE;
+            g->current++;
+            g->read_pos = 0;
+            gzidx_admit(g);
+            pthread_mutex_unlock(&g->mutex);
+        }
+    }
+    if (g->error && done == 0) return -1;
+    return (long)done;
+}
+
+static inline const char *gzidx_error(const gzidx_reader_t *g) {
+    return g->msg ? g->msg : "read error";
+}
+
+static inline void gzidx_close(gzidx_reader_t *g) {
+    if (!g) return;
+    pthread_mutex_lock(&g->mutex);
+    g->quit = 1;
+    pthread_cond_broadcast(&g->work_cond);
+    pthread_mutex_unlock(&g->mutex);
+    for (int i = 0; i < g->nthreads; i++) pthread_join(g->threads[i], NULL);
+    for (int i = 0; i < g->nslots; i++) free(g->slots[i].buf);
+    pthread_mutex_destroy(&g->mutex);
+    pthread_cond_destroy(&g->work_cond);
+    pthread_cond_destroy(&g->data_cond);
+    gzidx_free(g->idx);
+    free(g->slots);
+    free(g);
+}
+
+// Takes ownership of `idx`. Returns NULL if no worker starts.
+static inline gzidx_reader_t *gzidx_open(const void *data, size_t size, gzidx_t *idx, int threads) {
+    if (threads > GZIDX_MAX_THREADS) threads = GZIDX_MAX_THREADS;
+    if (threads < 1) threads = 1;
+    gzidx_reader_t *g = calloc(1, sizeof(gzidx_reader_t));
+    if (!g) {
+        gzidx_free(idx);
+        return NULL;
+    }
+    g->data = (const unsigned char *)data;
+    g->size = size;
+    g->idx = idx;
+    g->nslots = 2 * threads;
+    g->slots = calloc(g->nslots, sizeof(gzidx_slot_t));
+    if (!g->slots) {
+        gzidx_free(idx);
+        free(g);
+        return NULL;
+    }
+    pthread_mutex_init(&g->mutex, NULL);
+    pthread_cond_init(&g->work_cond, NULL);
+    pthread_cond_init(&g->data_cond, NULL);
+
+    pthread_mutex_lock(&g->mutex);
+    gzidx_admit(g);
+    pthread_mutex_unlock(&g->mutex);
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_lock(&g->mutex);
+        g->alive++;
+        pthread_mutex_unlock(&g->mutex);
+        if (pthread_create(&g->threads[g->nthreads], NULL, gzidx_worker, g) != 0) {
+            pthread_mutex_lock(&g->mutex);
+            g->alive--;
+            pthread_mutex_unlock(&g->mutex);
+            break;
+        }
+        g->nthreads++;
+    }
+    if (g->nthreads == 0) {
+        gzidx_close(g);
+        return NULL;
+    }
+    return g;
+}
+
+#endif
@@ -0,0 +1,579 @@
+/*
+ * gzpar.h - parallel decompression of gzip files made of several members
+ *
+ * BGZF files (bgzip, samtools) and concatenated gzip files are a series of
+ * independent gzip members, each of which can be inflated on its own. The
+ * compressed file (memory mapped) is cut into ranges of equal size: for
+ * each range a worker looks for the first member starting in it and then
+ * inflates members until one ends past the range. The output of the ranges
+ * is read back in input order with gzpar_read(), a fxscan_read_fn.
+ *
+ * Member starts are found from the gzip magic: BGZF headers are recognized
+ * by their "BC" extra field and block size, any other candidate has to
+ * inflate cleanly for a while. A candidate can still be wrong, and a member
+ * can run over several ranges: the reader knows where the previous member
+ * really ended, drops ranges that start inside it and reruns a range from
+ * the right offset when the guess of its worker does not match. A file with
+ * a single member ends up decoded by one worker, like gzread() would. The
+ * output of a member is only handed to the reader once its CRC and length
+ * have been checked (members of more than GZPAR_MAX_QUEUED chunks excepted),
+ * and a member that is corrupt or cut short makes gzpar_read() return -1
+ * once the output of the members before it has been read.
+ *
+ *   gzpar_open()   start `threads` workers on a mapped gzip file
+ *   gzpar_read()   next decompressed bytes, in order
+ *   gzpar_error()  why gzpar_read() returned -1
+ *   gzpar_close()  stop the workers and free everything
+ */
+#ifndef N50_GZPAR_H
+#define N50_GZPAR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#define GZPAR_RANGE      (2 << 20)     // compressed bytes per range at most
+#define GZPAR_MIN_RANGE  (64 << 10)    // and at least
+#define GZPAR_BUFSIZE    (1 << 20)     // decompressed bytes per output chunk
+#define GZPAR_MAX_QUEUED 16            // output chunks a range may hold before its worker waits
+#define GZPAR_PROBE      (32 << 10)    // compressed bytes a candidate member must inflate
+#define GZPAR_MAX_THREADS 64
+
+typedef struct gzpar_chunk {
+    struct gzpar_chunk *next;
+    size_t len;
+    char data[GZPAR_BUFSIZE];
+} gzpar_chunk_t;
+
+enum {
+    GZPAR_PENDING,      // waiting for a worker
+    GZPAR_RUNNING,      // looking for the first member
+    GZPAR_STARTED,      // `start` is known, inflating
+    GZPAR_DONE,         // `end` is known
+    GZPAR_FAILED        // inflate error after `start`
+};
+
+typedef struct {
+    uint64_t index;         // range number
+    unsigned gen;           // bumped when the slot is reset, stale workers drop their output
+    int state;
+    int64_t forced;         // member start to decode from, -1 to search the range
+    int64_t start;          // first member decoded, -1 if none starts in the range
+    size_t end;             // end of the last member decoded
+    const char *msg;        // why the range FAILED
+    gzpar_chunk_t *head, *tail;
+    int queued;
+} gzpar_slot_t;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t range;
+    uint64_t nranges;
+
+    int nslots;
+    gzpar_slot_t *slots;    // range r lives in slots[r % nslots]
+    uint64_t current;       // range being read
+    uint64_t admitted;      // ranges [current, admitted) are scheduled
+    size_t expected;        // offset of the next member in the output
+    int validated;          // the current range starts at `expected`
+    gzpar_chunk_t *reading; // chunk being copied out by gzpar_read()
+    size_t read_pos;
+
+    gzpar_chunk_t *free;    // recycled chunks
+    int quit;
+    int error;
+    const char *msg;        // cause of the error
+    int nthreads;           // threads started
+    int alive;              // workers able to run
+    pthread_t threads[GZPAR_MAX_THREADS];
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond, data_cond, space_cond;
+} gzpar_t;
+
+// Size of the BGZF block at `h`, 0 if it is not a BGZF header
+static inline size_t gzpar_bgzf_size(const unsigned char *h, size_t avail) {
+    if (avail < 18 || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || !(h[3] & 4)) return 0;
+    size_t xend = 12 + (h[10] | (size_t)h[11] << 8);
+    if (xend > avail) return 0;
+    for (size_t i = 12; i + 4 <= xend;) {
+        size_t slen = h[i + 2] | (size_t)h[i + 3] << 8;
+        if (h[i] == 'B' && h[i + 1] == 'C' && slen == 2 && i + 6 <= xend) {
+            size_t bsize = (h[i + 4] | (size_t)h[i + 5] << 8) + 1;
+            return bsize <= avail ? bsize : 0;
+        }
+        i += 4 + slen;
+    }
+    return 0;
+}
+
+// Does a gzip member plausibly start at `p`? `z` is a gzip-mode inflate stream.
+static inline int gzpar_is_member(const gzpar_t *g, z_stream *z, size_t p, unsigned char *scratch, size_t scratch_size) {
+    const unsigned char *h = g->data + p;
+    size_t avail = g->size - p;
+    if (avail < 18 || h[1] != 0x8b || h[2] != 8 || (h[3] & 0xe0)) return 0;
+
+    // A BGZF block followed by another one, or by the end of the file
+    size_t bsize = gzpar_bgzf_size(h, avail);
+    if (bsize && (bsize == avail || gzpar_bgzf_size(h + bsize, avail - bsize))) return 1;
+
+    // Otherwise the header and the start of the deflate stream must decode
+    inflateReset(z);
+    z->next_in = (unsigned char *)h;
+    z->avail_in = avail < GZPAR_PROBE ? avail : GZPAR_PROBE;
+    int ret;
+    do {
+        z->next_out = scratch;
+        z->avail_out = scratch_size;
+        ret = inflate(z, Z_NO_FLUSH);
+        if (ret == Z_OK && z->avail_in == 0) return 1;
+    } while (ret == Z_OK);
+    return ret == Z_STREAM_END;
+}
+
+static inline gzpar_chunk_t *gzpar_chunk_get(gzpar_t *g) {
+    pthread_mutex_lock(&g->mutex);
+    gzpar_chunk_t *c = g->free;
+    if (c) g->free = c->next;
+    pthread_mutex_unlock(&g->mutex);
+    if (!c) c = malloc(sizeof(gzpar_chunk_t));
+    if (c) {
+        c->next = NULL;
+        c->len = 0;
+    }
+    return c;
+}
+
+// Callers hold the mutex
+static inline void gzpar_chunk_put(gzpar_t *g, gzpar_chunk_t *c) {
+    c->next = g->free;
+    g->free = c;
+}
+
+static inline void gzpar_slot_clear(gzpar_t *g, gzpar_slot_t *s) {
+    while (s->head) {
+        gzpar_chunk_t *c = s->head;
+        s->head = c->next;
+        gzpar_chunk_put(g, c);
+    }
+    s->tail = NULL;
+    s->queued = 0;
+}
+
+// Hand a full chunk to the reader. Returns -1 if the slot was reset meanwhile.
+static inline int gzpar_push(gzpar_t *g, gzpar_slot_t *s, unsigned gen, gzpar_chunk_t *c) {
+    pthread_mutex_lock(&g->mutex);
+    while (s->gen == gen && s->queued >= GZPAR_MAX_QUEUED && !g->quit) {
+        pthread_cond_wait(&g->space_cond, &g->mutex);
+    }
+    if (s->gen != gen || g->quit) {
+        gzpar_chunk_put(g, c);
+        pthread_mutex_unlock(&g->mutex);
+        return -1;
+    }
+    if (s->tail) s->tail->next = c;
+    else s->head = c;
+    s->tail = c;
+    s->queued++;
+    pthread_cond_signal(&g->data_cond);
+    pthread_mutex_unlock(&g->mutex);
+    return 0;
+}
+
+static inline void gzpar_free_chunk(gzpar_t *g, gzpar_chunk_t *c) {
+    pthread_mutex_lock(&g->mutex);
+    gzpar_chunk_put(g, c);
+    pthread_mutex_unlock(&g->mutex);
+}
+
+// Hand the chunks held back by a worker to the reader, in order. Returns -1,
+// with the rest of them freed, if the slot was reset meanwhile.
+static inline int gzpar_release(gzpar_t *g, gzpar_slot_t *s, unsigned gen, gzpar_chunk_t **held,
+                                gzpar_chunk_t **tail, int *n) {
+    while (*held) {
+        gzpar_chunk_t *c = *held;
+        *held = c->next;
+        c->next = NULL;
+        if (gzpar_push(g, s, gen, c) != 0) {
+            pthread_mutex_lock(&g->mutex);
+            while (*held) {
+                c = *held;
+                *held = c->next;
+                gzpar_chunk_put(g, c);
+            }
+            pthread_mutex_unlock(&g->mutex);
+            *tail = NULL;
+            *n = 0;
+            return -1;
+        }
+    }
+    *tail = NULL;
+    *n = 0;
+    return 0;
+}
+
+// Decode the members of one range
+static inline void gzpar_run(gzpar_t *g, gzpar_slot_t *s, unsigned gen, uint64_t index, int64_t forced,
+                             z_stream *z, unsigned char *scratch, size_t scratch_size) {
+    size_t lo = index * g->range;
+    size_t hi = lo + g->range < g->size ? lo + g->range : g->size;
+
+    int64_t start = forced;
+    for (size_t p = lo; start < 0 && p < hi; p++) {
+        const unsigned char *m = memchr(g->data + p, 0x1f, hi - p);
+        if (!m) break;
+        p = m - g->data;
+        if (gzpar_is_member(g, z, p, scratch, scratch_size)) start = p;
+    }
+
+    // Anything but another member after a member is ignored, as gzread() does
+    int trailing = start >= 0 && (g->size - start < 2 || g->data[start] != 0x1f || g->data[start + 1] != 0x8b);
+
+    pthread_mutex_lock(&g->mutex);
+    if (s->gen != gen) {
+        pthread_mutex_unlock(&g->mutex);
+        return;
+    }
+    s->start = start;
+    s->end = trailing ? g->size : hi;
+    s->state = start < 0 || trailing ? GZPAR_DONE : GZPAR_STARTED;
+    pthread_cond_signal(&g->data_cond);
+    pthread_mutex_unlock(&g->mutex);
+    if (start < 0 || trailing) return;
+
+    // Output is handed to the reader once the member it belongs to has ended
+    // and passed its CRC and length check (Z_STREAM_END in gzip mode), so a
+    // damaged member is never read. Full chunks wait in `held` until then; a
+    // member longer than GZPAR_MAX_QUEUED chunks is handed over unchecked.
+    size_t pos = start;
+    const char *failed = NULL;
+    gzpar_chunk_t *c = NULL, *held = NULL, *held_tail = NULL;
+    int nheld = 0;
+    gzpar_chunk_t *mark = NULL;     // chunk where the last member ended, NULL if handed over
+    size_t mark_len = 0;            // and its bytes up to there
+    inflateReset(z);
+    z->next_in = (unsigned char *)g->data + pos;
+    z->avail_in = g->size - pos < UINT_MAX ? g->size - pos : UINT_MAX;
+    for (;;) {
+        if (!c && !(c = gzpar_chunk_get(g))) {
+            failed = "out of memory";
+            break;
+        }
+        z->next_out = (unsigned char *)c->data + c->len;
+        z->avail_out = GZPAR_BUFSIZE - c->len;
+        int ret = inflate(z, Z_NO_FLUSH);
+        c->len = GZPAR_BUFSIZE - z->avail_out;
+        pos = z->next_in - g->data;
+        if (ret == Z_STREAM_END) {
+            if (gzpar_release(g, s, gen, &held, &held_tail, &nheld) != 0) {
+                gzpar_free_chunk(g, c);
+                return;
+            }
+            mark = c;
+            mark_len = c->len;
+            if (pos >= hi) break;
+            if (g->size - pos < 2 || g->data[pos] != 0x1f || g->data[pos + 1] != 0x8b) {
+                pos = g->size;
+                break;
+            }
+            inflateReset(z);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            failed = z->msg ? z->msg : "invalid compressed data";
+            break;
+        }
+        if (z->avail_in == 0) {
+            if (pos == g->size) {
+                failed = "unexpected end of file";
+                break;
+            }
+            z->avail_in = g->size - pos < UINT_MAX ? g->size - pos : UINT_MAX;
+        }
+        if (c->len == GZPAR_BUFSIZE) {
+            if (held_tail) held_tail->next = c;
+            else held = c;
+            held_tail = c;
+            c = NULL;
+            if (++nheld >= GZPAR_MAX_QUEUED) {
+                if (gzpar_release(g, s, gen, &held, &held_tail, &nheld) != 0) return;
+                mark = NULL;
+            }
+        }
+    }
+    if (c) {
+        if (held_tail) held_tail->next = c;
+        else held = c;
+        held_tail = c;
+        nheld++;
+    }
+    pthread_mutex_lock(&g->mutex);
+    // After a failure only the output of the members that ended is kept
+    gzpar_chunk_t *keep = NULL, *keep_tail = NULL;
+    while (held) {
+        gzpar_chunk_t *h = held;
+        held = h->next;
+        h->next = NULL;
+        if (failed && h == mark) h->len = mark_len;
+        if (h->len && (!failed || h == mark)) {
+            if (keep_tail) keep_tail->next = h;
+            else keep = h;
+            keep_tail = h;
+        } else {
+            gzpar_chunk_put(g, h);
+        }
+    }
+    pthread_mutex_unlock(&g->mutex);
+    held = keep;
+    if (gzpar_release(g, s, gen, &held, &held_tail, &nheld) != 0) return;
+    pthread_mutex_lock(&g->mutex);
+    if (s->gen == gen) {
+        s->end = pos;
+        s->msg = failed;
+        s->state = failed ? GZPAR_FAILED : GZPAR_DONE;
+        pthread_cond_signal(&g->data_cond);
+    }
+    pthread_mutex_unlock(&g->mutex);
+}
+
+static void *gzpar_worker(void *arg) {
+    gzpar_t *g = (gzpar_t *)arg;
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    unsigned char *scratch = malloc(GZPAR_PROBE);
+    int ok = scratch && inflateInit2(&z, 16 + MAX_WBITS) == Z_OK;
+
+    pthread_mutex_lock(&g->mutex);
+    if (!ok) {
+        // The other workers carry on, the reader fails only if none is left
+        if (--g->alive == 0) {
+            g->error = 1;
+            g->msg = "out of memory";
+        }
+        pthread_cond_signal(&g->data_cond);
+        pthread_mutex_unlock(&g->mutex);
+        free(scratch);
+        return NULL;
+    }
+    while (!g->quit) {
+        gzpar_slot_t *s = NULL;
+        for (uint64_t r = g->current; r < g->admitted; r++) {
+            if (g->slots[r % g->nslots].state == GZPAR_PENDING) {
+                s = &g->slots[r % g->nslots];
+                break;
+            }
+        }
+        if (!s) {
+            pthread_cond_wait(&g->work_cond, &g->mutex);
+            continue;
+        }
+        s->state = GZPAR_RUNNING;
+        unsigned gen = s->gen;
+        uint64_t index = s->index;
+        int64_t forced = s->forced;
+        pthread_mutex_unlock(&g->mutex);
+        gzpar_run(g, s, gen, index, forced, &z, scratch, GZPAR_PROBE);
+        pthread_mutex_lock(&g->mutex);
+    }
+    pthread_mutex_unlock(&g->mutex);
+    inflateEnd(&z);
+    free(scratch);
+    return NULL;
+}
+
+// Decode range `s` again from `forced` (-1 to search), dropping its output.
+// Callers hold the mutex.
+static inline void gzpar_reset(gzpar_t *g, gzpar_slot_t *s, int64_t forced) {
+    gzpar_slot_clear(g, s);
+    s->gen++;
+    s->state = GZPAR_PENDING;
+    s->forced = forced;
+    s->start = -1;
+}
+
+// Schedule ranges up to the size of the window. Callers hold the mutex.
+static inline void gzpar_admit(gzpar_t *g) {
+    while (g->admitted < g->nranges && g->admitted < g->current + g->nslots) {
+        gzpar_slot_t *s = &g->slots[g->admitted % g->nslots];
+        gzpar_slot_clear(g, s);
+        s->gen++;
+        s->index = g->admitted++;
+        s->state = GZPAR_PENDING;
+        s->forced = s->index == 0 ? 0 : -1;   // the first member is at offset 0
+        s->start = -1;
+        s->end = 0;
+    }
+    pthread_cond_broadcast(&g->work_cond);
+}
+
+// Move on to the next range. Callers hold the mutex.
+static inline void gzpar_advance(gzpar_t *g) {
+    gzpar_slot_t *s = &g->slots[g->current % g->nslots];
+    gzpar_slot_clear(g, s);
+    s->gen++;
+    g->current++;
+    g->validated = 0;
+    pthread_cond_broadcast(&g->space_cond);
+    gzpar_admit(g);
+}
+
+// Take the next chunk of output into g->reading: 1 on success, 0 at the end, -1 on error
+static inline int gzpar_next_chunk(gzpar_t *g) {
+    pthread_mutex_lock(&g->mutex);
+    int ret;
+    for (;;) {
+        if (g->error) {
+            ret = -1;
+            break;
+        }
+        if (g->current >= g->nranges || g->expected >= g->size) {
+            ret = 0;
+            break;
+        }
+        gzpar_slot_t *s = &g->slots[g->current % g->nslots];
+        if (!g->validated) {
+            if (s->state == GZPAR_PENDING || s->state == GZPAR_RUNNING) {
+                pthread_cond_wait(&g->data_cond, &g->mutex);
+                continue;
+            }
+            size_t hi = (g->current + 1) * g->range;
+            if (s->start >= 0 && (size_t)s->start == g->expected) {
+                g->validated = 1;
+            } else if (g->expected >= hi) {
+                gzpar_advance(g);       // no member starts in this range
+            } else {
+                // Wrong guess: decode the range again from the real member start.
+                // The workers may all be waiting for the reader to take the
+                // output of later ranges, so those start over as well to free one.
+                for (uint64_t r = g->current + 1; r < g->admitted; r++) {
+                    gzpar_slot_t *t = &g->slots[r % g->nslots];
+                    if (t->state == GZPAR_STARTED) gzpar_reset(g, t, -1);
+                }
+                gzpar_reset(g, s, g->expected);
+                pthread_cond_broadcast(&g->space_cond);
+                pthread_cond_broadcast(&g->work_cond);
+            }
+            continue;
+        }
+        if (s->head) {
+            g->reading = s->head;
+            s->head = s->head->next;
+            if (!s->head) s->tail = NULL;
+            s->queued--;
+            g->read_pos = 0;
+            pthread_cond_broadcast(&g->space_cond);
+            ret = 1;
+            break;
+        }
+        if (s->state == GZPAR_DONE) {
+            g->expected = s->end;
+            gzpar_advance(g);
+        } else if (s->state == GZPAR_FAILED) {
+            g->error = 1;
+            g->msg = s->msg;
+        } else {
+            pthread_cond_wait(&g->data_cond, &g->mutex);
+        }
+    }
+    pthread_mutex_unlock(&g->mutex);
+    return ret;
+}
+
+static inline long gzpar_read(void *ctx, char *buf, size_t cap) {
+    gzpar_t *g = (gzpar_t *)ctx;
+    size_t done = 0;
+    while (done < cap) {
+        if (!g->reading) {
+            int ret = gzpar_next_chunk(g);
+            if (ret < 0 && done == 0) return -1;
+            if (ret <= 0) break;
+        }
+        size_t n = g->reading->len - g->read_pos;
+        if (n > cap - done) n = cap - done;
+        memcpy(buf + done, g->reading->data + g->read_pos, n);
+        g->read_pos += n;
+        done += n;
+        if (g->read_pos == g->reading->len) {
+            pthread_mutex_lock(&g->mutex);
+            gzpar_chunk_put(g, g->reading);
+            pthread_mutex_unlock(&g->mutex);
+            g->reading = NULL;
+        }
+    }
+    return (long)done;
+}
+
+static inline const char *gzpar_error(const gzpar_t *g) {
+    return g->msg ? g->msg : "read error";
+}
+
+static inline void gzpar_close(gzpar_t *g) {
+    if (!g) return;
+    pthread_mutex_lock(&g->mutex);
+    g->quit = 1;
+    pthread_cond_broadcast(&g->work_cond);
+    pthread_cond_broadcast(&g->space_cond);
+    pthread_mutex_unlock(&g->mutex);
+    for (int i = 0; i < g->nthreads; i++) pthread_join(g->threads[i], NULL);
+    for (int i = 0; i < g->nslots; i++) gzpar_slot_clear(g, &g->slots[i]);
+    if (g->reading) gzpar_chunk_put(g, g->reading);
+    while (g->free) {
+        gzpar_chunk_t *c = g->free;
+        g->free = c->next;
+        free(c);
+    }
+    pthread_mutex_destroy(&g->mutex);
+    pthread_cond_destroy(&g->work_cond);
+    pthread_cond_destroy(&g->data_cond);
+    pthread_cond_destroy(&g->space_cond);
+    free(g->slots);
+    free(g);
+}
+
+// Returns NULL if no worker could be started
+static inline gzpar_t *gzpar_open(const void *data, size_t size, int threads) {
+    if (threads > GZPAR_MAX_THREADS) threads = GZPAR_MAX_THREADS;
+    if (threads < 1) threads = 1;
+    gzpar_t *g = calloc(1, sizeof(gzpar_t));
+    if (!g) return NULL;
+    g->data = (const unsigned char *)data;
+    g->size = size;
+    g->range = size / (threads * 4);
+    if (g->range > GZPAR_RANGE) g->range = GZPAR_RANGE;
+    if (g->range < GZPAR_MIN_RANGE) g->range = GZPAR_MIN_RANGE;
+    g->nranges = (size + g->range - 1) / g->range;
+    g->nslots = 2 * threads;
+    g->slots = calloc(g->nslots, sizeof(gzpar_slot_t));
+    if (!g->slots) {
+        free(g);
+        return NULL;
+    }
+    pthread_mutex_init(&g->mutex, NULL);
+    pthread_cond_init(&g->work_cond, NULL);
+    pthread_cond_init(&g->data_cond, NULL);
+    pthread_cond_init(&g->space_cond, NULL);
+
+    pthread_mutex_lock(&g->mutex);
+    gzpar_admit(g);
+    pthread_mutex_unlock(&g->mutex);
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_lock(&g->mutex);
+        g->alive++;
+        pthread_mutex_unlock(&g->mutex);
+        if (pthread_create(&g->threads[g->nthreads], NULL, gzpar_worker, g) != 0) {
+            pthread_mutex_lock(&g->mutex);
+            g->alive--;
+            pthread_mutex_unlock(&g->mutex);
+            break;
+        }
+        g->nthreads++;
+    }
+    if (g->nthreads == 0) {
+        gzpar_close(g);
+        return NULL;
+    }
+    return g;
+}
+
+#endif
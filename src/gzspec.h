@@ -0,0 +1,892 @@
+/*
+ * gzspec.h - speculative parallel inflate of a single gzip member
+ *
+ * A plain .gz file is one deflate stream: blocks do not start on byte
+ * boundaries and back-references reach up to 32 KB into earlier output, so
+ * the stream cannot simply be cut. As in pugz, the compressed data is split
+ * into chunks of equal size and every chunk but the first is decoded from a
+ * guess: a worker looks for a bit position in its chunk where a dynamic
+ * Huffman block header is valid and the block decodes to text, and inflates
+ * from there with a window it does not know yet. Bytes copied from that
+ * unknown window are written as 16-bit markers (256 + offset in the window)
+ * until 32 KB of output are free of them, after which the chunk is plain
+ * bytes. Each chunk stops at the first dynamic block at or after the start
+ * of the next chunk, the place where the next chunk's search begins.
+ *
+ * The reader takes the chunks in order: a chunk whose guess is exactly where
+ * the previous one stopped has its markers replaced from the previous 32 KB
+ * of output. A wrong guess, or a chunk given up on, is decoded again by the
+ * reader with zlib from the right bit position and window, so the output is
+ * always the same as a sequential inflate. The CRC and length in the gzip
+ * trailer are checked at the end. A mismatch, or a stream cut short, makes
+ * gzspec_read() return -1 once the data before it has been read; gzspec_error()
+ * gives the cause in zlib's words.
+ *
+ * The output of the chunks in flight is bounded by GZSPEC_BUDGET in total:
+ * every slot and every worker's decoder holds an output buffer, each gets an
+ * equal share, and chunks are made small enough to fit in it. A chunk that
+ * outgrows its share, the first one included, is given up and inflated by
+ * the reader with zlib, straight into the caller's buffer.
+ *
+ *   gzspec_open()   start `threads` workers on the member at the start of a mapped file
+ *   gzspec_read()   next decompressed bytes, in order
+ *   gzspec_end()    offset just past the member once gzspec_read() returned 0
+ *   gzspec_error()  why gzspec_read() returned -1
+ *   gzspec_close()  stop the workers and free everything
+ */
+#ifndef N50_GZSPEC_H
+#define N50_GZSPEC_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#define GZSPEC_CHUNK       (4 << 20)    // compressed bytes per chunk at most
+#define GZSPEC_MIN_CHUNK   (512 << 10)  // and at least
+#define GZSPEC_MAX_OUT     (64 << 20)   // output bytes after which a chunk is given up
+#define GZSPEC_BUDGET      (512 << 20)  // output bytes of all the chunks in flight
+#define GZSPEC_RATIO       8            // output bytes per compressed byte a chunk has room for
+#define GZSPEC_WINDOW      32768
+#define GZSPEC_MAX_THREADS 64
+
+#define GZSPEC_LBITS 10                 // primary lookup bits, literal/length code
+#define GZSPEC_DBITS 8                  // primary lookup bits, distance code
+#define GZSPEC_LSIZE ((1 << GZSPEC_LBITS) * (1 + (1 << (15 - GZSPEC_LBITS))))
+#define GZSPEC_DSIZE ((1 << GZSPEC_DBITS) * (1 + (1 << (15 - GZSPEC_DBITS))))
+
+static const uint16_t gzspec_lbase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t gzspec_lextra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t gzspec_dbase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t gzspec_dextra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Bytes a FASTA/FASTQ literal may be while a guessed block is checked
+static inline int gzspec_is_text(unsigned c) {
+    return (c >= 32 && c < 127) || c == '\n' || c == '\r' || c == '\t';
+}
+
+/*
+ * Deflate decoder
+ */
+
+typedef struct {
+    const unsigned char *data;  // deflate stream
+    size_t size;
+    size_t pos;                 // next byte to load into buf
+    uint64_t buf;
+    unsigned bits;              // valid bits in buf
+
+    uint32_t lit[GZSPEC_LSIZE], dist[GZSPEC_DSIZE];
+    uint32_t fixed_lit[GZSPEC_LSIZE], fixed_dist[GZSPEC_DSIZE];
+
+    // Output: 16-bit symbols with markers until the window is known, then bytes.
+    // out[0, skip) repeats the last 32 KB of `wide` so copies can reach back.
+    uint16_t *wide;
+    size_t nwide, wide_cap;
+    size_t clean;               // wide[clean, nwide) holds no marker
+    unsigned char *out;
+    size_t nout, out_cap, skip;
+    int narrow;                 // writing to `out`
+    size_t max_out;             // output bytes (two per marker symbol) before giving up
+} gzspec_dec_t;
+
+static inline uint64_t gzspec_bitpos(const gzspec_dec_t *d) {
+    return (uint64_t)d->pos * 8 - d->bits;
+}
+
+// Keep at least 56 bits in buf; past the end of the data zeros are read
+static inline void gzspec_refill(gzspec_dec_t *d) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (d->pos + 8 <= d->size) {
+        uint64_t w;
+        memcpy(&w, d->data + d->pos, 8);
+        d->buf |= w << d->bits;
+        d->pos += (63 - d->bits) >> 3;
+        d->bits |= 56;
+        return;
+    }
+#endif
+    while (d->bits <= 56) {
+        uint64_t c = d->pos < d->size ? d->data[d->pos] : 0;
+        d->buf |= c << d->bits;
+        d->pos++;
+        d->bits += 8;
+    }
+}
+
+static inline unsigned gzspec_getbits(gzspec_dec_t *d, unsigned n) {
+    unsigned v = (unsigned)(d->buf & ((1ULL << n) - 1));
+    d->buf >>= n;
+    d->bits -= n;
+    return v;
+}
+
+static inline void gzspec_seek(gzspec_dec_t *d, uint64_t bitpos) {
+    d->pos = bitpos >> 3;
+    d->buf = 0;
+    d->bits = 0;
+    gzspec_refill(d);
+    gzspec_getbits(d, bitpos & 7);
+}
+
+// 32 bits of the stream at `bitpos`
+static inline uint32_t gzspec_peek(const unsigned char *data, size_t size, uint64_t bitpos) {
+    size_t p = bitpos >> 3;
+    uint64_t w = 0;
+    if (p + 8 <= size) {
+        for (int i = 7; i >= 0; i--) w = w << 8 | data[p + i];
+    } else {
+        for (int i = 7; i >= 0; i--) w = w << 8 | (p + i < size ? data[p + i] : 0);
+    }
+    return (uint32_t)(w >> (bitpos & 7));
+}
+
+// Canonical Huffman lookup table. Entries are symbol << 16 | bits, or for codes
+// longer than `pbits` subtable << 16 | subbits << 9 | 0x100 | pbits; 0 is invalid.
+// Returns -1 for an over-subscribed or (apart from a single code) incomplete code.
+static inline int gzspec_build(uint32_t *t, unsigned pbits, const uint8_t *lens, unsigned n, int complete) {
+    unsigned count[16] = {0}, next[16];
+    unsigned maxlen = 0;
+    for (unsigned i = 0; i < n; i++) {
+        count[lens[i]]++;
+        if (lens[i] > maxlen) maxlen = lens[i];
+    }
+    count[0] = 0;
+    int left = 1;
+    for (unsigned l = 1; l < 16; l++) {
+        left = (left << 1) - (int)count[l];
+        if (left < 0) return -1;
+    }
+    if (left > 0 && (complete || maxlen > 1)) return -1;
+
+    unsigned code = 0;
+    for (unsigned l = 1; l < 16; l++) {
+        code = (code + count[l - 1]) << 1;
+        next[l] = code;
+    }
+    unsigned subbits = maxlen > pbits ? maxlen - pbits : 0;
+    unsigned sub = 1u << pbits;
+    memset(t, 0, sizeof(uint32_t) << pbits);
+    for (unsigned sym = 0; sym < n; sym++) {
+        unsigned l = lens[sym];
+        if (!l) continue;
+        unsigned c = next[l]++, r = 0;
+        for (unsigned i = 0; i < l; i++) r |= ((c >> i) & 1) << (l - 1 - i);
+        if (l <= pbits) {
+            for (unsigned k = r; k < 1u << pbits; k += 1u << l) t[k] = sym << 16 | l;
+        } else {
+            unsigned p = r & ((1u << pbits) - 1);
+            if (!t[p]) {
+                t[p] = sub << 16 | subbits << 9 | 0x100 | pbits;
+                memset(t + sub, 0, sizeof(uint32_t) << subbits);
+                sub += 1u << subbits;
+            }
+            uint32_t *s = t + (t[p] >> 16);
+            for (unsigned k = r >> pbits; k < 1u << subbits; k += 1u << (l - pbits)) s[k] = sym << 16 | (l - pbits);
+        }
+    }
+    return 0;
+}
+
+// Next symbol, 0xffff for an invalid code. Needs 15 bits in buf.
+static inline unsigned gzspec_decode(gzspec_dec_t *d, const uint32_t *t, unsigned pbits) {
+    uint32_t e = t[d->buf & ((1u << pbits) - 1)];
+    if (e & 0x100) {
+        d->buf >>= pbits;
+        d->bits -= pbits;
+        e = t[(e >> 16) + (d->buf & ((1u << ((e >> 9) & 15)) - 1))];
+    }
+    if (!e) return 0xffff;
+    d->buf >>= e & 0xff;
+    d->bits -= e & 0xff;
+    return e >> 16;
+}
+
+static inline void gzspec_dec_init(gzspec_dec_t *d, const unsigned char *data, size_t size) {
+    uint8_t lens[288];
+    memset(d, 0, sizeof(*d));
+    d->data = data;
+    d->size = size;
+    for (int i = 0; i < 288; i++) lens[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    gzspec_build(d->fixed_lit, GZSPEC_LBITS, lens, 288, 1);
+    // Distance codes 30 and 31 exist in the fixed code but are invalid
+    for (int i = 0; i < 32; i++) lens[i] = 5;
+    gzspec_build(d->fixed_dist, GZSPEC_DBITS, lens, 32, 1);
+}
+
+static inline void gzspec_dec_free(gzspec_dec_t *d) {
+    free(d->wide);
+    free(d->out);
+}
+
+// Start a new output: with markers if the window is unknown, bytes otherwise
+static inline void gzspec_dec_reset(gzspec_dec_t *d, int narrow) {
+    d->nwide = d->clean = d->nout = d->skip = 0;
+    d->narrow = narrow;
+}
+
+// Room for `n` more symbols plus the 8 bytes an over-copy may write
+static inline int gzspec_reserve(gzspec_dec_t *d, size_t n) {
+    // Corrupt data can decode zeros past the end forever
+    if (d->pos > d->size + 8 || d->nwide * 2 + d->nout + n > d->max_out) return -1;
+    if (d->narrow) {
+        if (d->nout + n + 8 <= d->out_cap) return 0;
+        size_t cap = d->out_cap ? d->out_cap : (1 << 20);
+        while (cap < d->nout + n + 8) cap *= 2;
+        unsigned char *p = realloc(d->out, cap);
+        if (!p) return -1;
+        d->out = p;
+        d->out_cap = cap;
+    } else {
+        if (d->nwide + n <= d->wide_cap) return 0;
+        size_t cap = d->wide_cap ? d->wide_cap : (1 << 20);
+        while (cap < d->nwide + n) cap *= 2;
+        uint16_t *p = realloc(d->wide, cap * sizeof(uint16_t));
+        if (!p) return -1;
+        d->wide = p;
+        d->wide_cap = cap;
+    }
+    return 0;
+}
+
+// Once the last 32 KB have no marker, continue in bytes
+static inline int gzspec_go_narrow(gzspec_dec_t *d) {
+    d->narrow = 1;
+    d->nout = 0;
+    if (gzspec_reserve(d, GZSPEC_WINDOW) != 0) return -1;
+    for (size_t i = 0; i < GZSPEC_WINDOW; i++) d->out[i] = (unsigned char)d->wide[d->nwide - GZSPEC_WINDOW + i];
+    d->nout = d->skip = GZSPEC_WINDOW;
+    return 0;
+}
+
+// Read a dynamic block header into d->lit and d->dist
+static inline int gzspec_header(gzspec_dec_t *d) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    uint8_t lens[320];
+    uint32_t ctab[1 << 7];
+    if (d->bits < 32) gzspec_refill(d);
+    unsigned nlit = gzspec_getbits(d, 5) + 257;
+    unsigned ndist = gzspec_getbits(d, 5) + 1;
+    unsigned ncode = gzspec_getbits(d, 4) + 4;
+    if (nlit > 286 || ndist > 30) return -1;
+    memset(lens, 0, 19);
+    for (unsigned i = 0; i < ncode; i++) {
+        if (d->bits < 3) gzspec_refill(d);
+        lens[order[i]] = gzspec_getbits(d, 3);
+    }
+    if (gzspec_build(ctab, 7, lens, 19, 1) != 0) return -1;
+
+    unsigned n = 0;
+    while (n < nlit + ndist) {
+        if (d->bits < 16) gzspec_refill(d);
+        unsigned sym = gzspec_decode(d, ctab, 7);
+        if (sym < 16) {
+            lens[n++] = sym;
+            continue;
+        }
+        unsigned rep, val = 0;
+        if (sym == 16) {
+            if (n == 0) return -1;
+            val = lens[n - 1];
+            rep = 3 + gzspec_getbits(d, 2);
+        } else if (sym == 17) {
+            rep = 3 + gzspec_getbits(d, 3);
+        } else if (sym == 18) {
+            rep = 11 + gzspec_getbits(d, 7);
+        } else {
+            return -1;
+        }
+        if (n + rep > nlit + ndist) return -1;
+        while (rep--) lens[n++] = val;
+    }
+    if (lens[256] == 0) return -1;
+    if (gzspec_build(d->lit, GZSPEC_LBITS, lens, nlit, 0) != 0) return -1;
+    if (gzspec_build(d->dist, GZSPEC_DBITS, lens + nlit, ndist, 0) != 0) return -1;
+    return 0;
+}
+
+// Decode the symbols of one Huffman block up to its end-of-block code.
+// `check` rejects non-text literals, used while a guessed start is verified.
+static inline __attribute__((always_inline)) int gzspec_body(gzspec_dec_t *d, const uint32_t *lit, const uint32_t *dist,
+                                                             const int narrow, const int check) {
+    for (;;) {
+        if (narrow ? d->nout + 266 > d->out_cap : d->nwide + 258 > d->wide_cap) {
+            if (gzspec_reserve(d, 258) != 0) return -1;
+        }
+        // 48 bits cover the longest length/distance pair
+        if (d->bits < 48) gzspec_refill(d);
+        unsigned sym = gzspec_decode(d, lit, GZSPEC_LBITS);
+        if (sym < 256) {
+            if (check && !gzspec_is_text(sym)) return -1;
+            if (narrow) d->out[d->nout++] = (unsigned char)sym;
+            else d->wide[d->nwide++] = (uint16_t)sym;
+            continue;
+        }
+        if (sym == 256) return 0;
+        sym -= 257;
+        if (sym >= 29) return -1;
+        unsigned len = gzspec_lbase[sym] + gzspec_getbits(d, gzspec_lextra[sym]);
+        unsigned dsym = gzspec_decode(d, dist, GZSPEC_DBITS);
+        if (dsym >= 30) return -1;
+        size_t back = gzspec_dbase[dsym] + gzspec_getbits(d, gzspec_dextra[dsym]);
+        if (narrow) {
+            if (back > d->nout) return -1;
+            unsigned char *o = d->out + d->nout;
+            const unsigned char *s = o - back;
+            if (back >= 8) {
+                for (unsigned i = 0; i < len; i += 8) memcpy(o + i, s + i, 8);
+            } else {
+                for (unsigned i = 0; i < len; i++) o[i] = s[i];
+            }
+            d->nout += len;
+        } else {
+            uint16_t *o = d->wide + d->nwide;
+            if (back <= d->nwide) {
+                const uint16_t *s = o - back;
+                for (unsigned i = 0; i < len; i++) o[i] = s[i];
+                if (d->clean > d->nwide - back) {
+                    // Copied markers are still markers
+                    for (unsigned i = 0; i < len; i++) {
+                        if (o[i] >= 256) d->clean = d->nwide + i + 1;
+                    }
+                }
+            } else {
+                // Reaches into the unknown window before the chunk
+                for (unsigned i = 0; i < len; i++) {
+                    int64_t s = (int64_t)(d->nwide + i) - (int64_t)back;
+                    o[i] = s >= 0 ? d->wide[s] : (uint16_t)(256 + GZSPEC_WINDOW + s);
+                }
+                d->clean = d->nwide + len;
+            }
+            d->nwide += len;
+        }
+    }
+}
+
+static inline int gzspec_stored(gzspec_dec_t *d, int check) {
+    gzspec_getbits(d, d->bits & 7);
+    if (d->bits < 32) gzspec_refill(d);
+    unsigned len = gzspec_getbits(d, 16);
+    unsigned nlen = gzspec_getbits(d, 16);
+    if (len != (~nlen & 0xffff)) return -1;
+    // Hand the whole bytes left in buf back to the input
+    d->pos -= d->bits >> 3;
+    d->buf = 0;
+    d->bits = 0;
+    if (d->pos + len > d->size || gzspec_reserve(d, len) != 0) return -1;
+    const unsigned char *s = d->data + d->pos;
+    for (unsigned i = 0; check && i < len; i++) {
+        if (!gzspec_is_text(s[i])) return -1;
+    }
+    if (d->narrow) {
+        memcpy(d->out + d->nout, s, len);
+        d->nout += len;
+    } else {
+        for (unsigned i = 0; i < len; i++) d->wide[d->nwide + i] = s[i];
+        d->nwide += len;
+    }
+    d->pos += len;
+    return 0;
+}
+
+// Decode one block, header included. Returns 1 after the final block, 0 after
+// another block and -1 on invalid data.
+static inline int gzspec_block(gzspec_dec_t *d, int check) {
+    if (d->bits < 3) gzspec_refill(d);
+    unsigned final = gzspec_getbits(d, 1);
+    unsigned type = gzspec_getbits(d, 2);
+    int ret;
+    if (type == 0) {
+        ret = gzspec_stored(d, check);
+    } else if (type == 3) {
+        return -1;
+    } else {
+        const uint32_t *lit = d->fixed_lit, *dist = d->fixed_dist;
+        if (type == 2) {
+            if (gzspec_header(d) != 0) return -1;
+            lit = d->lit;
+            dist = d->dist;
+        }
+        if (d->narrow) ret = check ? gzspec_body(d, lit, dist, 1, 1) : gzspec_body(d, lit, dist, 1, 0);
+        else ret = check ? gzspec_body(d, lit, dist, 0, 1) : gzspec_body(d, lit, dist, 0, 0);
+    }
+    if (ret != 0 || gzspec_bitpos(d) > (uint64_t)d->size * 8) return -1;
+    if (!d->narrow && d->nwide - d->clean >= GZSPEC_WINDOW && gzspec_go_narrow(d) != 0) return -1;
+    return final;
+}
+
+// Is there the header of a dynamic, non-final block at `bitpos`?
+static inline int gzspec_dynamic_at(const unsigned char *data, size_t size, uint64_t bitpos) {
+    uint32_t v = gzspec_peek(data, size, bitpos);
+    return (v & 7) == 4 && ((v >> 3) & 31) <= 29 && ((v >> 8) & 31) <= 29;
+}
+
+// Find the first bit in [from, to) where a dynamic block starts and decodes to
+// text, and leave the decoder after that block. Returns the position or -1.
+static inline int64_t gzspec_find(gzspec_dec_t *d, uint64_t from, uint64_t to, size_t max_out) {
+    d->max_out = max_out;
+    for (uint64_t bp = from; bp < to; bp++) {
+        if (!gzspec_dynamic_at(d->data, d->size, bp)) continue;
+        gzspec_seek(d, bp);
+        gzspec_dec_reset(d, 0);
+        if (gzspec_block(d, 1) != 0) continue;
+        // The next block header must be possible too
+        if (d->bits < 3) gzspec_refill(d);
+        if (((d->buf >> 1) & 3) != 3) return (int64_t)bp;
+    }
+    return -1;
+}
+
+// Decode blocks until the final one (returns 1) or until a dynamic, non-final
+// block starts at or after `stop` (returns 0). -1 on invalid data or when a
+// guessed chunk produces more than `max_out` bytes.
+static inline int gzspec_inflate(gzspec_dec_t *d, uint64_t stop, size_t max_out) {
+    d->max_out = max_out;
+    for (;;) {
+        uint64_t bp = gzspec_bitpos(d);
+        if (bp >= stop && gzspec_dynamic_at(d->data, d->size, bp)) return 0;
+        int ret = gzspec_block(d, 0);
+        if (ret != 0) return ret;
+        if (d->nwide * 2 + d->nout > max_out) return -1;
+    }
+}
+
+/*
+ * Chunks and workers
+ */
+
+enum {
+    GZSPEC_PENDING,
+    GZSPEC_RUNNING,
+    GZSPEC_DONE
+};
+
+typedef struct {
+    uint64_t index;         // chunk number
+    unsigned gen;           // bumped when the slot is reused, stale workers drop their output
+    int state;
+    int ok;                 // a start was found and decoding reached `end`
+    int final;              // the member ends in this chunk
+    uint64_t start, end;    // bit positions in the deflate stream
+    uint16_t *wide;         // output, see gzspec_dec_t
+    size_t nwide, wide_cap;
+    unsigned char *out;
+    size_t nout, out_cap, skip;
+} gzspec_slot_t;
+
+typedef struct {
+    const unsigned char *file;  // the whole mapped file
+    size_t file_size;
+    const unsigned char *data;  // deflate stream of the member
+    size_t size;                // bytes from the deflate stream to the end of the file
+    size_t chunk;
+    uint64_t nchunks;
+    size_t max_out;             // output bytes of a chunk before it is given up
+
+    int nslots;
+    gzspec_slot_t *slots;       // chunk c lives in slots[c % nslots]
+    uint64_t current;           // chunk being read
+    uint64_t admitted;          // chunks [current, admitted) are scheduled
+    uint64_t expected;          // bit position where the output continues
+
+    // What gzspec_read() copies out next: resolved markers, then bytes
+    const unsigned char *span[2];
+    size_t span_len[2];
+    int in_chunk;               // spans point into the current slot
+    int final;                  // the member ends after the spans
+    unsigned char *resolved;
+    size_t resolved_cap;
+
+    int serial;                 // inflating with zlib up to serial_stop
+    uint64_t serial_stop;
+    z_stream z;
+
+    unsigned char window[GZSPEC_WINDOW];    // last output bytes
+    uLong crc;
+    uint64_t total;
+    int done;
+    size_t end;                 // offset past the member in the file
+
+    int quit;
+    int error;
+    const char *msg;            // cause of the error
+    int nthreads, alive;
+    pthread_t threads[GZSPEC_MAX_THREADS];
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond, data_cond;
+} gzspec_t;
+
+static inline void gzspec_fail(gzspec_t *g, const char *msg) {
+    g->error = 1;
+    g->msg = msg;
+}
+
+static inline void gzspec_run(gzspec_t *g, gzspec_slot_t *s, unsigned gen, uint64_t index, gzspec_dec_t *d) {
+    uint64_t lo = index * g->chunk;
+    uint64_t hi = lo + g->chunk < g->size ? lo + g->chunk : g->size;
+    int64_t start;
+    int ret;
+    if (index == 0) {
+        // The first chunk starts with the stream and an empty window
+        start = 0;
+        gzspec_seek(d, 0);
+        gzspec_dec_reset(d, 1);
+        ret = gzspec_inflate(d, hi * 8, g->max_out);
+    } else {
+        start = gzspec_find(d, lo * 8, hi * 8, g->max_out);
+        ret = start < 0 ? -1 : gzspec_inflate(d, hi * 8, g->max_out);
+    }
+
+    pthread_mutex_lock(&g->mutex);
+    if (s->gen == gen) {
+        s->ok = ret >= 0;
+        s->final = ret == 1;
+        s->start = start < 0 ? 0 : (uint64_t)start;
+        s->end = gzspec_bitpos(d);
+        // Swap buffers: the slot takes the output, the decoder keeps the old ones
+        uint16_t *w = s->wide;
+        unsigned char *o = s->out;
+        size_t wc = s->wide_cap, oc = s->out_cap;
+        s->wide = d->wide;
+        s->nwide = d->nwide;
+        s->wide_cap = d->wide_cap;
+        s->out = d->out;
+        s->nout = d->nout;
+        s->out_cap = d->out_cap;
+        s->skip = d->skip;
+        d->wide = w;
+        d->wide_cap = wc;
+        d->out = o;
+        d->out_cap = oc;
+        s->state = GZSPEC_DONE;
+        pthread_cond_signal(&g->data_cond);
+    }
+    pthread_mutex_unlock(&g->mutex);
+}
+
+static void *gzspec_worker(void *arg) {
+    gzspec_t *g = (gzspec_t *)arg;
+    gzspec_dec_t *d = malloc(sizeof(gzspec_dec_t));
+    if (d) gzspec_dec_init(d, g->data, g->size);
+
+    pthread_mutex_lock(&g->mutex);
+    if (!d) {
+        if (--g->alive == 0) gzspec_fail(g, "out of memory");
+        pthread_cond_signal(&g->data_cond);
+        pthread_mutex_unlock(&g->mutex);
+        return NULL;
+    }
+    while (!g->quit) {
+        gzspec_slot_t *s = NULL;
+        for (uint64_t c = g->current; c < g->admitted; c++) {
+            if (g->slots[c % g->nslots].state == GZSPEC_PENDING) {
+                s = &g->slots[c % g->nslots];
+                break;
+            }
+        }
+        if (!s) {
+            pthread_cond_wait(&g->work_cond, &g->mutex);
+            continue;
+        }
+        s->state = GZSPEC_RUNNING;
+        unsigned gen = s->gen;
+        uint64_t index = s->index;
+        pthread_mutex_unlock(&g->mutex);
+        gzspec_run(g, s, gen, index, d);
+        pthread_mutex_lock(&g->mutex);
+    }
+    pthread_mutex_unlock(&g->mutex);
+    gzspec_dec_free(d);
+    free(d);
+    return NULL;
+}
+
+// Schedule chunks up to the size of the window. Callers hold the mutex.
+static inline void gzspec_admit(gzspec_t *g) {
+    while (g->admitted < g->nchunks && g->admitted < g->current + g->nslots) {
+        gzspec_slot_t *s = &g->slots[g->admitted % g->nslots];
+        s->gen++;
+        s->index = g->admitted++;
+        s->state = GZSPEC_PENDING;
+    }
+    pthread_cond_broadcast(&g->work_cond);
+}
+
+static inline void gzspec_advance(gzspec_t *g) {
+    pthread_mutex_lock(&g->mutex);
+    g->slots[g->current % g->nslots].gen++;
+    g->current++;
+    gzspec_admit(g);
+    pthread_mutex_unlock(&g->mutex);
+}
+
+// Account for output handed to the reader
+static inline void gzspec_emit(gzspec_t *g, const unsigned char *p, size_t n) {
+    for (size_t off = 0; off < n; off += 1 << 30) {
+        size_t len = n - off < (1 << 30) ? n - off : (1 << 30);
+        g->crc = crc32(g->crc, p + off, (uInt)len);
+    }
+    if (n >= GZSPEC_WINDOW) {
+        memcpy(g->window, p + n - GZSPEC_WINDOW, GZSPEC_WINDOW);
+    } else {
+        memmove(g->window, g->window + n, GZSPEC_WINDOW - n);
+        memcpy(g->window + GZSPEC_WINDOW - n, p, n);
+    }
+    g->total += n;
+}
+
+// Check the gzip trailer at byte `off` of the deflate stream
+static inline void gzspec_trailer(gzspec_t *g, size_t off) {
+    g->done = 1;
+    if (g->size - off < 8) {
+        g->end = g->file_size;
+        gzspec_fail(g, "unexpected end of file");
+        return;
+    }
+    const unsigned char *t = g->data + off;
+    uint32_t crc = t[0] | t[1] << 8 | t[2] << 16 | (uint32_t)t[3] << 24;
+    uint32_t isize = t[4] | t[5] << 8 | t[6] << 16 | (uint32_t)t[7] << 24;
+    if (crc != (uint32_t)g->crc) gzspec_fail(g, "incorrect data check");
+    else if (isize != (uint32_t)g->total) gzspec_fail(g, "incorrect length check");
+    g->end = (g->data - g->file) + off + 8;
+}
+
+// Inflate with zlib from the expected position up to the end of the chunk
+static inline int gzspec_serial_start(gzspec_t *g, uint64_t stop) {
+    size_t byte = g->expected >> 3;
+    unsigned r = g->expected & 7;
+    if (byte >= g->size || inflateReset(&g->z) != Z_OK) return -1;
+    if (r) {
+        inflatePrime(&g->z, 8 - r, g->data[byte] >> r);
+        byte++;
+    }
+    size_t wlen = g->total < GZSPEC_WINDOW ? g->total : GZSPEC_WINDOW;
+    if (wlen) inflateSetDictionary(&g->z, g->window + GZSPEC_WINDOW - wlen, wlen);
+    g->z.next_in = (unsigned char *)g->data + byte;
+    g->z.avail_in = g->size - byte < UINT_MAX ? g->size - byte : UINT_MAX;
+    g->serial = 1;
+    g->serial_stop = stop;
+    return 0;
+}
+
+static inline long gzspec_serial_read(gzspec_t *g, char *buf, size_t cap) {
+    g->z.next_out = (unsigned char *)buf;
+    g->z.avail_out = cap < UINT_MAX ? cap : UINT_MAX;
+    int ret = inflate(&g->z, Z_BLOCK);
+    size_t n = (unsigned char *)g->z.next_out - (unsigned char *)buf;
+    gzspec_emit(g, (unsigned char *)buf, n);
+    size_t in = g->z.next_in - g->data;
+    if (ret == Z_STREAM_END) {
+        g->serial = 0;
+        gzspec_trailer(g, in);
+    } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+        uint64_t bp = (uint64_t)in * 8 - (g->z.data_type & 7);
+        if ((g->z.data_type & 128) && !(g->z.data_type & 64) && bp >= g->serial_stop &&
+            gzspec_dynamic_at(g->data, g->size, bp)) {
+            g->serial = 0;
+            g->expected = bp;
+            gzspec_advance(g);
+        } else if (n == 0 && g->z.avail_in == 0) {
+            if (in < g->size) {
+                g->z.avail_in = g->size - in < UINT_MAX ? g->size - in : UINT_MAX;
+            } else {
+                g->serial = 0;
+                g->done = 1;
+                g->end = g->file_size;
+                gzspec_fail(g, "unexpected end of file");
+            }
+        }
+    } else {
+        gzspec_fail(g, g->z.msg ? g->z.msg : "invalid compressed data");
+    }
+    return (long)n;
+}
+
+// Line up the output of the next chunk, or switch to zlib for it
+static inline void gzspec_next(gzspec_t *g) {
+    if (g->current >= g->nchunks) {
+        g->done = 1;                // the final block was never found
+        g->end = g->file_size;
+        gzspec_fail(g, "unexpected end of file");
+        return;
+    }
+    gzspec_slot_t *s = &g->slots[g->current % g->nslots];
+    pthread_mutex_lock(&g->mutex);
+    while (s->state != GZSPEC_DONE && !g->error) pthread_cond_wait(&g->data_cond, &g->mutex);
+    pthread_mutex_unlock(&g->mutex);
+    if (g->error) return;
+
+    uint64_t hi = (g->current + 1) * g->chunk;
+    if (hi > g->size) hi = g->size;
+    if (s->ok && s->start == g->expected) {
+        if (s->nwide > g->resolved_cap) {
+            unsigned char *p = realloc(g->resolved, s->nwide);
+            if (!p) {
+                gzspec_fail(g, "out of memory");
+                return;
+            }
+            g->resolved = p;
+            g->resolved_cap = s->nwide;
+        }
+        for (size_t i = 0; i < s->nwide; i++) {
+            uint16_t v = s->wide[i];
+            g->resolved[i] = v < 256 ? (unsigned char)v : g->window[v - 256];
+        }
+        // out[0, skip) repeats the end of wide
+        g->span[0] = g->resolved;
+        g->span_len[0] = s->nwide;
+        g->span[1] = s->out + s->skip;
+        g->span_len[1] = s->nout - s->skip;
+        g->in_chunk = 1;
+        g->final = s->final;
+        g->expected = s->end;
+    } else if (g->expected >= hi * 8) {
+        gzspec_advance(g);          // the previous chunk already covers this one
+    } else if (gzspec_serial_start(g, hi * 8) != 0) {
+        gzspec_fail(g, "unexpected end of file");
+    }
+}
+
+static inline long gzspec_read(void *ctx, char *buf, size_t cap) {
+    gzspec_t *g = (gzspec_t *)ctx;
+    size_t done = 0;
+    while (done < cap && !g->error) {
+        if (g->in_chunk) {
+            int i = g->span_len[0] ? 0 : 1;
+            if (g->span_len[i]) {
+                size_t n = g->span_len[i] < cap - done ? g->span_len[i] : cap - done;
+                memcpy(buf + done, g->span[i], n);
+                gzspec_emit(g, g->span[i], n);
+                g->span[i] += n;
+                g->span_len[i] -= n;
+                done += n;
+                continue;
+            }
+            g->in_chunk = 0;
+            if (g->final) gzspec_trailer(g, (g->expected + 7) >> 3);
+            else gzspec_advance(g);
+        } else if (g->serial) {
+            done += gzspec_serial_read(g, buf + done, cap - done);
+        } else if (g->done) {
+            break;
+        } else {
+            gzspec_next(g);
+        }
+    }
+    if (g->error && done == 0) return -1;
+    return (long)done;
+}
+
+static inline size_t gzspec_end(const gzspec_t *g) {
+    return g->end;
+}
+
+static inline const char *gzspec_error(const gzspec_t *g) {
+    return g->msg ? g->msg : "read error";
+}
+
+static inline void gzspec_close(gzspec_t *g) {
+    if (!g) return;
+    pthread_mutex_lock(&g->mutex);
+    g->quit = 1;
+    pthread_cond_broadcast(&g->work_cond);
+    pthread_mutex_unlock(&g->mutex);
+    for (int i = 0; i < g->nthreads; i++) pthread_join(g->threads[i], NULL);
+    for (int i = 0; i < g->nslots; i++) {
+        free(g->slots[i].wide);
+        free(g->slots[i].out);
+    }
+    inflateEnd(&g->z);
+    pthread_mutex_destroy(&g->mutex);
+    pthread_cond_destroy(&g->work_cond);
+    pthread_cond_destroy(&g->data_cond);
+    free(g->resolved);
+    free(g->slots);
+    free(g);
+}
+
+// Length of the gzip header at `h`, 0 if there is none
+static inline size_t gzspec_header_size(const unsigned char *h, size_t size) {
+    if (size < 18 || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || (h[3] & 0xe0)) return 0;
+    size_t p = 10;
+    if (h[3] & 4) {
+        p += 2 + (h[10] | (size_t)h[11] << 8);
+    }
+    for (int flag = 8; flag <= 16; flag <<= 1) {
+        if (!(h[3] & flag)) continue;
+        while (p < size && h[p]) p++;
+        p++;
+    }
+    if (h[3] & 2) p += 2;
+    return p < size ? p : 0;
+}
+
+// Returns NULL if the file does not start with a gzip header or no worker starts
+static inline gzspec_t *gzspec_open(const void *data, size_t size, int threads) {
+    const unsigned char *file = (const unsigned char *)data;
+    size_t hdr = gzspec_header_size(file, size);
+    if (!hdr) return NULL;
+    if (threads > GZSPEC_MAX_THREADS) threads = GZSPEC_MAX_THREADS;
+    if (threads < 1) threads = 1;
+
+    gzspec_t *g = calloc(1, sizeof(gzspec_t));
+    if (!g) return NULL;
+    g->file = file;
+    g->file_size = size;
+    g->data = file + hdr;
+    g->size = size - hdr;
+    g->nslots = 2 * threads;
+    // Slots and decoders share the budget, and a chunk fits in its share
+    g->max_out = GZSPEC_BUDGET / (g->nslots + threads);
+    if (g->max_out > GZSPEC_MAX_OUT) g->max_out = GZSPEC_MAX_OUT;
+    g->chunk = g->size / (threads * 4);
+    if (g->chunk > GZSPEC_CHUNK) g->chunk = GZSPEC_CHUNK;
+    if (g->chunk > g->max_out / GZSPEC_RATIO) g->chunk = g->max_out / GZSPEC_RATIO;
+    if (g->chunk < GZSPEC_MIN_CHUNK) g->chunk = GZSPEC_MIN_CHUNK;
+    g->nchunks = (g->size + g->chunk - 1) / g->chunk;
+    g->slots = calloc(g->nslots, sizeof(gzspec_slot_t));
+    g->crc = crc32(0L, Z_NULL, 0);
+    if (!g->slots || inflateInit2(&g->z, -MAX_WBITS) != Z_OK) {
+        free(g->slots);
+        free(g);
+        return NULL;
+    }
+    pthread_mutex_init(&g->mutex, NULL);
+    pthread_cond_init(&g->work_cond, NULL);
+    pthread_cond_init(&g->data_cond, NULL);
+
+    pthread_mutex_lock(&g->mutex);
+    gzspec_admit(g);
+    pthread_mutex_unlock(&g->mutex);
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_lock(&g->mutex);
+        g->alive++;
+        pthread_mutex_unlock(&g->mutex);
+        if (pthread_create(&g->threads[g->nthreads], NULL, gzspec_worker, g) != 0) {
+            pthread_mutex_lock(&g->mutex);
+            g->alive--;
+            pthread_mutex_unlock(&g->mutex);
+            break;
+        }
+        g->nthreads++;
+    }
+    if (g->nthreads == 0) {
+        gzspec_close(g);
+        return NULL;
+    }
+    return g;
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * hwcount.h - hardware performance counters per phase (--hwcounters)
+ *
+ * Timings say how long a phase took, not why: a file can be bound by
+ * branch misses in the composition loop, by cache misses in the sort or by
+ * zlib. With --hwcounters every thread that reads files opens its own group
+ * of counters with perf_event_open(2) (cycles, instructions, cache misses,
+ * branch misses, stalled cycles; user space only), and reads the group at
+ * every phase boundary; the difference goes to the phase that just ended.
+ * One read() returns the whole group. n50, fqc and n50_qual read the
+ * counters per block or batch of records, so that the system calls hardly
+ * disturb what is measured; n50_qual, whose parser reuses its buffers for
+ * every record, copies a batch of reads before it processes them.
+ *
+ * The report gives, per phase summed over all threads, the raw counts, IPC
+ * and misses per MB of decompressed input. Counters the CPU lacks (stalled
+ * cycles on many cores) are shown as "-". Other systems than Linux, and
+ * Linux without access to the counters (see perf_event_paranoid, or virtual
+ * machines without a PMU), get a warning and no report.
+ *
+ *   hwcount_open()   open the counters of the calling thread
+ *   hwcount_lap()    add the counts since the last lap to a phase
+ *   hwcount_read()   fxscan_read_fn that counts the reads of another one as decompress
+ *   hwcount_close()  close them
+ *   hwcount_add()    add up the phases of two threads or files
+ *   hwcount_print()  print the report
+ */
+#ifndef N50_HWCOUNT_H
+#define N50_HWCOUNT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "profile.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+enum {
+    HW_CYCLES,
+    HW_INSTRUCTIONS,
+    HW_CACHE_MISSES,
+    HW_BRANCH_MISSES,
+    HW_STALLED,
+    HW_EVENTS
+};
+
+static const char *const hwcount_names[HW_EVENTS] = {
+    "Cycles", "Instructions", "CacheMisses", "BranchMisses", "StalledCycles"
+};
+
+typedef struct {
+    int fd[HW_EVENTS];          // -1 for counters that could not be opened
+    int order[HW_EVENTS];       // event of each value in a group read
+    int n;                      // counters in the group
+    uint64_t last[HW_EVENTS];
+} hwcount_t;
+
+// Counts per phase (profile.h phases); `have` has a bit for every event counted
+typedef struct {
+    uint64_t count[PROF_PHASES][HW_EVENTS];
+    unsigned have;
+    uint64_t bytes;             // decompressed input
+} hwcount_sum_t;
+
+#ifdef __linux__
+static inline int hwcount_event(int event, int group) {
+    static const uint64_t config[HW_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+    };
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config[event];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = group < 0;      // the leader starts the group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+// Returns 0, or -1 with errno set if the counters cannot be used
+static inline int hwcount_open(hwcount_t *hw) {
+    memset(hw, 0, sizeof(*hw));
+    for (int i = 0; i < HW_EVENTS; i++) hw->fd[i] = -1;
+#ifdef __linux__
+    hw->fd[HW_CYCLES] = hwcount_event(HW_CYCLES, -1);
+    if (hw->fd[HW_CYCLES] < 0) return -1;
+    hw->order[hw->n++] = HW_CYCLES;
+    for (int i = HW_CYCLES + 1; i < HW_EVENTS; i++) {
+        hw->fd[i] = hwcount_event(i, hw->fd[HW_CYCLES]);
+        if (hw->fd[i] >= 0) hw->order[hw->n++] = i;
+    }
+    ioctl(hw->fd[HW_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(hw->fd[HW_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static inline void hwcount_lap(hwcount_t *hw, hwcount_sum_t *sum, int phase) {
+    uint64_t buf[1 + HW_EVENTS];
+    if (!hw || hw->n == 0) return;
+    if (read(hw->fd[HW_CYCLES], buf, sizeof(buf)) < (ssize_t)((1 + hw->n) * sizeof(uint64_t))) return;
+    for (int i = 0; i < hw->n; i++) {
+        int e = hw->order[i];
+        sum->count[phase][e] += buf[1 + i] - hw->last[e];
+        hw->last[e] = buf[1 + i];
+        sum->have |= 1u << e;
+    }
+}
+
+// A read callback and its context, with the counters of the thread that calls it
+typedef struct {
+    fxscan_read_fn read;
+    void *ctx;
+    hwcount_t *hw;
+    hwcount_sum_t *sum;
+} hwcount_reader_t;
+
+// What ran since the last lap was parsing
+static inline long hwcount_read(void *arg, char *buf, size_t cap) {
+    hwcount_reader_t *r = (hwcount_reader_t *)arg;
+    hwcount_lap(r->hw, r->sum, PROF_PARSE);
+    long n = r->read(r->ctx, buf, cap);
+    hwcount_lap(r->hw, r->sum, PROF_DECOMPRESS);
+    if (n > 0) r->sum->bytes += n;
+    return n;
+}
+
+static inline void hwcount_close(hwcount_t *hw) {
+    for (int i = 0; i < HW_EVENTS; i++) {
+        if (hw->fd[i] >= 0) close(hw->fd[i]);
+        hw->fd[i] = -1;
+    }
+    hw->n = 0;
+}
+
+static inline void hwcount_add(hwcount_sum_t *dst, const hwcount_sum_t *src) {
+    for (int p = 0; p < PROF_PHASES; p++) {
+        for (int e = 0; e < HW_EVENTS; e++) dst->count[p][e] += src->count[p][e];
+    }
+    dst->have |= src->have;
+    dst->bytes += src->bytes;
+}
+
+static inline void hwcount_print(FILE *fp, const hwcount_sum_t *sum) {
+    double mb = sum->bytes / 1e6;
+    fprintf(fp, "Phase");
+    for (int e = 0; e < HW_EVENTS; e++) fprintf(fp, "\t%s", hwcount_names[e]);
+    fprintf(fp, "\tIPC\tCacheMisses/MB\tBranchMisses/MB\n");
+    for (int p = 0; p < PROF_PHASES; p++) {
+        const uint64_t *c = sum->count[p];
+        if (!c[HW_CYCLES]) continue;
+        fprintf(fp, "%s", profile_phase_names[p]);
+        for (int e = 0; e < HW_EVENTS; e++) {
+            if (sum->have & (1u << e)) fprintf(fp, "\t%llu", (unsigned long long)c[e]);
+            else fprintf(fp, "\t-");
+        }
+        if (sum->have & (1u << HW_INSTRUCTIONS)) fprintf(fp, "\t%.2f", (double)c[HW_INSTRUCTIONS] / c[HW_CYCLES]);
+        else fprintf(fp, "\t-");
+        for (int e = HW_CACHE_MISSES; e <= HW_BRANCH_MISSES; e++) {
+            if ((sum->have & (1u << e)) && mb > 0) fprintf(fp, "\t%.1f", c[e] / mb);
+            else fprintf(fp, "\t-");
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+#endif
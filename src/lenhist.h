@@ -0,0 +1,242 @@
+/*
+ * lenhist.h - exact sequence length histogram
+ *
+ * Read lengths are heavily duplicated (a 200M reads Illumina run has a few
+ * hundred distinct lengths), so instead of storing one entry per sequence we
+ * count how many sequences have each length. Short lengths are counted in a
+ * dense array, long ones in a small open addressing hash map. Memory is
+ * bounded by the number of distinct lengths, and N50/N75/N90/I50/auN are
+ * derived exactly, with the same results as sorting every length.
+ */
+#ifndef N50_LENHIST_H
+#define N50_LENHIST_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "radix.h"
+
+#define LENHIST_DENSE_MAX 65536   // lengths below this go to the dense array
+#define LENHIST_DENSE_MIN 1024    // initial size of the dense array
+
+typedef struct {
+    uint64_t *dense;        // dense[len] = count, for len < dense_size
+    size_t dense_size;
+    uint64_t *keys;         // sparse map for len >= LENHIST_DENSE_MAX (0 = empty)
+    uint64_t *counts;
+    size_t sparse_cap;
+    size_t sparse_used;
+    uint64_t n;             // number of sequences
+    uint64_t total;         // sum of lengths
+    uint64_t min, max;
+} lenhist_t;
+
+typedef struct {
+    uint64_t len;
+    uint64_t count;
+} lenhist_bin_t;
+
+typedef struct {
+    uint64_t n50, n75, n90;
+    uint64_t i50;
+    uint64_t aun;
+} lenhist_stats_t;
+
+static inline void lenhist_init(lenhist_t *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline void lenhist_free(lenhist_t *h) {
+    free(h->dense);
+    free(h->keys);
+    free(h->counts);
+    lenhist_init(h);
+}
+
+// Forget all counts but keep the memory, to fill the histogram again
+static inline void lenhist_reset(lenhist_t *h) {
+    if (h->dense) memset(h->dense, 0, h->dense_size * sizeof(uint64_t));
+    if (h->keys) memset(h->keys, 0, h->sparse_cap * sizeof(uint64_t));
+    if (h->counts) memset(h->counts, 0, h->sparse_cap * sizeof(uint64_t));
+    h->sparse_used = 0;
+    h->n = h->total = h->max = 0;
+    h->min = UINT64_MAX;
+}
+
+static inline uint64_t lenhist_hash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline int lenhist_sparse_grow(lenhist_t *h) {
+    size_t cap = h->sparse_cap ? h->sparse_cap * 2 : 256;
+    uint64_t *keys = calloc(cap, sizeof(uint64_t));
+    uint64_t *counts = calloc(cap, sizeof(uint64_t));
+    if (!keys || !counts) {
+        free(keys);
+        free(counts);
+        return -1;
+    }
+    for (size_t i = 0; i < h->sparse_cap; i++) {
+        if (!h->keys[i]) continue;
+        size_t j = lenhist_hash(h->keys[i]) & (cap - 1);
+        while (keys[j]) j = (j + 1) & (cap - 1);
+        keys[j] = h->keys[i];
+        counts[j] = h->counts[i];
+    }
+    free(h->keys);
+    free(h->counts);
+    h->keys = keys;
+    h->counts = counts;
+    h->sparse_cap = cap;
+    return 0;
+}
+
+// Add `count` sequences of length `len`. Returns 0 on success, -1 on allocation failure.
+static inline int lenhist_add_n(lenhist_t *h, uint64_t len, uint64_t count) {
+    if (!count) return 0;
+    if (len < LENHIST_DENSE_MAX) {
+        if (len >= h->dense_size) {
+            size_t size = h->dense_size ? h->dense_size : LENHIST_DENSE_MIN;
+            while (size <= len) size *= 2;
+            uint64_t *dense = realloc(h->dense, size * sizeof(uint64_t));
+            if (!dense) return -1;
+            memset(dense + h->dense_size, 0, (size - h->dense_size) * sizeof(uint64_t));
+            h->dense = dense;
+            h->dense_size = size;
+        }
+        h->dense[len] += count;
+    } else {
+        // Keep the load factor below 1/2
+        if ((h->sparse_used + 1) * 2 > h->sparse_cap && lenhist_sparse_grow(h) != 0) return -1;
+        size_t j = lenhist_hash(len) & (h->sparse_cap - 1);
+        while (h->keys[j] && h->keys[j] != len) j = (j + 1) & (h->sparse_cap - 1);
+        if (!h->keys[j]) {
+            h->keys[j] = len;
+            h->sparse_used++;
+        }
+        h->counts[j] += count;
+    }
+    h->n += count;
+    h->total += len * count;
+    if (len < h->min) h->min = len;
+    if (len > h->max) h->max = len;
+    return 0;
+}
+
+static inline int lenhist_add(lenhist_t *h, uint64_t len) {
+    if (len < h->dense_size) {
+        h->dense[len]++;
+        h->n++;
+        h->total += len;
+        if (len < h->min) h->min = len;
+        if (len > h->max) h->max = len;
+        return 0;
+    }
+    return lenhist_add_n(h, len, 1);
+}
+
+// Add all the counts of `src` into `dst`
+static inline int lenhist_merge(lenhist_t *dst, const lenhist_t *src) {
+    for (size_t len = 0; len < src->dense_size; len++) {
+        if (src->dense[len] && lenhist_add_n(dst, len, src->dense[len]) != 0) return -1;
+    }
+    for (size_t i = 0; i < src->sparse_cap; i++) {
+        if (src->keys[i] && lenhist_add_n(dst, src->keys[i], src->counts[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+// Distinct lengths with their counts, longest first. Caller frees the array.
+static inline lenhist_bin_t *lenhist_bins(const lenhist_t *h, size_t *nbins) {
+    size_t n = h->sparse_used;
+    for (size_t len = 0; len < h->dense_size; len++) {
+        if (h->dense[len]) n++;
+    }
+    lenhist_bin_t *bins = malloc((n ? n : 1) * sizeof(lenhist_bin_t));
+    uint64_t *keys = malloc((h->sparse_used ? h->sparse_used : 1) * sizeof(uint64_t));
+    if (!bins || !keys) {
+        free(bins);
+        free(keys);
+        return NULL;
+    }
+
+    // Long lengths: sort the keys of the map, then look their counts up
+    size_t k = 0;
+    for (size_t i = 0; i < h->sparse_cap; i++) {
+        if (h->keys[i]) keys[k++] = h->keys[i];
+    }
+    if (radix_sort_u64_desc(keys, k, 1) != 0) {
+        free(bins);
+        free(keys);
+        return NULL;
+    }
+    for (size_t i = 0; i < k; i++) {
+        size_t j = lenhist_hash(keys[i]) & (h->sparse_cap - 1);
+        while (h->keys[j] != keys[i]) j = (j + 1) & (h->sparse_cap - 1);
+        bins[i].len = keys[i];
+        bins[i].count = h->counts[j];
+    }
+    free(keys);
+
+    for (size_t len = h->dense_size; len-- > 0;) {
+        if (h->dense[len]) {
+            bins[k].len = len;
+            bins[k].count = h->dense[len];
+            k++;
+        }
+    }
+    *nbins = k;
+    return bins;
+}
+
+// Number of sequences of length `len` (starting from cumulative sum `sum`)
+// needed for the cumulative sum to reach `target`, at least 1.
+static inline uint64_t lenhist_reach(uint64_t sum, uint64_t len, uint64_t count, double target) {
+    if (len == 0 || (double)(sum + len) >= target) return 1;
+    uint64_t k = (uint64_t)((target - (double)sum) / (double)len);
+    if (k < 1) k = 1;
+    if (k > count) k = count;
+    while (k > 1 && (double)(sum + (k - 1) * len) >= target) k--;
+    while (k < count && (double)(sum + k * len) < target) k++;
+    return k;
+}
+
+// N50/N75/N90/I50 and auN, walking the distinct lengths longest first.
+// Returns 0 on success, -1 on allocation failure.
+static inline int lenhist_stats(const lenhist_t *h, lenhist_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+    size_t nbins;
+    lenhist_bin_t *bins = lenhist_bins(h, &nbins);
+    if (!bins) return -1;
+
+    uint64_t total = h->total;
+    double t50 = total * 0.5, t75 = total * 0.75, t90 = total * 0.90;
+    int have50 = 0, have75 = 0, have90 = 0;
+    uint64_t sum = 0, seqs = 0;
+    double aun = 0.0;
+    for (size_t i = 0; i < nbins; i++) {
+        uint64_t len = bins[i].len, count = bins[i].count;
+        uint64_t end = sum + len * count;
+        if (!have50 && (double)end >= t50) {
+            st->n50 = len;
+            st->i50 = seqs + lenhist_reach(sum, len, count, t50);
+            have50 = 1;
+        }
+        if (!have75 && (double)end >= t75) { st->n75 = len; have75 = 1; }
+        if (!have90 && (double)end >= t90) { st->n90 = len; have90 = 1; }
+        if (total) aun += count * (len * ((double)len / total));
+        sum = end;
+        seqs += count;
+    }
+    st->aun = (uint64_t)(aun + 0.5);
+
+    free(bins);
+    return 0;
+}
+
+#endif
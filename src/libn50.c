@@ -0,0 +1,109 @@
+// libn50: the statistics of n50 behind an accumulator, see libn50.h
+#include <stdlib.h>
+#include <string.h>
+
+#include "libn50.h"
+#include "fxsrc.h"
+#include "fxpipe.h"
+#include "lenhist.h"
+#include "compose.h"
+
+struct n50_acc {
+    lenhist_t hist;
+    compose_t comp;
+};
+
+// fxscan_next()/fxpipe_run() results to library error codes
+static int n50_status(int ret) {
+    switch (ret) {
+        case 0: return N50_OK;
+        case -1: return N50_EFORMAT;
+        case -2: return N50_EREAD;
+        default: return N50_ENOMEM;
+    }
+}
+
+n50_acc_t *n50_acc_new(void) {
+    n50_acc_t *acc = calloc(1, sizeof(n50_acc_t));
+    if (acc) lenhist_init(&acc->hist);
+    return acc;
+}
+
+void n50_acc_free(n50_acc_t *acc) {
+    if (!acc) return;
+    lenhist_free(&acc->hist);
+    free(acc);
+}
+
+int n50_acc_add_seq(n50_acc_t *acc, const char *seq, size_t len) {
+    if (lenhist_add(&acc->hist, len) != 0) return N50_ENOMEM;
+    compose_count(seq, len, &acc->comp);
+    return N50_OK;
+}
+
+int n50_acc_add_len(n50_acc_t *acc, uint64_t len, uint64_t count) {
+    return lenhist_add_n(&acc->hist, len, count) != 0 ? N50_ENOMEM : N50_OK;
+}
+
+int n50_acc_add_buffer(n50_acc_t *acc, const char *buf, size_t len) {
+    return n50_status(fxpipe_scan(buf, len, 0, NULL, &acc->hist, &acc->comp));
+}
+
+int n50_acc_add_file(n50_acc_t *acc, const char *path, int threads) {
+    fxsrc_t src;
+    if (fxsrc_open(&src, path, threads) != 0) return N50_EOPEN;
+    int ret;
+    if (src.kind == FXSRC_MAP) {
+        ret = fxpipe_map(src.map, src.size, threads, NULL, &acc->hist, &acc->comp);
+    } else if (threads > 1) {
+        ret = fxpipe_run(fxsrc_read, &src, threads, NULL, &acc->hist, &acc->comp);
+    } else {
+        fxscan_t scan;
+        if (fxsrc_scan_init(&src, &scan) != 0) {
+            fxsrc_close(&src);
+            return N50_ENOMEM;
+        }
+        fxrec_t rec;
+        while ((ret = fxscan_next(&scan, &rec)) > 0) {
+            if (lenhist_add(&acc->hist, rec.len) != 0) {
+                ret = -3;
+                break;
+            }
+            compose_count(rec.seq, rec.bytes, &acc->comp);
+        }
+        fxscan_destroy(&scan);
+    }
+    fxsrc_close(&src);
+    return n50_status(ret);
+}
+
+int n50_acc_merge(n50_acc_t *dst, const n50_acc_t *src) {
+    if (lenhist_merge(&dst->hist, &src->hist) != 0) return N50_ENOMEM;
+    compose_add(&dst->comp, &src->comp);
+    return N50_OK;
+}
+
+int n50_acc_stats(const n50_acc_t *acc, n50_stats_t *stats) {
+    const lenhist_t *h = &acc->hist;
+    lenhist_stats_t st;
+    memset(stats, 0, sizeof(*stats));
+    if (lenhist_stats(h, &st) != 0) return N50_ENOMEM;
+    stats->total_seqs = h->n;
+    stats->total_len = h->total;
+    stats->n50 = st.n50;
+    stats->n75 = st.n75;
+    stats->n90 = st.n90;
+    stats->i50 = st.i50;
+    stats->aun = st.aun;
+    if (h->n) {
+        stats->min_len = h->min;
+        stats->max_len = h->max;
+        stats->avg_len = (double)h->total / h->n;
+    }
+    if (h->total) {
+        stats->gc_content = (double)acc->comp.gc / h->total * 100.0;
+        stats->n_content = (double)acc->comp.n / h->total * 100.0;
+        stats->masked_content = (double)acc->comp.lower / h->total * 100.0;
+    }
+    return N50_OK;
+}
@@ -0,0 +1,73 @@
+/*
+ * libn50.h - sequence statistics as a library
+ *
+ * An accumulator collects sequence lengths and base composition, from
+ * sequences a program already holds in memory, from lengths alone, from
+ * FASTA/FASTQ text or from files, and turns them into the statistics n50
+ * prints. Accumulators can be merged, so threads or processes can each
+ * keep their own and combine them at the end. Results are exact: lengths
+ * are kept as a histogram of distinct lengths, not sampled.
+ *
+ * Percentages (GC, N, masked) are relative to the total length, so lengths
+ * added without their sequence count as bases of unknown composition.
+ *
+ * Link with -ln50 -lz -lpthread (bin/libn50.a or bin/libn50.so).
+ *
+ *   n50_acc_new()         create an empty accumulator
+ *   n50_acc_free()        free it
+ *   n50_acc_add_seq()     add one sequence (bases only, no line breaks)
+ *   n50_acc_add_len()     add `count` sequences of a length, composition unknown
+ *   n50_acc_add_buffer()  add the records of FASTA/FASTQ text
+ *   n50_acc_add_file()    add the records of a file, gzipped or not ("-" for STDIN)
+ *   n50_acc_merge()       add everything in one accumulator to another
+ *   n50_acc_stats()       compute the statistics of what was added so far
+ */
+#ifndef LIBN50_H
+#define LIBN50_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define N50_OK        0
+#define N50_ENOMEM   -1     // out of memory (or threads); nothing is lost but the call
+#define N50_EOPEN    -2     // the file cannot be opened
+#define N50_EFORMAT  -3     // malformed FASTQ record; the records before it were added
+#define N50_EREAD    -4     // read or decompression error; the records before it were added
+
+typedef struct n50_acc n50_acc_t;
+
+typedef struct {
+    uint64_t total_seqs;
+    uint64_t total_len;
+    uint64_t n50, n75, n90;
+    uint64_t i50;           // number of sequences needed to reach N50
+    uint64_t aun;           // area under the Nx curve
+    uint64_t min_len, max_len;
+    double avg_len;
+    double gc_content;      // percentages of the total length
+    double n_content;
+    double masked_content;
+} n50_stats_t;
+
+n50_acc_t *n50_acc_new(void);
+void n50_acc_free(n50_acc_t *acc);
+
+int n50_acc_add_seq(n50_acc_t *acc, const char *seq, size_t len);
+int n50_acc_add_len(n50_acc_t *acc, uint64_t len, uint64_t count);
+// `buf` holds whole records; a record cut at the end of it counts as shorter
+int n50_acc_add_buffer(n50_acc_t *acc, const char *buf, size_t len);
+// Up to `threads` threads decompress and scan the file
+int n50_acc_add_file(n50_acc_t *acc, const char *path, int threads);
+
+int n50_acc_merge(n50_acc_t *dst, const n50_acc_t *src);
+int n50_acc_stats(const n50_acc_t *acc, n50_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
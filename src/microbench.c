@@ -0,0 +1,344 @@
+// In-process benchmarks of the hot kernels on synthetic buffers, as JSON.
+// Build and run with `make bench`; the only argument is the buffer size in MB.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fxscan.h"
+#include "compose.h"
+#include "lenhist.h"
+#include "radix.h"
+#include "qualstat.h"
+#include "chunkq.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define REPEATS 5
+#define QUEUE_CHUNK 1048576
+#define QUEUE_CONSUMERS 4
+
+typedef struct {
+    double seconds;
+    uint64_t cycles;
+} sample_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t cycles(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Keeps results alive so the compiler cannot drop the work
+static volatile uint64_t sink;
+
+static uint64_t rng_state = 42;
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/*
+ * Inputs
+ */
+
+static void fill_bases(char *p, size_t n) {
+    static const char bases[] = "ACGTACGTACGTACGTacgtN";
+    for (size_t i = 0; i < n; i++) p[i] = bases[rng() % (sizeof(bases) - 1)];
+}
+
+// Illumina-like FASTQ of 150 bp reads, about `size` bytes
+static char *make_fastq(size_t size, size_t *len) {
+    char *buf = malloc(size + 1024);
+    size_t pos = 0;
+    uint64_t id = 0;
+    while (buf && pos + 400 < size) {
+        pos += sprintf(buf + pos, "@read%llu\n", (unsigned long long)id++);
+        fill_bases(buf + pos, 150);
+        pos += 150;
+        memcpy(buf + pos, "\n+\n", 3);
+        pos += 3;
+        for (int i = 0; i < 150; i++) buf[pos++] = '!' + 2 + rng() % 39;
+        buf[pos++] = '\n';
+    }
+    *len = pos;
+    return buf;
+}
+
+// Multi-line FASTA (80 columns) of contigs from 1 to 100 kbp
+static char *make_fasta(size_t size, size_t *len) {
+    char *buf = malloc(size + 1024);
+    size_t pos = 0;
+    uint64_t id = 0;
+    while (buf && pos + 200 < size) {
+        pos += sprintf(buf + pos, ">contig%llu\n", (unsigned long long)id++);
+        size_t bases = 1000 + rng() % 99000;
+        while (bases > 0 && pos + 100 < size) {
+            size_t line = bases < 80 ? bases : 80;
+            fill_bases(buf + pos, line);
+            pos += line;
+            buf[pos++] = '\n';
+            bases -= line;
+        }
+    }
+    *len = pos;
+    return buf;
+}
+
+/*
+ * Kernels: each processes its whole input once
+ */
+
+typedef struct {
+    const char *name;
+    void (*run)(void *ctx);
+    void *ctx;
+    size_t bytes;           // input bytes per run
+} bench_t;
+
+typedef struct {
+    const char *buf;
+    size_t len;
+} buf_ctx_t;
+
+static void run_scan(void *arg) {
+    buf_ctx_t *c = arg;
+    fxscan_t scan;
+    fxrec_t rec;
+    uint64_t total = 0;
+    fxscan_init_buffer(&scan, c->buf, c->len);
+    while (fxscan_next(&scan, &rec) > 0) total += rec.len;
+    sink = total;
+}
+
+static void run_compose(void *arg) {
+    buf_ctx_t *c = arg;
+    compose_t comp = {0};
+    compose_count(c->buf, c->len, &comp);
+    sink = comp.gc;
+}
+
+static void run_qual(void *arg) {
+    buf_ctx_t *c = arg;
+    qualstat_t qs = {0};
+    double p = 0.0;
+    for (size_t i = 0; i + 150 <= c->len; i += 150) p += qualstat_read(c->buf + i, 150, 33, &qs);
+    sink = qs.total_quality + (uint64_t)p;
+}
+
+static void run_qual_count(void *arg) {
+    buf_ctx_t *c = arg;
+    qualstat_t qs = {0};
+    for (size_t i = 0; i + 150 <= c->len; i += 150) qualstat_count(c->buf + i, 150, 33, &qs);
+    sink = qs.total_quality + qs.q30_count;
+}
+
+typedef struct {
+    const unsigned *lengths;
+    unsigned *work;
+    uint64_t *work64;
+    size_t n;
+    unsigned long total;
+} len_ctx_t;
+
+static void run_radix(void *arg) {
+    len_ctx_t *c = arg;
+    memcpy(c->work, c->lengths, c->n * sizeof(unsigned));
+    if (radix_sort_u32_desc(c->work, c->n, 1) == 0) sink = c->work[0];
+}
+
+static void run_radix64(void *arg) {
+    len_ctx_t *c = arg;
+    for (size_t i = 0; i < c->n; i++) c->work64[i] = c->lengths[i];
+    if (radix_sort_u64_desc(c->work64, c->n, 1) == 0) sink = c->work64[0];
+}
+
+static void run_aun(void *arg) {
+    len_ctx_t *c = arg;
+    sink = calculate_auN(c->work, c->n, c->total);
+}
+
+static void run_lenhist(void *arg) {
+    len_ctx_t *c = arg;
+    lenhist_t h;
+    lenhist_stats_t st;
+    lenhist_init(&h);
+    for (size_t i = 0; i < c->n; i++) lenhist_add(&h, c->lengths[i]);
+    if (lenhist_stats(&h, &st) == 0) sink = st.n50;
+    lenhist_free(&h);
+}
+
+typedef struct {
+    ChunkQueue queue;
+    size_t chunks;
+    uint64_t counts[QUEUE_CONSUMERS];
+} queue_ctx_t;
+
+typedef struct {
+    queue_ctx_t *q;
+    int id;
+} consumer_arg_t;
+
+static void *queue_consumer(void *arg) {
+    consumer_arg_t *a = arg;
+    Chunk chunk;
+    uint64_t count = 0;
+    while (chunkq_pop(&a->q->queue, &chunk)) {
+        const char *p = chunk.buffer, *end = chunk.buffer + chunk.bytes_read;
+        while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+            count++;
+            p++;
+        }
+        free(chunk.buffer);
+    }
+    a->q->counts[a->id] = count;
+    return NULL;
+}
+
+// The fqc pipeline without the file: 1 MB chunks through the queue to newline counters
+static void run_queue(void *arg) {
+    queue_ctx_t *q = arg;
+    pthread_t threads[QUEUE_CONSUMERS];
+    consumer_arg_t args[QUEUE_CONSUMERS];
+    chunkq_init(&q->queue);
+    int started = 0;
+    for (int i = 0; i < QUEUE_CONSUMERS; i++) {
+        args[i].q = q;
+        args[i].id = i;
+        if (pthread_create(&threads[i], NULL, queue_consumer, &args[i]) == 0) started++;
+    }
+    for (size_t i = 0; i < q->chunks; i++) {
+        char *buf = malloc(QUEUE_CHUNK);
+        if (!buf) break;
+        memset(buf, 'A', QUEUE_CHUNK);
+        for (size_t j = 79; j < QUEUE_CHUNK; j += 80) buf[j] = '\n';
+        if (chunkq_push(&q->queue, buf, QUEUE_CHUNK) < 0) {
+            free(buf);
+            break;
+        }
+    }
+    chunkq_finish(&q->queue);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    chunkq_destroy(&q->queue);
+    uint64_t total = 0;
+    for (int i = 0; i < QUEUE_CONSUMERS; i++) total += q->counts[i];
+    sink = total;
+}
+
+/*
+ * Timing
+ */
+
+// Best of REPEATS runs after one warm-up run
+static sample_t measure(const bench_t *b) {
+    sample_t best = {0, 0};
+    b->run(b->ctx);
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t c0 = cycles();
+        double t0 = now();
+        b->run(b->ctx);
+        double t = now() - t0;
+        uint64_t c = cycles() - c0;
+        if (r == 0 || t < best.seconds) {
+            best.seconds = t;
+            best.cycles = c;
+        }
+    }
+    return best;
+}
+
+static void report(const bench_t *b, sample_t s, int first) {
+    double ns_per_byte = s.seconds * 1e9 / b->bytes;
+    printf("%s    {\"name\": \"%s\", \"bytes\": %zu, \"seconds\": %.6f, \"ns_per_byte\": %.4f, \"gb_per_s\": %.3f, ",
+           first ? "" : ",\n", b->name, b->bytes, s.seconds, ns_per_byte, b->bytes / s.seconds / 1e9);
+#ifdef HAVE_TSC
+    printf("\"cycles_per_byte\": %.4f}", (double)s.cycles / b->bytes);
+#else
+    printf("\"cycles_per_byte\": null}");
+#endif
+}
+
+int main(int argc, char **argv) {
+    size_t mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+    if (mb < 1) mb = 1;
+    size_t size = mb << 20;
+
+    buf_ctx_t fastq, fasta, bases, quals;
+    fastq.buf = make_fastq(size, &fastq.len);
+    fasta.buf = make_fasta(size, &fasta.len);
+    char *b = malloc(size), *q = malloc(size);
+    len_ctx_t lens;
+    lens.n = size / 64;
+    unsigned *lengths = malloc(lens.n * sizeof(unsigned));
+    lens.work = malloc(lens.n * sizeof(unsigned));
+    lens.work64 = malloc(lens.n * sizeof(uint64_t));
+    if (!fastq.buf || !fasta.buf || !b || !q || !lengths || !lens.work || !lens.work64) {
+        perror("malloc");
+        return 1;
+    }
+    fill_bases(b, size);
+    bases.buf = b;
+    bases.len = size;
+    for (size_t i = 0; i < size; i++) q[i] = '!' + rng() % 42;
+    quals.buf = q;
+    quals.len = size;
+
+    // Read lengths: mostly 150 bp with a long tail, like trimmed short reads
+    lens.total = 0;
+    for (size_t i = 0; i < lens.n; i++) {
+        lengths[i] = rng() % 4 ? 150 - rng() % 30 : 1 + rng() % 100000;
+        lens.total += lengths[i];
+    }
+    lens.lengths = lengths;
+    memcpy(lens.work, lengths, lens.n * sizeof(unsigned));
+    radix_sort_u32_desc(lens.work, lens.n, 1);
+
+    queue_ctx_t queue;
+    memset(&queue, 0, sizeof(queue));
+    queue.chunks = mb;
+
+    // Length kernels are reported per length (4 bytes each)
+    bench_t benches[] = {
+        {"fxscan_fastq", run_scan, &fastq, fastq.len},
+        {"fxscan_fasta", run_scan, &fasta, fasta.len},
+        {"compose_count", run_compose, &bases, bases.len},
+        {"qualstat_read", run_qual, &quals, quals.len},
+        {"qualstat_count", run_qual_count, &quals, quals.len},
+        {"radix_sort_u32", run_radix, &lens, lens.n * sizeof(unsigned)},
+        {"radix_sort_u64", run_radix64, &lens, lens.n * sizeof(unsigned)},
+        {"calculate_auN", run_aun, &lens, lens.n * sizeof(unsigned)},
+        {"lenhist", run_lenhist, &lens, lens.n * sizeof(unsigned)},
+        {"chunk_queue", run_queue, &queue, queue.chunks * QUEUE_CHUNK},
+    };
+
+    printf("{\n  \"compose_kernel\": \"%s\",\n  \"size_mb\": %zu,\n  \"benchmarks\": [\n", compose_kernel_name(), mb);
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        report(&benches[i], measure(&benches[i]), i == 0);
+        fflush(stdout);
+    }
+    printf("\n  ]\n}\n");
+
+    free((char *)fastq.buf);
+    free((char *)fasta.buf);
+    free(b);
+    free(q);
+    free(lengths);
+    free(lens.work);
+    free(lens.work64);
+    return 0;
+}
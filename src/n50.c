@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <pthread.h>
 #include <zlib.h>
 #include <libgen.h>
@@ -12,11 +13,30 @@
 #include <sys/ioctl.h>
 #include <termios.h>
 
-#include "kseq.h"
-KSEQ_INIT(gzFile, gzread)
+#include "fxsrc.h"
+#include "fxpipe.h"
+#include "lenhist.h"
+#include "compose.h"
+#include "rescache.h"
+#include "sketch.h"
+#include "profile.h"
+#include "trace.h"
+#include "hwcount.h"
+#include "progress.h"
 
-#define MAX_THREADS 4
 #define VERSION "1.9.4"
+#define HW_BATCH 4096   // records whose composition is counted at once with --hwcounters
+
+// Long options without a short one
+enum {
+    OPT_PROFILE = 256,
+    OPT_TRACE,
+    OPT_HWCOUNTERS,
+    OPT_PROGRESS,
+    OPT_MIN_LEN,
+    OPT_MAX_LEN,
+    OPT_FIELDS
+};
 
 typedef enum {
     TSV,
@@ -26,31 +46,102 @@ typedef enum {
 
 typedef struct {
     char *filepath;
+    int index;          // position among the input files, used to keep output order
+    off_t size;         // size on disk, used to schedule the largest files first
     int abs_path;
     int basename;
     output_format_t output_format;
     int nice_output;
+    int threads;        // threads for the file itself, e.g. to inflate it in parallel
+    int build_index;    // save a gzip index next to the file if it has none
+    int sketch;         // save the sketch of the file next to it
+    int cacheable;      // regular file, `key` is set
+    rescache_key_t key;
+    int profile;        // time the phases of the file (--profile)
+    uint64_t min_len, max_len;  // records kept (--min-len, --max-len)
+    int compose;        // count the bases, for GC, Ns, Masked or a sketch
 } task_t;
 
 typedef struct {
-    char filepath[PATH_MAX];
+    char *filepath;
     unsigned long total_seqs;
     unsigned long total_len;
     unsigned long n50, n75, n90;
     unsigned long i50;
     double gc_content;
+    double n_content;       // % of N bases
+    double masked_content;  // % of soft-masked (lowercase) bases
     double avg_len;
     unsigned long min_len, max_len;
     unsigned long aun;
+    unsigned long all_seqs, all_len;    // before the length filter
+    profile_t prof;         // phases of the file, with --profile
+    hwcount_sum_t hw;       // counters of the file, with --hwcounters
+    int failed;             // the scan stopped on a read error or malformed record
 } result_t;
 
-pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
-int num_threads = 0;
-pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t thread_cond = PTHREAD_COND_INITIALIZER;
+// Output columns after Filepath, in their default order
+typedef enum {
+    COL_TOTSEQS,
+    COL_TOTLEN,
+    COL_N50,
+    COL_N75,
+    COL_N90,
+    COL_I50,
+    COL_GC,
+    COL_AVG,
+    COL_MIN,
+    COL_MAX,
+    COL_AUN,
+    COL_NS,
+    COL_MASKED,
+    COL_ALLSEQS,
+    COL_ALLLEN,
+    COLS
+} column_t;
+
+static const char *const column_names[COLS] = {
+    "TotSeqs", "TotLen", "N50", "N75", "N90", "I50", "GC", "Avg", "Min", "Max", "AuN", "Ns", "Masked",
+    "AllSeqs", "AllLen"
+};
+
+// Columns printed, in order (--fields)
+typedef struct {
+    column_t col[COLS];
+    int n;
+} fields_t;
+
+typedef enum {
+    SLOT_PENDING,
+    SLOT_RUNNING,
+    SLOT_DONE
+} slot_state_t;
+
+typedef struct {
+    task_t task;
+    slot_state_t state;
+    result_t *result;
+} slot_t;
+
+// Shared work queue. Only a window of `depth` inputs past the next one to be
+// printed is admitted at a time: workers pick the largest pending file in the
+// window, and main() prints results in input order as soon as they are done.
+// Memory is bounded by the window, not by the number of input files.
+typedef struct {
+    slot_t *slots;          // ring buffer, input i lives in slots[i % depth]
+    int depth;
+    int total;
+    int admitted;           // inputs [emitted, admitted) are in the ring
+    int emitted;            // next input to be printed
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    int hwcounters;         // workers open hardware counters
+} work_queue_t;
 
-int compare_desc(const void *a, const void *b) {
-    return (*(int *)b - *(int *)a);
+int get_default_threads() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
 }
 
 int get_terminal_width() {
@@ -61,146 +152,575 @@ int get_terminal_width() {
     return 80; // Default fallback width
 }
 
-unsigned long calculate_auN(unsigned *lengths, unsigned long n, unsigned long limit) {
-    double aun = 0.0;
-    unsigned long cumulative = 0;
-    for (unsigned long i = 0; i < n && cumulative < limit; i++) {
-        unsigned long eff_len = (cumulative + lengths[i] <= limit) ? lengths[i] : (limit - cumulative);
-        aun += eff_len * ((double)eff_len / limit);
-        cumulative += lengths[i];
+// Path of the file as printed
+char *result_path(task_t *task) {
+    char path[PATH_MAX];
+    if (!realpath(task->filepath, path)) {
+        strncpy(path, task->filepath, PATH_MAX - 1);
+        path[PATH_MAX - 1] = '\0';
     }
-    return (unsigned long)(aun + 0.5);
+    return strdup(task->basename ? basename(path) : path);
 }
 
-void *process_file(void *arg) {
-    task_t *task = (task_t *)arg;
+// Statistics of a histogram and composition, printed as `filepath` (taken over)
+result_t *make_result(char *filepath, const lenhist_t *h, const compose_t *comp) {
+    lenhist_stats_t st;
+    result_t *res = malloc(sizeof(result_t));
+    if (!filepath || !res || lenhist_stats(h, &st) != 0) {
+        perror("malloc");
+        free(filepath);
+        free(res);
+        return NULL;
+    }
+    memset(res, 0, sizeof(result_t));
+    res->filepath = filepath;
+    res->total_seqs = h->n;
+    res->total_len = h->total;
+    res->n50 = st.n50;
+    res->n75 = st.n75;
+    res->n90 = st.n90;
+    res->i50 = st.i50;
+    // Nothing left, e.g. after a length filter: ratios and limits stay 0
+    if (h->n) {
+        res->avg_len = (double)h->total / h->n;
+        res->min_len = h->min;
+        res->max_len = h->max;
+    }
+    if (h->total) {
+        res->gc_content = (double)comp->gc / h->total * 100.0;
+        res->n_content = (double)comp->n / h->total * 100.0;
+        res->masked_content = (double)comp->lower / h->total * 100.0;
+    }
+    res->aun = st.aun;
+    return res;
+}
+
+result_t *cached_result(task_t *task, const rescache_stats_t *c) {
+    result_t *res = calloc(1, sizeof(result_t));
+    if (!res) return NULL;
+    res->filepath = result_path(task);
+    res->total_seqs = c->total_seqs;
+    res->total_len = c->total_len;
+    res->n50 = c->n50;
+    res->n75 = c->n75;
+    res->n90 = c->n90;
+    res->i50 = c->i50;
+    res->gc_content = c->gc_content;
+    res->n_content = c->n_content;
+    res->masked_content = c->masked_content;
+    res->avg_len = c->avg_len;
+    res->min_len = c->min_len;
+    res->max_len = c->max_len;
+    res->aun = c->aun;
+    res->all_seqs = c->all_seqs;
+    res->all_len = c->all_len;
+    return res;
+}
 
-    gzFile fp;
-    if (strcmp(task->filepath, "-") == 0)
-        fp = gzdopen(STDIN_FILENO, "r");
-    else
-        fp = gzopen(task->filepath, "r");
-    if (!fp) {
+void cache_result(rescache_t *cache, task_t *task, const result_t *r) {
+    rescache_stats_t c = {
+        .total_seqs = r->total_seqs, .total_len = r->total_len,
+        .n50 = r->n50, .n75 = r->n75, .n90 = r->n90, .i50 = r->i50,
+        .min_len = r->min_len, .max_len = r->max_len, .aun = r->aun,
+        .gc_content = r->gc_content, .n_content = r->n_content,
+        .masked_content = r->masked_content, .avg_len = r->avg_len,
+        .all_seqs = r->all_seqs, .all_len = r->all_len
+    };
+    if (rescache_put(cache, &task->key, &c) != 0) perror("malloc");
+}
+
+// Records parsed but not counted yet, with --hwcounters
+typedef struct {
+    fxrec_t *recs;
+    int n;
+    compose_t *comp;
+    hwcount_t *hw;
+    hwcount_sum_t *sum;
+    profile_t *prof;
+    double t;
+} hw_batch_t;
+
+// Count the composition of the batch; what ran since the last lap was parsing
+static void hw_batch_flush(void *arg) {
+    hw_batch_t *b = (hw_batch_t *)arg;
+    hwcount_lap(b->hw, b->sum, PROF_PARSE);
+    if (b->prof) b->t = profile_lap(b->prof, PROF_PARSE, b->t);
+    for (int i = 0; b->comp && i < b->n; i++) compose_count(b->recs[i].seq, b->recs[i].bytes, b->comp);
+    b->n = 0;
+    hwcount_lap(b->hw, b->sum, PROF_COMPUTE);
+    if (b->prof) b->t = profile_lap(b->prof, PROF_COMPUTE, b->t);
+}
+
+// The loop of process_file() with hardware counters. Lengths are counted as
+// records are parsed, compositions a batch at a time (and before the scanner
+// moves its buffer), so that the counters are read per batch and per block
+// read instead of per record. Returns what fxscan_next() ended with (0 at the
+// end, -1 or -2), or -3 if memory ran out.
+static int scan_counted(fxsrc_t *src, profile_reader_t *in, progress_file_t *pf, hwcount_t *hw, hwcount_sum_t *sum,
+                        profile_t *p, double *t, fxfilter_t *filter, lenhist_t *hist, compose_t *comp) {
+    hw_batch_t b = {malloc(HW_BATCH * sizeof(fxrec_t)), 0, comp, hw, sum, p, *t};
+    hwcount_reader_t hin = {profile_read, in, hw, sum};
+    fxscan_t scan;
+    if (!b.recs) return -3;
+    int ret = src->kind == FXSRC_MAP ? fxsrc_scan_init(src, &scan) : fxscan_init_reader(&scan, hwcount_read, &hin);
+    if (ret != 0) {
+        free(b.recs);
+        return -3;
+    }
+    if (src->kind == FXSRC_MAP) sum->bytes += src->size;
+    scan.flush = hw_batch_flush;
+    scan.flush_ctx = &b;
+    hwcount_lap(hw, sum, PROF_OPEN);
+
+    fxrec_t rec;
+    while ((ret = fxscan_next(&scan, &rec)) > 0) {
+        if (progress_on && (filter->seqs & (PROGRESS_BATCH - 1)) == 0) {
+            uint64_t pos = src->kind == FXSRC_MAP ? scan.consumed + scan.pos : 0;
+            progress_update(pf, pos, pos, filter->seqs, filter->bases);
+        }
+        if (!fxfilter_keep(filter, rec.len)) continue;
+        if (lenhist_add(hist, rec.len) != 0) {
+            ret = -3;
+            break;
+        }
+        b.recs[b.n++] = rec;
+        if (b.n == HW_BATCH) hw_batch_flush(&b);
+    }
+    hw_batch_flush(&b);
+    fxscan_destroy(&scan);
+    free(b.recs);
+    if (p) {
+        // The scanner reads its input while parsing
+        p->seconds[PROF_PARSE] -= p->seconds[PROF_DECOMPRESS];
+        *t = b.t;
+    }
+    return ret;
+}
+
+// The threads of a file (-t) are shared by whatever inflates it and the scan.
+// Scanning takes far less than inflating, so a gzip file read in parallel is
+// inflated by all of them but a quarter (at least one) for the scan workers
+// and one for the reader and splitter of fxpipe, which mostly wait. Below
+// -t 4 it still gets two, or it would not be inflated in parallel at all.
+static int inflate_threads(int threads) {
+    int n = threads - (threads / 4 > 1 ? threads / 4 : 1) - 1;
+    return n > 2 ? n : threads > 1 ? 2 : 1;
+}
+
+// Scan workers: the threads that the source of a file leaves idle
+static int scan_threads(const fxsrc_t *src, int threads) {
+    // A mapped file has no reader or splitter, and the calling thread scans too
+    if (src->kind == FXSRC_MAP) return threads;
+    // Otherwise zlib inflates on the reader, or the source on threads of its own,
+    // and the splitter takes one more
+    int used = src->kind == FXSRC_PGZ && !src->build ? src->threads + 1 : 2;
+    return threads - used > 1 ? threads - used : 1;
+}
+
+// `hw` is NULL unless the calling thread counts with hardware counters
+result_t *process_file(task_t *task, hwcount_t *hw) {
+    profile_t prof;
+    profile_t *p = task->profile ? &prof : NULL;
+    double start = 0.0, t = 0.0;
+    if (p) {
+        memset(p, 0, sizeof(profile_t));
+        start = t = profile_now();
+    }
+
+    // Plain files are scanned in place from a memory mapping, gzip goes through zlib
+    uint64_t span = trace_now();
+    fxsrc_t src;
+    if (fxsrc_open_index(&src, task->filepath, inflate_threads(task->threads), task->build_index) != 0) {
         fprintf(stderr, "Error opening file %s\n", task->filepath);
-        pthread_exit(NULL);
+        progress_done(NULL, task->size);
+        return NULL;
     }
+    trace_span("open", span);
+    span = trace_now();
+    if (p) {
+        t = profile_lap(p, PROF_OPEN, t);
+        p->in_bytes = src.size;
+        if (src.kind == FXSRC_MAP) p->bytes = src.size;
+    }
+    // Reads go through `in` so that --profile can time them, and --progress follow them
+    progress_file_t pf;
+    progress_file(&pf, &src);
+    profile_reader_t in = {progress_on ? progress_read : fxsrc_read, progress_on ? (void *)&pf : (void *)&src, p};
+    uint64_t mapped = src.kind == FXSRC_MAP ? src.size : 0;
 
-    kseq_t *seq = kseq_init(fp);
-    unsigned long total_len = 0, total_seqs = 0;
-    unsigned long gc_count = 0;
-    unsigned long min_len = ULONG_MAX, max_len = 0;
-    size_t alloc = 1024;
-    unsigned *lengths = malloc(sizeof(unsigned) * alloc);
-    if (!lengths) {
-        perror("malloc");
-        pthread_exit(NULL);
-    }
-
-    while (kseq_read(seq) >= 0) {
-        unsigned len = seq->seq.l;
-        if (total_seqs >= alloc) {
-            alloc *= 2;
-            unsigned *new_lengths = realloc(lengths, sizeof(unsigned) * alloc);
-            if (!new_lengths) {
-                perror("realloc");
-                free(lengths);
-                pthread_exit(NULL);
+    // Records outside the length limits are counted, then skipped before their bases are read.
+    // Without a column that needs the composition no base is read at all.
+    fxfilter_t filter;
+    fxfilter_init(&filter, task->min_len, task->max_len);
+    compose_t comp = {0};
+    compose_t *cp = task->compose ? &comp : NULL;
+    lenhist_t hist;
+    lenhist_init(&hist);
+
+    hwcount_sum_t hws;
+    memset(&hws, 0, sizeof(hws));
+
+    int scan_ret = 0;   // how the scan ended: 0 at the end, -1 malformed, -2 read error
+    if (task->threads > 1) {
+        // Mapped files are split in byte ranges; otherwise decompression,
+        // record splitting and counting run on their own threads
+        int scan = scan_threads(&src, task->threads);
+        int ret = src.kind == FXSRC_MAP ? fxpipe_map(src.map, src.size, scan, &filter, &hist, cp)
+                                        : fxpipe_run(profile_read, &in, scan, &filter, &hist, cp);
+        if (ret == -3) {
+            perror("malloc");
+            lenhist_free(&hist);
+            fxsrc_close(&src);
+            return NULL;
+        }
+        scan_ret = ret;
+        // The ranges of a mapped file, and the records of both, were published by
+        // fxpipe; other sources published their position through `in`
+        if (mapped) pf.in = pf.bytes = mapped;
+        if (p) t = profile_lap(p, PROF_PARSE, t);
+        trace_span("scan", span);
+    } else if (hw) {
+        scan_ret = scan_counted(&src, &in, &pf, hw, &hws, p, &t, &filter, &hist, cp);
+        if (scan_ret == -3) {
+            perror("malloc");
+            lenhist_free(&hist);
+            fxsrc_close(&src);
+            return NULL;
+        }
+        progress_update(&pf, mapped, mapped, filter.seqs, filter.bases);
+        trace_span("scan", span);
+    } else {
+        fxscan_t scan;
+        int ret = src.kind == FXSRC_MAP ? fxsrc_scan_init(&src, &scan) : fxscan_init_reader(&scan, profile_read, &in);
+        if (ret != 0) {
+            perror("malloc");
+            fxsrc_close(&src);
+            return NULL;
+        }
+        fxrec_t rec;
+        while ((scan_ret = fxscan_next(&scan, &rec)) > 0) {
+            if (p) t = profile_lap(p, PROF_PARSE, t);
+            if (progress_on && (filter.seqs & (PROGRESS_BATCH - 1)) == 0) {
+                uint64_t pos = mapped ? scan.consumed + scan.pos : 0;
+                progress_update(&pf, pos, pos, filter.seqs, filter.bases);
             }
-            lengths = new_lengths;
+            if (!fxfilter_keep(&filter, rec.len)) continue;
+            if (lenhist_add(&hist, rec.len) != 0) {
+                perror("malloc");
+                lenhist_free(&hist);
+                fxscan_destroy(&scan);
+                fxsrc_close(&src);
+                return NULL;
+            }
+            if (cp) compose_count(rec.seq, rec.bytes, cp);
+            if (p) t = profile_lap(p, PROF_COMPUTE, t);
+        }
+        fxscan_destroy(&scan);
+        progress_update(&pf, mapped, mapped, filter.seqs, filter.bases);
+        if (p) {
+            t = profile_lap(p, PROF_PARSE, t);
+            // The scanner reads its input while parsing
+            p->seconds[PROF_PARSE] -= p->seconds[PROF_DECOMPRESS];
         }
-        lengths[total_seqs++] = len;
-        total_len += len;
-        if (len < min_len) min_len = len;
-        if (len > max_len) max_len = len;
-        for (unsigned i = 0; i < len; i++) {
-            char c = seq->seq.s[i];
-            if (c == 'G' || c == 'g' || c == 'C' || c == 'c') gc_count++;
+        trace_span("scan", span);
+    }
+    progress_done(&pf, src.size);
+    if (scan_ret < 0) {
+        fprintf(stderr, "Error reading %s: %s, results may be incomplete\n", task->filepath,
+                scan_ret == -1 ? "malformed record" : fxsrc_error(&src));
+    }
+    fxsrc_close(&src);
+    if (p) t = profile_lap(p, PROF_OPEN, t);
+
+    span = trace_now();
+    if (task->sketch) {
+        // A partial sketch would be pooled by --merge as if it were complete
+        char *spath = scan_ret < 0 ? NULL : sketch_path(task->filepath);
+        if (scan_ret < 0) {
+            fprintf(stderr, "Warning: no sketch of %s, it was not read to the end\n", task->filepath);
+        } else if (strcmp(task->filepath, "-") == 0 || !spath || sketch_save(spath, &hist, &comp) != 0) {
+            fprintf(stderr, "Warning: cannot write the sketch of %s\n", task->filepath);
         }
+        free(spath);
+        if (p) t = profile_lap(p, PROF_FORMAT, t);
+        trace_span("sketch", span);
+        span = trace_now();
     }
 
-    kseq_destroy(seq);
-    gzclose(fp);
+    hwcount_lap(hw, &hws, PROF_OPEN);
+    result_t *res = make_result(result_path(task), &hist, &comp);
+    trace_span("stats", span);
+    if (res) {
+        res->all_seqs = filter.seqs;
+        res->all_len = filter.bases;
+        res->failed = scan_ret < 0;
+    }
+    hwcount_lap(hw, &hws, PROF_SORT);
+    if (res) res->hw = hws;
+    if (res && p) {
+        p->wall = profile_lap(p, PROF_SORT, t) - start;
+        p->seqs = filter.seqs;
+        p->bases = filter.bases;
+        res->prof = *p;
+    }
+    lenhist_free(&hist);
+    return res;
+}
 
-    qsort(lengths, total_seqs, sizeof(unsigned), compare_desc);
+void free_result(result_t *r) {
+    free(r->filepath);
+    free(r);
+}
+
+void *worker(void *arg) {
+    work_queue_t *queue = (work_queue_t *)arg;
+    trace_thread("worker");
+    hwcount_t hw;
+    int counting = queue->hwcounters && hwcount_open(&hw) == 0;
 
-    unsigned long sum = 0;
-    unsigned long n50 = 0, n75 = 0, n90 = 0, i50 = 0;
-    for (unsigned long i = 0; i < total_seqs; i++) {
-        sum += lengths[i];
-        if (!n50 && sum >= total_len * 0.5) { n50 = lengths[i]; i50 = i + 1; }
-        if (!n75 && sum >= total_len * 0.75) n75 = lengths[i];
-        if (!n90 && sum >= total_len * 0.90) n90 = lengths[i];
+    pthread_mutex_lock(&queue->mutex);
+    while (1) {
+        // Largest pending input within the admitted window
+        slot_t *best = NULL;
+        for (int i = queue->emitted; i < queue->admitted; i++) {
+            slot_t *slot = &queue->slots[i % queue->depth];
+            if (slot->state == SLOT_PENDING && (!best || slot->task.size > best->task.size)) {
+                best = slot;
+            }
+        }
+        if (!best) {
+            if (queue->admitted >= queue->total) break;
+            uint64_t span = trace_now();
+            pthread_cond_wait(&queue->work_cond, &queue->mutex);
+            trace_span("wait", span);
+            continue;
+        }
+        best->state = SLOT_RUNNING;
+        pthread_mutex_unlock(&queue->mutex);
+
+        result_t *res = process_file(&best->task, counting ? &hw : NULL);
+
+        pthread_mutex_lock(&queue->mutex);
+        best->result = res;
+        best->state = SLOT_DONE;
+        pthread_cond_signal(&queue->done_cond);
     }
+    pthread_mutex_unlock(&queue->mutex);
+    if (counting) hwcount_close(&hw);
+    return NULL;
+}
 
-    result_t *res = malloc(sizeof(result_t));
-    if (!res) {
-        perror("malloc");
-        free(lengths);
-        pthread_exit(NULL);
-    }
-    realpath(task->filepath, res->filepath);
-    if (task->basename) strcpy(res->filepath, basename(res->filepath));
-    res->total_seqs = total_seqs;
-    res->total_len = total_len;
-    res->n50 = n50;
-    res->n75 = n75;
-    res->n90 = n90;
-    res->i50 = i50;
-    res->gc_content = (double)gc_count / total_len * 100.0;
-    res->avg_len = (double)total_len / total_seqs;
-    res->min_len = min_len;
-    res->max_len = max_len;
-    res->aun = calculate_auN(lengths, total_seqs, total_len);
-
-    free(lengths);
-
-    pthread_mutex_lock(&thread_mutex);
-    num_threads--;
-    pthread_mutex_unlock(&thread_mutex);
-
-    pthread_exit(res);
+// Width of the Filepath column of the nice table with `num_cols` columns
+// including it, from the terminal width: at least 15 chars and at most 50
+int nice_filepath_width(int num_cols, int min_col_width) {
+    int reserved_width = (num_cols - 1) * min_col_width + (num_cols - 1); // space for separators
+    int filepath_width = get_terminal_width() - reserved_width;
+    if (filepath_width < 15) filepath_width = 15;
+    if (filepath_width > 50) filepath_width = 50;
+    return filepath_width;
 }
 
-void print_result(result_t *r, output_format_t fmt, int nice_output) {
+// Column `c` of `r` as printed
+void column_value(const result_t *r, column_t c, char *buf, size_t len) {
+    unsigned long v = 0;
+    switch (c) {
+        case COL_TOTSEQS: v = r->total_seqs; break;
+        case COL_TOTLEN: v = r->total_len; break;
+        case COL_N50: v = r->n50; break;
+        case COL_N75: v = r->n75; break;
+        case COL_N90: v = r->n90; break;
+        case COL_I50: v = r->i50; break;
+        case COL_GC: snprintf(buf, len, "%.2f", r->gc_content); return;
+        case COL_AVG: snprintf(buf, len, "%.2f", r->avg_len); return;
+        case COL_MIN: v = r->min_len; break;
+        case COL_MAX: v = r->max_len; break;
+        case COL_AUN: v = r->aun; break;
+        case COL_NS: snprintf(buf, len, "%.2f", r->n_content); return;
+        case COL_MASKED: snprintf(buf, len, "%.2f", r->masked_content); return;
+        case COL_ALLSEQS: v = r->all_seqs; break;
+        case COL_ALLLEN: v = r->all_len; break;
+        default: break;
+    }
+    snprintf(buf, len, "%lu", v);
+}
+
+void print_header(const fields_t *f, int nice_output) {
     if (nice_output) {
-        int term_width = get_terminal_width();
-        // Calculate dynamic column widths based on terminal width
-        // Reserve minimum space for each column, adjust filepath width dynamically
         int min_col_width = 8;
-        int num_cols = 12; // total columns including filepath
-        int reserved_width = (num_cols - 1) * min_col_width + (num_cols - 1); // space for separators
-        int filepath_width = term_width - reserved_width;
-        
-        // Ensure filepath width is at least 15 chars and not more than 50
-        if (filepath_width < 15) filepath_width = 15;
-        if (filepath_width > 50) filepath_width = 50;
-        
-        printf("%-*s %*lu %*lu %*lu %*lu %*lu %*lu %*.2f %*.2f %*lu %*lu %*lu\n",
-               filepath_width, r->filepath,
-               min_col_width, r->total_seqs,
-               min_col_width, r->total_len,
-               min_col_width, r->n50,
-               min_col_width, r->n75,
-               min_col_width, r->n90,
-               min_col_width, r->i50,
-               min_col_width, r->gc_content,
-               min_col_width, r->avg_len,
-               min_col_width, r->min_len,
-               min_col_width, r->max_len,
-               min_col_width, r->aun);
+        printf("%-*s", nice_filepath_width(f->n + 1, min_col_width), "Filepath");
+        for (int i = 0; i < f->n; i++) printf(" %*s", min_col_width, column_names[f->col[i]]);
+    } else {
+        printf("Filepath");
+        for (int i = 0; i < f->n; i++) printf("\t%s", column_names[f->col[i]]);
+    }
+    printf("\n");
+}
+
+void print_result(result_t *r, const fields_t *f, output_format_t fmt, int nice_output) {
+    char value[64];
+    if (nice_output) {
+        // Columns are right-aligned, the filepath takes what the terminal has left
+        int min_col_width = 8;
+        printf("%-*s", nice_filepath_width(f->n + 1, min_col_width), r->filepath);
+        for (int i = 0; i < f->n; i++) {
+            column_value(r, f->col[i], value, sizeof(value));
+            printf(" %*s", min_col_width, value);
+        }
     } else {
         char sep = fmt == CSV ? ',' : '\t';
-        printf("%s%c%lu%c%lu%c%lu%c%lu%c%lu%c%lu%c%.2f%c%.2f%c%lu%c%lu%c%lu\n",
-               r->filepath, sep, r->total_seqs, sep, r->total_len, sep, r->n50, sep,
-               r->n75, sep, r->n90, sep, r->i50, sep, r->gc_content, sep,
-               r->avg_len, sep, r->min_len, sep, r->max_len, sep, r->aun);
+        printf("%s", r->filepath);
+        for (int i = 0; i < f->n; i++) {
+            column_value(r, f->col[i], value, sizeof(value));
+            printf("%c%s", sep, value);
+        }
     }
+    printf("\n");
 }
 
-void print_json_result(result_t *r, int is_first) {
+void print_json_result(result_t *r, const fields_t *f, int is_first) {
+    char value[64];
     if (!is_first) printf(",\n");
-    printf("  {\"File\":\"%s\",\"TotSeqs\":%lu,\"TotLen\":%lu,\"N50\":%lu,\"N75\":%lu,\"N90\":%lu,\"I50\":%lu,\"GC\":%.2f,\"Avg\":%.2f,\"Min\":%lu,\"Max\":%lu,\"AuN\":%lu}",
-           r->filepath, r->total_seqs, r->total_len, r->n50, r->n75, r->n90, r->i50, r->gc_content, r->avg_len, r->min_len, r->max_len, r->aun);
+    printf("  {\"File\":\"%s\"", r->filepath);
+    for (int i = 0; i < f->n; i++) {
+        column_value(r, f->col[i], value, sizeof(value));
+        printf(",\"%s\":%s", column_names[f->col[i]], value);
+    }
+    printf("}");
+}
+
+// Append the paths listed one per line in `path` ("-" for STDIN) to `*list`
+int read_file_list(const char *path, char ***list, int *n, int *cap) {
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!fp) return -1;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    int ret = 0;
+    while ((len = getline(&line, &line_cap, fp)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0) continue;
+        if (*n == *cap) {
+            int c = *cap ? *cap * 2 : 256;
+            char **p = realloc(*list, c * sizeof(char *));
+            if (!p) { ret = -1; break; }
+            *list = p;
+            *cap = c;
+        }
+        if (!((*list)[*n] = strdup(line))) { ret = -1; break; }
+        (*n)++;
+    }
+    if (ferror(fp)) ret = -1;
+    free(line);
+    if (fp != stdin) fclose(fp);
+    return ret;
+}
+
+typedef struct {
+    off_t size;
+    int index;
+} shard_file_t;
+
+static int shard_file_cmp(const void *a, const void *b) {
+    const shard_file_t *x = a, *y = b;
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    return x->index - y->index;
+}
+
+// Keep the inputs that fall in shard `shard` (1-based) of `nshards`, in their
+// order. Files go, largest first, to the shard with the fewest bytes so far
+// (the lowest numbered one on ties), so every process computes the same
+// partition from the same list and the shards end up about equally large.
+// Returns the number of inputs kept, or -1 if memory ran out.
+int shard_inputs(char **inputs, int n, int shard, int nshards) {
+    shard_file_t *f = malloc((n ? n : 1) * sizeof(shard_file_t));
+    uint64_t *load = calloc(nshards, sizeof(uint64_t));
+    int *heap = malloc(nshards * sizeof(int));     // shards, least loaded first
+    char *keep = calloc(n ? n : 1, 1);
+    if (!f || !load || !heap || !keep) {
+        free(f); free(load); free(heap); free(keep);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        struct stat st;
+        f[i].size = (strcmp(inputs[i], "-") != 0 && stat(inputs[i], &st) == 0) ? st.st_size : 0;
+        f[i].index = i;
+    }
+    qsort(f, n, sizeof(shard_file_t), shard_file_cmp);
+    for (int i = 0; i < nshards; i++) heap[i] = i;     // all empty: already a heap
+#define SHARD_LESS(a, b) (load[a] < load[b] || (load[a] == load[b] && (a) < (b)))
+    for (int i = 0; i < n; i++) {
+        int s = heap[0];
+        if (s == shard - 1) keep[f[i].index] = 1;
+        load[s] += (uint64_t)f[i].size + 1;
+        // Sift the root down
+        int j = 0;
+        for (;;) {
+            int c = 2 * j + 1;
+            if (c >= nshards) break;
+            if (c + 1 < nshards && SHARD_LESS(heap[c + 1], heap[c])) c++;
+            if (!SHARD_LESS(heap[c], heap[j])) break;
+            int t = heap[c]; heap[c] = heap[j]; heap[j] = t;
+            j = c;
+        }
+    }
+#undef SHARD_LESS
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        if (keep[i]) inputs[kept++] = inputs[i];
+    }
+    free(f); free(load); free(heap); free(keep);
+    return kept;
+}
+
+// A length limit of --min-len or --max-len: returns 0, or -1 if `arg` is not one.
+// Limits stay below 2^32 so that both fit in the cache key.
+int parse_len(const char *arg, uint64_t *len) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(arg, &end, 10);
+    if (errno || end == arg || *end || *arg == '-' || v >= UINT32_MAX) return -1;
+    *len = v;
+    return 0;
+}
+
+// Columns of --fields, a comma-separated list of names in any case: returns 0,
+// or -1 with a message if a name is unknown or given twice
+int parse_fields(const char *arg, fields_t *f) {
+    f->n = 0;
+    const char *p = arg;
+    for (;;) {
+        size_t len = strcspn(p, ",");
+        int c = 0;
+        while (c < COLS && (strlen(column_names[c]) != len || strncasecmp(p, column_names[c], len) != 0)) c++;
+        if (c == COLS) {
+            fprintf(stderr, "Error: unknown field '%.*s' in --fields, expected some of", (int)len, p);
+            for (int i = 0; i < COLS; i++) fprintf(stderr, "%s%s", i ? "," : " ", column_names[i]);
+            fprintf(stderr, "\n");
+            return -1;
+        }
+        for (int i = 0; i < f->n; i++) {
+            if (f->col[i] == (column_t)c) {
+                fprintf(stderr, "Error: field %s is given twice in --fields\n", column_names[c]);
+                return -1;
+            }
+        }
+        f->col[f->n++] = (column_t)c;
+        if (!p[len]) return 0;
+        p += len + 1;
+    }
+}
+
+int fields_has(const fields_t *f, column_t c) {
+    for (int i = 0; i < f->n; i++) {
+        if (f->col[i] == c) return 1;
+    }
+    return 0;
+}
+
+// Cache key options of a length filter, 0 without one
+uint64_t filter_opts(uint64_t min_len, uint64_t max_len) {
+    uint64_t max = max_len < UINT32_MAX ? max_len : UINT32_MAX;
+    return min_len << 32 | (UINT32_MAX - max);
 }
 
 void print_help(const char *progname) {
@@ -214,10 +734,38 @@ void print_help(const char *progname) {
     printf("  -j, --json      Output results in JSON format\n");
     printf("  -c, --csv       Output results in CSV format (default is TSV)\n");
     printf("  -n, --nice      Output results in a visually aligned ASCII table\n");
+    printf("  -t, --threads N Number of threads (default: online cores)\n");
+    printf("  -k, --sketch    Save a mergeable sketch of each file next to it (FILE.n50sketch)\n");
+    printf("  -m, --merge     FILES are sketches: print the pooled statistics of all of them\n");
+    printf("  -C, --cache F   Keep results in the cache file F (default: $N50_CACHE) and\n");
+    printf("                  reuse them while a file keeps its inode, size, mtime and ctime\n");
+    printf("  -x, --index     Save an index next to gzip files (FILE.gzidx) so that later\n");
+    printf("                  runs inflate them on several threads; the file is read by\n");
+    printf("                  one thread while its index is built\n");
+    printf("  -F, --files-from L  Read more FILES from the list L, one per line ('-' for STDIN)\n");
+    printf("  -S, --shard I/N Only process shard I (1..N) of the FILES, split in N shards of\n");
+    printf("                  about the same total size; every I gets a disjoint share\n");
+    printf("  --trace FILE    Write a timeline of what every thread did (Chrome trace-event\n");
+    printf("                  JSON, for chrome://tracing or ui.perfetto.dev) to FILE\n");
+    printf("  --hwcounters    Count cycles, instructions, cache and branch misses of the\n");
+    printf("                  decompress, parse, compute and sort phases (Linux perf events)\n");
+    printf("                  and print them to STDERR; files are read by one thread each\n");
+    printf("  --profile[=J]   Print the time of each phase, throughput and peak memory of\n");
+    printf("                  every file to STDERR, or as JSON to the file J\n");
+    printf("  --progress[=S]  Print the progress, throughput and time left to STDERR every\n");
+    printf("                  S seconds (default: 1)\n");
+    printf("  --min-len N     Only count sequences of at least N bases\n");
+    printf("  --max-len N     Only count sequences of at most N bases; with either option\n");
+    printf("                  AllSeqs and AllLen give the totals before filtering\n");
+    printf("  --fields LIST   Only print the columns in LIST, comma-separated and in that\n");
+    printf("                  order (e.g. TotSeqs,TotLen,N50); without GC, Ns and Masked\n");
+    printf("                  the bases are not read, only the lengths counted\n");
     printf("  -h, --help      Show this help message and exit\n");
     printf("  -v, --version   Show version number and exit\n\n");
     printf("Output Columns (TSV/CSV):\n");
-    printf("  Filepath, TotSeqs, TotLen, N50, N75, N90, I50, GC, Avg, Min, Max, AuN\n\n");
+    printf("  Filepath, TotSeqs, TotLen, N50, N75, N90, I50, GC, Avg, Min, Max, AuN\n");
+    printf("  [AllSeqs, AllLen with --min-len or --max-len]; --fields picks others after Filepath,\n");
+    printf("  among them Ns and Masked (percentages of N and lowercase bases)\n\n");
 }
 
 int main(int argc, char *argv[]) {
@@ -225,6 +773,20 @@ int main(int argc, char *argv[]) {
     output_format_t output_format = TSV;
     int abs_path = 0, basename_flag = 0;
     int nice_output = 0;
+    int num_threads = get_default_threads();
+    int build_index = 0;
+    int sketch = 0, merge = 0;
+    const char *cache_path = getenv("N50_CACHE");
+    const char *files_from = NULL;
+    int shard = 0, nshards = 0;
+    int profile = 0;
+    const char *profile_path = NULL;
+    const char *trace_path = NULL;
+    int hwcounters = 0;
+    double progress = 0.0;
+    uint64_t min_len = 0, max_len = UINT64_MAX;
+    int filtered = 0;
+    const char *fields_arg = NULL;
 
     static struct option long_opts[] = {
         {"abs", no_argument, 0, 'a'},
@@ -232,116 +794,349 @@ int main(int argc, char *argv[]) {
         {"json", no_argument, 0, 'j'},
         {"csv", no_argument, 0, 'c'},
         {"nice", no_argument, 0, 'n'},
+        {"threads", required_argument, 0, 't'},
+        {"index", no_argument, 0, 'x'},
+        {"cache", required_argument, 0, 'C'},
+        {"sketch", no_argument, 0, 'k'},
+        {"merge", no_argument, 0, 'm'},
+        {"files-from", required_argument, 0, 'F'},
+        {"shard", required_argument, 0, 'S'},
+        {"profile", optional_argument, 0, OPT_PROFILE},
+        {"trace", required_argument, 0, OPT_TRACE},
+        {"hwcounters", no_argument, 0, OPT_HWCOUNTERS},
+        {"progress", optional_argument, 0, OPT_PROGRESS},
+        {"min-len", required_argument, 0, OPT_MIN_LEN},
+        {"max-len", required_argument, 0, OPT_MAX_LEN},
+        {"fields", required_argument, 0, OPT_FIELDS},
         {"help", no_argument, 0, 'h'},
         {"version", no_argument, 0, 'v'},
         {0, 0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "abjchnv", long_opts, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "abjchnt:xC:kmF:S:v", long_opts, &option_index)) != -1) {
         switch (opt) {
             case 'a': abs_path = 1; break;
             case 'b': basename_flag = 1; break;
             case 'j': output_format = JSON; break;
             case 'c': output_format = CSV; break;
             case 'n': nice_output = 1; basename_flag = 1; break;
+            case 't':
+                num_threads = atoi(optarg);
+                if (num_threads < 1) {
+                    fprintf(stderr, "Error: --threads must be a positive integer\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'x': build_index = 1; break;
+            case 'C': cache_path = optarg; break;
+            case 'k': sketch = 1; break;
+            case 'm': merge = 1; break;
+            case 'F': files_from = optarg; break;
+            case 'S': {
+                char extra;
+                if (sscanf(optarg, "%d/%d%c", &shard, &nshards, &extra) != 2 || nshards < 1 || shard < 1 || shard > nshards) {
+                    fprintf(stderr, "Error: --shard must be I/N with 1 <= I <= N\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case OPT_PROFILE:
+                profile = 1;
+                profile_path = optarg;
+                break;
+            case OPT_TRACE: trace_path = optarg; break;
+            case OPT_HWCOUNTERS: hwcounters = 1; break;
+            case OPT_PROGRESS:
+                progress = optarg ? atof(optarg) : 1.0;
+                if (progress <= 0) {
+                    fprintf(stderr, "Error: --progress must be a positive number of seconds\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_MIN_LEN:
+            case OPT_MAX_LEN:
+                if (parse_len(optarg, opt == OPT_MIN_LEN ? &min_len : &max_len) != 0) {
+                    fprintf(stderr, "Error: --%s must be a number of bases below %u\n",
+                            opt == OPT_MIN_LEN ? "min-len" : "max-len", UINT32_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                filtered = 1;
+                break;
+            case OPT_FIELDS: fields_arg = optarg; break;
             case 'h': print_help(argv[0]); exit(0);
             case 'v': printf("%s\n", VERSION); exit(0);
             default: exit(EXIT_FAILURE);
         }
     }
 
-    int files = argc - optind;
+    // Inputs: the arguments, then the files listed in --files-from
+    if (min_len > max_len) {
+        fprintf(stderr, "Error: --min-len is above --max-len, no sequence can be kept\n");
+        return 1;
+    }
+
+    int files = argc - optind, inputs_cap = files;
+    char **inputs = malloc((files ? files : 1) * sizeof(char *));
+    if (!inputs) {
+        perror("malloc");
+        return 1;
+    }
+    for (int i = 0; i < files; i++) inputs[i] = argv[optind + i];
+    if (files_from && read_file_list(files_from, &inputs, &files, &inputs_cap) != 0) {
+        fprintf(stderr, "Error reading file list %s\n", files_from);
+        return 1;
+    }
     if (files < 1) {
         fprintf(stderr, "Usage: %s [options] FILES...\n", argv[0]);
         return 1;
     }
+    if (filtered && merge) {
+        fprintf(stderr, "Error: --min-len and --max-len cannot be used with --merge\n");
+        return 1;
+    }
+
+    // The columns up to AuN by default, as parsers of the output expect them, and
+    // the totals before filtering with a filter. Ns and Masked only with --fields.
+    fields_t fields;
+    if (fields_arg) {
+        if (parse_fields(fields_arg, &fields) != 0) return 1;
+    } else {
+        fields.n = 0;
+        for (int c = 0; c < COLS; c++) {
+            if (c == COL_NS || c == COL_MASKED) continue;
+            if (filtered || (c != COL_ALLSEQS && c != COL_ALLLEN)) fields.col[fields.n++] = (column_t)c;
+        }
+    }
+    int compose = sketch || fields_has(&fields, COL_GC) || fields_has(&fields, COL_NS) || fields_has(&fields, COL_MASKED);
+    if (nshards && (files = shard_inputs(inputs, files, shard, nshards)) < 0) {
+        perror("malloc");
+        return 1;
+    }
 
-    if (output_format == TSV) {
-        if (nice_output) {
-            int term_width = get_terminal_width();
-            int min_col_width = 8;
-            int num_cols = 12;
-            int reserved_width = (num_cols - 1) * min_col_width + (num_cols - 1);
-            int filepath_width = term_width - reserved_width;
-            
-            if (filepath_width < 15) filepath_width = 15;
-            if (filepath_width > 50) filepath_width = 50;
-            
-            printf("%-*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s\n",
-                   filepath_width, "Filepath",
-                   min_col_width, "TotSeqs",
-                   min_col_width, "TotLen",
-                   min_col_width, "N50",
-                   min_col_width, "N75",
-                   min_col_width, "N90",
-                   min_col_width, "I50",
-                   min_col_width, "GC",
-                   min_col_width, "Avg",
-                   min_col_width, "Min",
-                   min_col_width, "Max",
-                   min_col_width, "AuN");
+    rescache_t cache;
+    int use_cache = cache_path && *cache_path;
+    if (use_cache && rescache_open(&cache, cache_path) != 0) {
+        perror("malloc");
+        return 1;
+    }
+
+    if (output_format == TSV) print_header(&fields, nice_output);
+
+    if (merge) {
+        // Pool the sketches: histograms and compositions add up exactly
+        lenhist_t hist;
+        compose_t comp = {0};
+        lenhist_init(&hist);
+        for (int i = 0; i < files; i++) {
+            int ret = sketch_load(inputs[i], &hist, &comp);
+            if (ret != 0) {
+                if (ret == -2) perror("malloc");
+                else fprintf(stderr, "Error reading sketch %s\n", inputs[i]);
+                lenhist_free(&hist);
+                return 1;
+            }
+        }
+        result_t *res = make_result(strdup("merged"), &hist, &comp);
+        lenhist_free(&hist);
+        if (!res) return 1;
+        if (output_format == JSON) {
+            printf("[\n");
+            print_json_result(res, &fields, 1);
+            printf("\n]\n");
         } else {
-            printf("Filepath\tTotSeqs\tTotLen\tN50\tN75\tN90\tI50\tGC\tAvg\tMin\tMax\tAuN\n");
+            print_result(res, &fields, output_format, nice_output);
         }
+        free_result(res);
+        return 0;
     }
 
-    result_t **all_results = NULL;
-    int total_results = 0;
+    if (files == 0) {
+        // An empty shard
+        if (output_format == JSON) printf("[\n]\n");
+        return 0;
+    }
 
-    if (output_format == JSON) {
-        all_results = malloc(files * sizeof(result_t*));
-        if (!all_results) {
-            perror("malloc");
-            return 1;
+    profile_report_t report;
+    if (profile && profile_open(&report, profile_path) != 0) {
+        fprintf(stderr, "Error creating profile %s\n", profile_path);
+        return 1;
+    }
+
+    if (trace_path) {
+        trace_start("n50");
+        trace_thread("main");
+    }
+
+    if (progress) {
+        // Percentages need the size of every input, unknown as soon as one is not a regular file
+        uint64_t total = 0;
+        for (int i = 0; i < files; i++) {
+            struct stat st;
+            if (strcmp(inputs[i], "-") == 0 || stat(inputs[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+                total = 0;
+                break;
+            }
+            total += st.st_size;
         }
+        if (progress_start(total, files, progress) != 0) fprintf(stderr, "Warning: cannot start the progress reporter\n");
     }
 
-    pthread_t threads[MAX_THREADS];
-    int running_threads = 0;
-    for (int i = optind; i < argc; i++) {
-        task_t *t = malloc(sizeof(task_t));
-        t->filepath = argv[i];
-        t->output_format = output_format;
-        t->abs_path = abs_path;
-        t->basename = basename_flag;
-        t->nice_output = nice_output;
-
-        pthread_mutex_lock(&thread_mutex);
-        while (num_threads >= MAX_THREADS) {
-            pthread_mutex_unlock(&thread_mutex);
-            usleep(10000);
-            pthread_mutex_lock(&thread_mutex);
+    hwcount_sum_t hw_total;
+    memset(&hw_total, 0, sizeof(hw_total));
+    if (hwcounters) {
+        hwcount_t probe;
+        if (hwcount_open(&probe) != 0) {
+            fprintf(stderr, "Warning: hardware counters are not available (%s)\n", strerror(errno));
+            hwcounters = 0;
         }
-        pthread_create(&threads[running_threads++], NULL, process_file, t);
-        num_threads++;
-        pthread_mutex_unlock(&thread_mutex);
-
-        if (running_threads >= MAX_THREADS || i == argc - 1) {
-            for (int j = 0; j < running_threads; j++) {
-                void *res;
-                pthread_join(threads[j], &res);
-                if (res) {
-                    if (output_format == JSON) {
-                        all_results[total_results++] = (result_t *)res;
-                    } else {
-                        print_result((result_t *)res, output_format, nice_output);
-                        free(res);
-                    }
-                }
-            }
-            running_threads = 0;
+        hwcount_close(&probe);
+    }
+
+    // Threads left over when there are fewer files than threads work inside the
+    // files, except with counters, which count the phases of one thread
+    int file_threads = num_threads / files > 1 && !hwcounters ? num_threads / files : 1;
+    if (num_threads > files) num_threads = files;
+    work_queue_t queue = { .total = files, .admitted = 0, .emitted = 0 };
+    queue.depth = num_threads * 4;
+    queue.hwcounters = hwcounters;
+    queue.slots = calloc(queue.depth, sizeof(slot_t));
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (!queue.slots || !threads) {
+        perror("malloc");
+        return 1;
+    }
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.work_cond, NULL);
+    pthread_cond_init(&queue.done_cond, NULL);
+
+    int started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, worker, &queue) != 0) {
+            fprintf(stderr, "Error creating worker thread %d\n", i);
+            break;
         }
+        started++;
     }
+    if (started == 0) return 1;
 
-    if (output_format == JSON) {
-        printf("[\n");
-        for (int i = 0; i < total_results; i++) {
-            print_json_result(all_results[i], i == 0);
-            free(all_results[i]);
+    if (output_format == JSON) printf("[\n");
+    int printed = 0;
+    int failed = 0;     // inputs that could not be opened or read to the end
+    while (queue.emitted < files) {
+        // Admit new inputs as the window moves forward; stat() is done outside the lock
+        pthread_mutex_lock(&queue.mutex);
+        int limit = queue.emitted + queue.depth;
+        pthread_mutex_unlock(&queue.mutex);
+        if (limit > files) limit = files;
+        for (int i = queue.admitted; i < limit; i++) {
+            slot_t *slot = &queue.slots[i % queue.depth];
+            task_t *t = &slot->task;
+            struct stat st;
+            t->filepath = inputs[i];
+            t->index = i;
+            int regular = strcmp(t->filepath, "-") != 0 && stat(t->filepath, &st) == 0 && S_ISREG(st.st_mode);
+            t->size = regular ? st.st_size : 0;
+            t->output_format = output_format;
+            t->abs_path = abs_path;
+            t->basename = basename_flag;
+            t->nice_output = nice_output;
+            t->threads = file_threads;
+            t->build_index = build_index;
+            t->sketch = sketch;
+            t->cacheable = use_cache && regular && !sketch;
+            t->profile = profile;
+            t->min_len = min_len;
+            t->max_len = max_len;
+            t->compose = compose;
+            if (t->cacheable) rescache_key(&st, filtered ? filter_opts(min_len, max_len) : 0, &t->key);
+            slot->result = NULL;
+            slot->state = SLOT_PENDING;
+            // Cached files are done without being opened
+            rescache_stats_t cached;
+            if (t->cacheable && rescache_get(&cache, &t->key, &cached)) {
+                slot->result = cached_result(t, &cached);
+                slot->state = SLOT_DONE;
+                t->cacheable = 0;
+                progress_done(NULL, t->size);
+            }
+            pthread_mutex_lock(&queue.mutex);
+            queue.admitted = i + 1;
+            trace_count("files", queue.admitted - queue.emitted);
+            pthread_cond_signal(&queue.work_cond);
+            pthread_mutex_unlock(&queue.mutex);
         }
-        printf("\n]\n");
-        free(all_results);
+
+        // Wait for the next input in order, flushing what we have before blocking
+        slot_t *slot = &queue.slots[queue.emitted % queue.depth];
+        pthread_mutex_lock(&queue.mutex);
+        if (slot->state != SLOT_DONE) {
+            pthread_mutex_unlock(&queue.mutex);
+            fflush(stdout);
+            pthread_mutex_lock(&queue.mutex);
+            uint64_t span = trace_now();
+            while (slot->state != SLOT_DONE) {
+                pthread_cond_wait(&queue.done_cond, &queue.mutex);
+            }
+            trace_span("wait", span);
+        }
+        result_t *res = slot->result;
+        queue.emitted++;
+        if (queue.emitted == files) pthread_cond_broadcast(&queue.work_cond);
+        pthread_mutex_unlock(&queue.mutex);
+
+        // Inputs that could not be opened, or ran out of memory, print no row
+        if (!res) {
+            failed++;
+            continue;
+        }
+        failed += res->failed;
+        // A result without the composition, or of a scan that stopped before the
+        // end, is not complete enough to be reused
+        if (slot->task.cacheable && slot->task.compose && !res->failed) cache_result(&cache, &slot->task, res);
+        if (hwcounters) hwcount_add(&hw_total, &res->hw);
+        double format_start = profile ? profile_now() : 0.0;
+        uint64_t span = trace_now();
+        if (output_format == JSON) {
+            print_json_result(res, &fields, printed == 0);
+        } else {
+            print_result(res, &fields, output_format, nice_output);
+        }
+        trace_span("output", span);
+        if (profile) {
+            res->prof.wall += profile_lap(&res->prof, PROF_FORMAT, format_start) - format_start;
+            profile_file(&report, res->filepath, &res->prof);
+        }
+        printed++;
+        free_result(res);
+    }
+    if (output_format == JSON) printf("\n]\n");
+    fflush(stdout);
+    progress_stop();
+    if (profile) {
+        fflush(stdout);
+        profile_close(&report);
+    }
+    if (hwcounters) {
+        fflush(stdout);
+        hwcount_print(stderr, &hw_total);
     }
 
-    return 0;
+    uint64_t span = trace_now();
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    trace_span("join", span);
+    if (trace_path && trace_write(trace_path) != 0) fprintf(stderr, "Warning: cannot write the trace %s\n", trace_path);
+    if (use_cache) {
+        if (rescache_save(&cache) != 0) fprintf(stderr, "Warning: cannot write the cache %s\n", cache_path);
+        rescache_close(&cache);
+    }
+    free(threads);
+    free(inputs);
+    free(queue.slots);
+    pthread_mutex_destroy(&queue.mutex);
+    pthread_cond_destroy(&queue.work_cond);
+    pthread_cond_destroy(&queue.done_cond);
+
+    return failed ? 1 : 0;
 }
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <pthread.h>
 #include <zlib.h>
 #include <libgen.h>
@@ -14,10 +15,29 @@
 #include <math.h>
 
 #include "kseq.h"
-KSEQ_INIT(gzFile, gzread)
+#include "radix.h"
+#include "compose.h"
+#include "fxsrc.h"
+#include "qualstat.h"
+#include "profile.h"
+#include "hwcount.h"
+#include "progress.h"
+KSEQ_INIT(profile_reader_t *, profile_kread)
 
 #define MAX_THREADS 4
 #define VERSION "1.9.4"
+#define QUAL_BATCH 4096             // reads parsed before they are processed
+#define QUAL_BATCH_BYTES (4 << 20)  // or fewer, when they are long
+
+// Long options without a short one
+enum {
+    OPT_PROFILE = 256,
+    OPT_HWCOUNTERS,
+    OPT_PROGRESS,
+    OPT_MIN_LEN,
+    OPT_MAX_LEN,
+    OPT_FIELDS
+};
 
 typedef enum {
     TSV,
@@ -33,6 +53,13 @@ typedef struct {
     int nice_output;
     int qual_offset;
     char *output_file;
+    int threads;        // threads for the file itself, e.g. to inflate it in parallel
+    int profile;        // time the phases of the file (--profile)
+    int hwcounters;     // count its phases with hardware counters
+    uint64_t min_len, max_len;  // reads kept (--min-len, --max-len)
+    int compose;        // count the bases, for GC
+    int quals;          // read the qualities, for AvgQual, Q20 or Q30
+    int error_probs;    // sum their error probabilities, for AvgQual or --output
 } task_t;
 
 typedef struct {
@@ -57,17 +84,49 @@ typedef struct {
     double avg_quality;
     double q20_fraction;
     double q30_fraction;
+    unsigned long all_seqs, all_len;    // before the length filter
+    int failed;             // the read stopped on a read error or malformed record
+    profile_t prof;         // phases of the file, with --profile
+    hwcount_sum_t hw;       // counters of the file, with --hwcounters
 } result_t;
 
+// Output columns after Filepath, in their default order
+typedef enum {
+    COL_TOTSEQS,
+    COL_TOTLEN,
+    COL_N50,
+    COL_N75,
+    COL_N90,
+    COL_I50,
+    COL_GC,
+    COL_AVG,
+    COL_MIN,
+    COL_MAX,
+    COL_AUN,
+    COL_AVGQUAL,
+    COL_Q20,
+    COL_Q30,
+    COL_ALLSEQS,
+    COL_ALLLEN,
+    COLS
+} column_t;
+
+static const char *const column_names[COLS] = {
+    "TotSeqs", "TotLen", "N50", "N75", "N90", "I50", "GC", "Avg", "Min", "Max", "AuN", "AvgQual", "Q20", "Q30",
+    "AllSeqs", "AllLen"
+};
+
+// Columns printed, in order (--fields)
+typedef struct {
+    column_t col[COLS];
+    int n;
+} fields_t;
+
 pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
 int num_threads = 0;
 pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t thread_cond = PTHREAD_COND_INITIALIZER;
 
-int compare_desc(const void *a, const void *b) {
-    return (*(int *)b - *(int *)a);
-}
-
 int get_terminal_width() {
     struct winsize w;
     if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0) {
@@ -76,17 +135,6 @@ int get_terminal_width() {
     return 80; // Default fallback width
 }
 
-unsigned long calculate_auN(unsigned *lengths, unsigned long n, unsigned long limit) {
-    double aun = 0.0;
-    unsigned long cumulative = 0;
-    for (unsigned long i = 0; i < n && cumulative < limit; i++) {
-        unsigned long eff_len = (cumulative + lengths[i] <= limit) ? lengths[i] : (limit - cumulative);
-        aun += eff_len * ((double)eff_len / limit);
-        cumulative += lengths[i];
-    }
-    return (unsigned long)(aun + 0.5);
-}
-
 void write_seq_qual_tsv(seq_qual_t *seq_quals, unsigned long total_seqs, const char *output_file) {
     FILE *fp = fopen(output_file, "w");
     if (!fp) {
@@ -108,7 +156,41 @@ void write_seq_qual_tsv(seq_qual_t *seq_quals, unsigned long total_seqs, const c
     fclose(fp);
 }
 
+// Reads parsed but not processed yet. kseq reuses its buffers for every
+// record, so the bases, qualities and name a read needs are copied, in that
+// order, to buf at off[i].
+typedef struct {
+    size_t off[QUAL_BATCH];
+    unsigned len[QUAL_BATCH];
+    int n;
+    char *buf;
+    size_t used, cap;
+} qual_batch_t;
+
+// Copy the parts of the current record that are needed; -1 if out of memory
+static int qual_batch_add(qual_batch_t *b, const kseq_t *seq, int bases, int quals, int names) {
+    size_t len = seq->seq.l;
+    size_t need = (bases ? len : 0) + (quals ? len : 0) + (names ? seq->name.l + 1 : 0);
+    if (b->used + need > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 1 << 16;
+        while (cap < b->used + need) cap *= 2;
+        char *buf = realloc(b->buf, cap);
+        if (!buf) return -1;
+        b->buf = buf;
+        b->cap = cap;
+    }
+    char *d = b->buf + b->used;
+    b->off[b->n] = b->used;
+    b->len[b->n++] = len;
+    if (bases) memcpy(d, seq->seq.s, len), d += len;
+    if (quals) memcpy(d, seq->qual.s, len), d += len;
+    if (names) memcpy(d, seq->name.s, seq->name.l + 1);
+    b->used += need;
+    return 0;
+}
+
 void free_seq_quals(seq_qual_t *seq_quals, unsigned long total_seqs) {
+    if (!seq_quals) return;
     for (unsigned long i = 0; i < total_seqs; i++) {
         if (seq_quals[i].readname) {
             free(seq_quals[i].readname);
@@ -119,99 +201,175 @@ void free_seq_quals(seq_qual_t *seq_quals, unsigned long total_seqs) {
 
 void *process_file(void *arg) {
     task_t *task = (task_t *)arg;
+    profile_t prof;
+    profile_t *p = task->profile ? &prof : NULL;
+    double start = 0.0, t = 0.0;
+    if (p) {
+        memset(p, 0, sizeof(profile_t));
+        start = t = profile_now();
+    }
 
-    gzFile fp;
-    if (strcmp(task->filepath, "-") == 0)
-        fp = gzdopen(STDIN_FILENO, "r");
-    else
-        fp = gzopen(task->filepath, "r");
-    if (!fp) {
+    // Whatever is set here is released at `done`, on every way out
+    result_t *res = NULL;
+    hwcount_t hwc;
+    hwcount_t *hw = NULL;
+    fxsrc_t src;
+    int opened = 0;
+    progress_file_t pf;
+    kseq_t *seq = NULL;
+    unsigned *lengths = NULL;
+    seq_qual_t *seq_quals = NULL;
+    unsigned long total_seqs = 0;
+    qual_batch_t *b = NULL;
+
+    if (fxsrc_open(&src, task->filepath, task->threads) != 0) {
         fprintf(stderr, "Error opening file %s\n", task->filepath);
-        pthread_exit(NULL);
+        progress_done(NULL, 0);
+        goto done;
     }
-
-    kseq_t *seq = kseq_init(fp);
+    opened = 1;
+    if (p) {
+        t = profile_lap(p, PROF_OPEN, t);
+        p->in_bytes = src.size;
+    }
+    // Counters are opened by the thread that reads the file and read per batch of reads
+    if (task->hwcounters && hwcount_open(&hwc) == 0) hw = &hwc;
+    hwcount_sum_t hws;
+    memset(&hws, 0, sizeof(hws));
+    progress_file(&pf, &src);
+    fxscan_read_fn read_fn = progress_on ? progress_read : fxsrc_read;
+    void *read_ctx = progress_on ? (void *)&pf : (void *)&src;
+    hwcount_reader_t hwin = {read_fn, read_ctx, hw, &hws};
+
+    // Reads go through `in` so that --profile, --hwcounters and --progress can measure them
+    profile_reader_t in = {hw ? hwcount_read : read_fn, hw ? (void *)&hwin : read_ctx, p};
+    seq = kseq_init(&in);
+    // Reads outside the length limits are counted, then skipped before their bases and qualities are read
+    fxfilter_t filter;
+    fxfilter_init(&filter, task->min_len, task->max_len);
     int first_seq = 1;
-    unsigned long total_len = 0, total_seqs = 0;
+    unsigned long total_len = 0;
     unsigned long gc_count = 0;
     unsigned long min_len = ULONG_MAX, max_len = 0;
-    unsigned long total_quality = 0, q20_count = 0, q30_count = 0;
+    qualstat_t qs = {0};
     double total_error_prob_sum = 0.0;
     size_t alloc = 1024;
-    unsigned *lengths = malloc(sizeof(unsigned) * alloc);
-    seq_qual_t *seq_quals = malloc(sizeof(seq_qual_t) * alloc);
-    if (!lengths || !seq_quals) {
+    lengths = malloc(sizeof(unsigned) * alloc);
+    // Per-read names and qualities are only kept for --output
+    seq_quals = task->output_file ? malloc(sizeof(seq_qual_t) * alloc) : NULL;
+    if (!seq || !lengths || (task->output_file && !seq_quals)) {
         perror("malloc");
-        if (lengths) free(lengths);
-        if (seq_quals) free_seq_quals(seq_quals, 0);
-        pthread_exit(NULL);
-    }
-
-    while (kseq_read(seq) >= 0) {
-        // Check if this is FASTA format (no quality scores)
-        if (first_seq && seq->qual.l == 0) {
-            fprintf(stderr, "Error: File %s appears to be in FASTA format. This tool requires FASTQ files with quality scores.\n", task->filepath);
-            kseq_destroy(seq);
-            gzclose(fp);
-            free(lengths);
-            free_seq_quals(seq_quals, 0);
-            pthread_exit(NULL);
-        }
-        first_seq = 0;
-        
-        unsigned len = seq->seq.l;
-        if (total_seqs >= alloc) {
-            alloc *= 2;
-            unsigned *new_lengths = realloc(lengths, sizeof(unsigned) * alloc);
-            seq_qual_t *new_seq_quals = realloc(seq_quals, sizeof(seq_qual_t) * alloc);
-            if (!new_lengths || !new_seq_quals) {
+        goto done;
+    }
+
+    // Reads are parsed a batch at a time and then processed, so that the counters are read per batch
+    int keep_quals = task->quals || task->error_probs;
+    b = malloc(sizeof(qual_batch_t));
+    if (!b) {
+        perror("malloc");
+        goto done;
+    }
+    b->buf = NULL;
+    b->cap = 0;
+    int more = 1;
+    int l = 0;      // last kseq_read(): -1 at the end, -2 malformed, -3 read error
+    while (more) {
+        b->n = 0;
+        b->used = 0;
+        while (b->n < QUAL_BATCH && b->used < QUAL_BATCH_BYTES && (more = ((l = kseq_read(seq)) >= 0))) {
+            // Check if this is FASTA format (no quality scores)
+            if (first_seq && seq->qual.l == 0) {
+                fprintf(stderr, "Error: File %s appears to be in FASTA format. This tool requires FASTQ files with quality scores.\n", task->filepath);
+                goto done;
+            }
+            first_seq = 0;
+            if (progress_on && (filter.seqs & (PROGRESS_BATCH - 1)) == 0) progress_update(&pf, 0, 0, filter.seqs, filter.bases);
+            if (!fxfilter_keep(&filter, seq->seq.l)) continue;
+            if (qual_batch_add(b, seq, task->compose, keep_quals, seq_quals != NULL) != 0) {
                 perror("realloc");
-                free(lengths);
-                free_seq_quals(seq_quals, total_seqs);
-                pthread_exit(NULL);
+                goto done;
             }
-            lengths = new_lengths;
-            seq_quals = new_seq_quals;
         }
-        lengths[total_seqs] = len;
-        total_len += len;
-        if (len < min_len) min_len = len;
-        if (len > max_len) max_len = len;
-        
-        // Parse quality values
-        double seq_error_prob_sum = 0.0;
-        for (unsigned i = 0; i < len; i++) {
-            char c = seq->seq.s[i];
-            if (c == 'G' || c == 'g' || c == 'C' || c == 'c') gc_count++;
-            
-            // Parse quality score
-            int qual = (int)seq->qual.s[i] - task->qual_offset;
-            // Convert quality to error probability: P = 10^(-Q/10)
-            double error_prob = pow(10.0, -qual / 10.0);
-            seq_error_prob_sum += error_prob;
-            total_error_prob_sum += error_prob;
-            total_quality += qual;
-            if (qual >= 20) q20_count++;
-            if (qual >= 30) q30_count++;
-        }
-        
-        // Store sequence length, average quality, and readname
-        seq_quals[total_seqs].length = len;
-        // Calculate average quality using logarithmic method: Q_avg = -10 * log10(P_avg)
-        double avg_error_prob = seq_error_prob_sum / len;
-        seq_quals[total_seqs].avg_quality = (avg_error_prob == 0.0) ? 0.0 : -10.0 * log10(avg_error_prob);
-        seq_quals[total_seqs].readname = malloc(strlen(seq->name.s) + 1);
-        if (seq_quals[total_seqs].readname) {
-            strcpy(seq_quals[total_seqs].readname, seq->name.s);
+        if (p) t = profile_lap(p, PROF_PARSE, t);
+        if (hw) hwcount_lap(hw, &hws, PROF_PARSE);
+
+        for (int i = 0; i < b->n; i++) {
+            unsigned len = b->len[i];
+            const char *bases = b->buf + b->off[i];
+            const char *quals = bases + (task->compose ? len : 0);
+            const char *name = quals + (keep_quals ? len : 0);
+            if (total_seqs >= alloc) {
+                alloc *= 2;
+                // Each array is taken over as soon as it has moved, so that a
+                // failure frees only the arrays currently in use
+                unsigned *new_lengths = realloc(lengths, sizeof(unsigned) * alloc);
+                if (new_lengths) lengths = new_lengths;
+                seq_qual_t *new_seq_quals = new_lengths && seq_quals ? realloc(seq_quals, sizeof(seq_qual_t) * alloc) : NULL;
+                if (new_seq_quals) seq_quals = new_seq_quals;
+                if (!new_lengths || (seq_quals && !new_seq_quals)) {
+                    perror("realloc");
+                    goto done;
+                }
+            }
+            lengths[total_seqs] = len;
+            total_len += len;
+            if (len < min_len) min_len = len;
+            if (len > max_len) max_len = len;
+
+            if (task->compose) {
+                compose_t comp = {0};
+                compose_count(bases, len, &comp);
+                gc_count += comp.gc;
+            }
+
+            // Parse quality values; error probabilities cost a pow() per base and are only summed when needed
+            double seq_error_prob_sum = 0.0;
+            if (task->error_probs) seq_error_prob_sum = qualstat_read(quals, len, task->qual_offset, &qs);
+            else if (task->quals) qualstat_count(quals, len, task->qual_offset, &qs);
+            total_error_prob_sum += seq_error_prob_sum;
+
+            if (seq_quals) {
+                // Store sequence length, average quality, and readname
+                seq_quals[total_seqs].length = len;
+                // Calculate average quality using logarithmic method: Q_avg = -10 * log10(P_avg)
+                double avg_error_prob = seq_error_prob_sum / len;
+                seq_quals[total_seqs].avg_quality = (avg_error_prob == 0.0) ? 0.0 : -10.0 * log10(avg_error_prob);
+                seq_quals[total_seqs].readname = strdup(name);
+            }
+
+            total_seqs++;
         }
-        
-        total_seqs++;
+        if (p) t = profile_lap(p, PROF_COMPUTE, t);
+        if (hw) hwcount_lap(hw, &hws, PROF_COMPUTE);
+    }
+    // kseq gives -2 when the stream breaks inside a quality line
+    if (l == -2 && ks_err(seq->f)) l = -3;
+    free(b->buf);
+    free(b);
+    b = NULL;
+    progress_update(&pf, 0, 0, filter.seqs, filter.bases);
+    if (p) {
+        t = profile_lap(p, PROF_PARSE, t);
+        // kseq reads its input while parsing
+        p->seconds[PROF_PARSE] -= p->seconds[PROF_DECOMPRESS];
     }
 
     kseq_destroy(seq);
-    gzclose(fp);
+    seq = NULL;
+    progress_done(&pf, src.size);
+    if (l < -1) {
+        fprintf(stderr, "Error reading %s: %s, results may be incomplete\n", task->filepath,
+                l == -2 ? "malformed record" : fxsrc_error(&src));
+    }
+    fxsrc_close(&src);
+    opened = 0;
+    if (p) t = profile_lap(p, PROF_OPEN, t);
+    if (hw) hwcount_lap(hw, &hws, PROF_OPEN);
 
-    qsort(lengths, total_seqs, sizeof(unsigned), compare_desc);
+    if (radix_sort_u32_desc(lengths, total_seqs, 0) != 0) {
+        perror("malloc");
+        goto done;
+    }
 
     unsigned long sum = 0;
     unsigned long n50 = 0, n75 = 0, n90 = 0, i50 = 0;
@@ -222,12 +380,10 @@ void *process_file(void *arg) {
         if (!n90 && sum >= total_len * 0.90) n90 = lengths[i];
     }
 
-    result_t *res = malloc(sizeof(result_t));
+    res = malloc(sizeof(result_t));
     if (!res) {
         perror("malloc");
-        free(lengths);
-        free_seq_quals(seq_quals, total_seqs);
-        pthread_exit(NULL);
+        goto done;
     }
     realpath(task->filepath, res->filepath);
     if (task->basename) strcpy(res->filepath, basename(res->filepath));
@@ -237,25 +393,56 @@ void *process_file(void *arg) {
     res->n75 = n75;
     res->n90 = n90;
     res->i50 = i50;
-    res->gc_content = (double)gc_count / total_len * 100.0;
-    res->avg_len = (double)total_len / total_seqs;
-    res->min_len = min_len;
-    res->max_len = max_len;
     res->aun = calculate_auN(lengths, total_seqs, total_len);
-    res->total_quality = total_quality;
-    res->q20_count = q20_count;
-    res->q30_count = q30_count;
-    // Calculate average quality using logarithmic method: Q_avg = -10 * log10(P_avg)
-    double avg_error_prob = total_error_prob_sum / total_len;
-    res->avg_quality = (avg_error_prob == 0.0) ? 0.0 : -10.0 * log10(avg_error_prob);
-    res->q20_fraction = (double)q20_count / total_len;
-    res->q30_fraction = (double)q30_count / total_len;
+    res->total_quality = qs.total_quality;
+    res->q20_count = qs.q20_count;
+    res->q30_count = qs.q30_count;
+    // No read left, e.g. after a length filter: ratios and limits stay 0
+    res->gc_content = res->avg_len = res->avg_quality = res->q20_fraction = res->q30_fraction = 0.0;
+    res->min_len = res->max_len = 0;
+    if (total_seqs) {
+        res->avg_len = (double)total_len / total_seqs;
+        res->min_len = min_len;
+        res->max_len = max_len;
+    }
+    if (total_len) {
+        res->gc_content = (double)gc_count / total_len * 100.0;
+        // Calculate average quality using logarithmic method: Q_avg = -10 * log10(P_avg)
+        double avg_error_prob = total_error_prob_sum / total_len;
+        res->avg_quality = (avg_error_prob == 0.0) ? 0.0 : -10.0 * log10(avg_error_prob);
+        res->q20_fraction = (double)qs.q20_count / total_len;
+        res->q30_fraction = (double)qs.q30_count / total_len;
+    }
+    res->all_seqs = filter.seqs;
+    res->all_len = filter.bases;
+    res->failed = l < -1;
+    if (p) t = profile_lap(p, PROF_SORT, t);
+    if (hw) hwcount_lap(hw, &hws, PROF_SORT);
 
     // Write TSV output if requested
     if (task->output_file) {
         write_seq_qual_tsv(seq_quals, total_seqs, task->output_file);
     }
+    if (p) {
+        p->wall = profile_lap(p, PROF_FORMAT, t) - start;
+        p->seqs = filter.seqs;
+        p->bases = filter.bases;
+        res->prof = *p;
+    }
+    if (hw) {
+        hwcount_lap(hw, &hws, PROF_FORMAT);
+        res->hw = hws;
+    }
 
+done:
+    if (b) free(b->buf);
+    free(b);
+    if (seq) kseq_destroy(seq);
+    if (opened) {
+        progress_done(&pf, src.size);
+        fxsrc_close(&src);
+    }
+    if (hw) hwcount_close(hw);
     free(lengths);
     free_seq_quals(seq_quals, total_seqs);
 
@@ -266,50 +453,127 @@ void *process_file(void *arg) {
     pthread_exit(res);
 }
 
-void print_result(result_t *r, output_format_t fmt, int nice_output) {
+// Width of the Filepath column of the nice table with `num_cols` columns
+// including it, from the terminal width: at least 15 chars and at most 50
+int nice_filepath_width(int num_cols, int min_col_width) {
+    int reserved_width = (num_cols - 1) * min_col_width + (num_cols - 1); // space for separators
+    int filepath_width = get_terminal_width() - reserved_width;
+    if (filepath_width < 15) filepath_width = 15;
+    if (filepath_width > 50) filepath_width = 50;
+    return filepath_width;
+}
+
+// Column `c` of `r` as printed
+void column_value(const result_t *r, column_t c, char *buf, size_t len) {
+    unsigned long v = 0;
+    switch (c) {
+        case COL_TOTSEQS: v = r->total_seqs; break;
+        case COL_TOTLEN: v = r->total_len; break;
+        case COL_N50: v = r->n50; break;
+        case COL_N75: v = r->n75; break;
+        case COL_N90: v = r->n90; break;
+        case COL_I50: v = r->i50; break;
+        case COL_GC: snprintf(buf, len, "%.2f", r->gc_content); return;
+        case COL_AVG: snprintf(buf, len, "%.2f", r->avg_len); return;
+        case COL_MIN: v = r->min_len; break;
+        case COL_MAX: v = r->max_len; break;
+        case COL_AUN: v = r->aun; break;
+        case COL_AVGQUAL: snprintf(buf, len, "%.2f", r->avg_quality); return;
+        case COL_Q20: snprintf(buf, len, "%.2f", r->q20_fraction * 100.0); return;
+        case COL_Q30: snprintf(buf, len, "%.2f", r->q30_fraction * 100.0); return;
+        case COL_ALLSEQS: v = r->all_seqs; break;
+        case COL_ALLLEN: v = r->all_len; break;
+        default: break;
+    }
+    snprintf(buf, len, "%lu", v);
+}
+
+void print_header(const fields_t *f, int nice_output) {
     if (nice_output) {
-        int term_width = get_terminal_width();
-        // Calculate dynamic column widths based on terminal width
-        // Reserve minimum space for each column, adjust filepath width dynamically
         int min_col_width = 8;
-        int num_cols = 12; // total columns including filepath
-        int reserved_width = (num_cols - 1) * min_col_width + (num_cols - 1); // space for separators
-        int filepath_width = term_width - reserved_width;
-        
-        // Ensure filepath width is at least 15 chars and not more than 50
-        if (filepath_width < 15) filepath_width = 15;
-        if (filepath_width > 50) filepath_width = 50;
-        
-        printf("%-*s %*lu %*lu %*lu %*lu %*lu %*lu %*.2f %*.2f %*lu %*lu %*lu %*.2f %*.2f %*.2f\n",
-               filepath_width, r->filepath,
-               min_col_width, r->total_seqs,
-               min_col_width, r->total_len,
-               min_col_width, r->n50,
-               min_col_width, r->n75,
-               min_col_width, r->n90,
-               min_col_width, r->i50,
-               min_col_width, r->gc_content,
-               min_col_width, r->avg_len,
-               min_col_width, r->min_len,
-               min_col_width, r->max_len,
-               min_col_width, r->aun,
-               min_col_width, r->avg_quality,
-               min_col_width, r->q20_fraction * 100.0,
-               min_col_width, r->q30_fraction * 100.0);
+        printf("%-*s", nice_filepath_width(f->n + 1, min_col_width), "Filepath");
+        for (int i = 0; i < f->n; i++) printf(" %*s", min_col_width, column_names[f->col[i]]);
+    } else {
+        printf("Filepath");
+        for (int i = 0; i < f->n; i++) printf("\t%s", column_names[f->col[i]]);
+    }
+    printf("\n");
+}
+
+void print_result(result_t *r, const fields_t *f, output_format_t fmt, int nice_output) {
+    char value[64];
+    if (nice_output) {
+        // Columns are right-aligned, the filepath takes what the terminal has left
+        int min_col_width = 8;
+        printf("%-*s", nice_filepath_width(f->n + 1, min_col_width), r->filepath);
+        for (int i = 0; i < f->n; i++) {
+            column_value(r, f->col[i], value, sizeof(value));
+            printf(" %*s", min_col_width, value);
+        }
     } else {
         char sep = fmt == CSV ? ',' : '\t';
-        printf("%s%c%lu%c%lu%c%lu%c%lu%c%lu%c%lu%c%.2f%c%.2f%c%lu%c%lu%c%lu%c%.2f%c%.2f%c%.2f\n",
-               r->filepath, sep, r->total_seqs, sep, r->total_len, sep, r->n50, sep,
-               r->n75, sep, r->n90, sep, r->i50, sep, r->gc_content, sep,
-               r->avg_len, sep, r->min_len, sep, r->max_len, sep, r->aun, sep,
-               r->avg_quality, sep, r->q20_fraction * 100.0, sep, r->q30_fraction * 100.0);
+        printf("%s", r->filepath);
+        for (int i = 0; i < f->n; i++) {
+            column_value(r, f->col[i], value, sizeof(value));
+            printf("%c%s", sep, value);
+        }
     }
+    printf("\n");
 }
 
-void print_json_result(result_t *r, int is_first) {
+void print_json_result(result_t *r, const fields_t *f, int is_first) {
+    char value[64];
     if (!is_first) printf(",\n");
-    printf("  {\"File\":\"%s\",\"TotSeqs\":%lu,\"TotLen\":%lu,\"N50\":%lu,\"N75\":%lu,\"N90\":%lu,\"I50\":%lu,\"GC\":%.2f,\"Avg\":%.2f,\"Min\":%lu,\"Max\":%lu,\"AuN\":%lu,\"AvgQual\":%.2f,\"Q20\":%.2f,\"Q30\":%.2f}",
-           r->filepath, r->total_seqs, r->total_len, r->n50, r->n75, r->n90, r->i50, r->gc_content, r->avg_len, r->min_len, r->max_len, r->aun, r->avg_quality, r->q20_fraction * 100.0, r->q30_fraction * 100.0);
+    printf("  {\"File\":\"%s\"", r->filepath);
+    for (int i = 0; i < f->n; i++) {
+        column_value(r, f->col[i], value, sizeof(value));
+        printf(",\"%s\":%s", column_names[f->col[i]], value);
+    }
+    printf("}");
+}
+
+// A length limit of --min-len or --max-len: returns 0, or -1 if `arg` is not one
+int parse_len(const char *arg, uint64_t *len) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(arg, &end, 10);
+    if (errno || end == arg || *end || *arg == '-') return -1;
+    *len = v;
+    return 0;
+}
+
+// Columns of --fields, a comma-separated list of names in any case: returns 0,
+// or -1 with a message if a name is unknown or given twice
+int parse_fields(const char *arg, fields_t *f) {
+    f->n = 0;
+    const char *p = arg;
+    for (;;) {
+        size_t len = strcspn(p, ",");
+        int c = 0;
+        while (c < COLS && (strlen(column_names[c]) != len || strncasecmp(p, column_names[c], len) != 0)) c++;
+        if (c == COLS) {
+            fprintf(stderr, "Error: unknown field '%.*s' in --fields, expected some of", (int)len, p);
+            for (int i = 0; i < COLS; i++) fprintf(stderr, "%s%s", i ? "," : " ", column_names[i]);
+            fprintf(stderr, "\n");
+            return -1;
+        }
+        for (int i = 0; i < f->n; i++) {
+            if (f->col[i] == (column_t)c) {
+                fprintf(stderr, "Error: field %s is given twice in --fields\n", column_names[c]);
+                return -1;
+            }
+        }
+        f->col[f->n++] = (column_t)c;
+        if (!p[len]) return 0;
+        p += len + 1;
+    }
+}
+
+int fields_has(const fields_t *f, column_t c) {
+    for (int i = 0; i < f->n; i++) {
+        if (f->col[i] == c) return 1;
+    }
+    return 0;
 }
 
 void print_help(const char *progname) {
@@ -325,10 +589,23 @@ void print_help(const char *progname) {
     printf("  -n, --nice      Output results in a visually aligned ASCII table\n");
     printf("  -o, --output FILE  Save per-sequence data (readname, length, avg_qual) to TSV file\n");
     printf("  --offset INT    Phred quality score offset (default: 33)\n");
+    printf("  --hwcounters    Count cycles, instructions, cache and branch misses of the\n");
+    printf("                  decompress, parse, compute and sort phases (Linux perf events)\n");
+    printf("  --profile[=J]   Print the time of each phase, throughput and peak memory of\n");
+    printf("                  every file to STDERR, or as JSON to the file J\n");
+    printf("  --progress[=S]  Print the progress, throughput and time left to STDERR every\n");
+    printf("                  S seconds (default: 1)\n");
+    printf("  --min-len N     Only count reads of at least N bases\n");
+    printf("  --max-len N     Only count reads of at most N bases; with either option\n");
+    printf("                  AllSeqs and AllLen give the totals before filtering\n");
+    printf("  --fields LIST   Only print the columns in LIST, comma-separated and in that\n");
+    printf("                  order (e.g. TotSeqs,N50,Q30); qualities are only read for\n");
+    printf("                  AvgQual, Q20 and Q30, bases only for GC\n");
     printf("  -h, --help      Show this help message and exit\n");
     printf("  -v, --version   Show version number and exit\n\n");
     printf("Output Columns (TSV/CSV):\n");
-    printf("  Filepath, TotSeqs, TotLen, N50, N75, N90, I50, GC, Avg, Min, Max, AuN, AvgQual, Q20, Q30\n\n");
+    printf("  Filepath, TotSeqs, TotLen, N50, N75, N90, I50, GC, Avg, Min, Max, AuN, AvgQual, Q20, Q30\n");
+    printf("  [AllSeqs, AllLen with --min-len or --max-len]; --fields picks others after Filepath\n\n");
 }
 
 int main(int argc, char *argv[]) {
@@ -338,6 +615,13 @@ int main(int argc, char *argv[]) {
     int nice_output = 0;
     int qual_offset = 33;
     char *output_file = NULL;
+    int profile = 0;
+    const char *profile_path = NULL;
+    int hwcounters = 0;
+    double progress = 0.0;
+    uint64_t min_len = 0, max_len = UINT64_MAX;
+    int filtered = 0;
+    const char *fields_arg = NULL;
 
     static struct option long_opts[] = {
         {"abs", no_argument, 0, 'a'},
@@ -347,6 +631,12 @@ int main(int argc, char *argv[]) {
         {"nice", no_argument, 0, 'n'},
         {"output", required_argument, 0, 'o'},
         {"offset", required_argument, 0, 'O'},
+        {"profile", optional_argument, 0, OPT_PROFILE},
+        {"hwcounters", no_argument, 0, OPT_HWCOUNTERS},
+        {"progress", optional_argument, 0, OPT_PROGRESS},
+        {"min-len", required_argument, 0, OPT_MIN_LEN},
+        {"max-len", required_argument, 0, OPT_MAX_LEN},
+        {"fields", required_argument, 0, OPT_FIELDS},
         {"help", no_argument, 0, 'h'},
         {"version", no_argument, 0, 'v'},
         {0, 0, 0, 0}
@@ -361,52 +651,94 @@ int main(int argc, char *argv[]) {
             case 'n': nice_output = 1; basename_flag = 1; break;
             case 'o': output_file = optarg; break;
             case 'O': qual_offset = atoi(optarg); break;
+            case OPT_PROFILE:
+                profile = 1;
+                profile_path = optarg;
+                break;
+            case OPT_HWCOUNTERS: hwcounters = 1; break;
+            case OPT_PROGRESS:
+                progress = optarg ? atof(optarg) : 1.0;
+                if (progress <= 0) {
+                    fprintf(stderr, "Error: --progress must be a positive number of seconds\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_MIN_LEN:
+            case OPT_MAX_LEN:
+                if (parse_len(optarg, opt == OPT_MIN_LEN ? &min_len : &max_len) != 0) {
+                    fprintf(stderr, "Error: --%s must be a number of bases\n", opt == OPT_MIN_LEN ? "min-len" : "max-len");
+                    exit(EXIT_FAILURE);
+                }
+                filtered = 1;
+                break;
+            case OPT_FIELDS: fields_arg = optarg; break;
             case 'h': print_help(argv[0]); exit(0);
             case 'v': printf("%s\n", VERSION); exit(0);
             default: exit(EXIT_FAILURE);
         }
     }
 
+    if (min_len > max_len) {
+        fprintf(stderr, "Error: --min-len is above --max-len, no sequence can be kept\n");
+        return 1;
+    }
+
     int files = argc - optind;
     if (files < 1) {
         fprintf(stderr, "Usage: %s [options] FILES...\n", argv[0]);
         return 1;
     }
 
-    if (output_format == TSV) {
-        if (nice_output) {
-            int term_width = get_terminal_width();
-            int min_col_width = 8;
-            int num_cols = 12;
-            int reserved_width = (num_cols - 1) * min_col_width + (num_cols - 1);
-            int filepath_width = term_width - reserved_width;
-            
-            if (filepath_width < 15) filepath_width = 15;
-            if (filepath_width > 50) filepath_width = 50;
-            
-            printf("%-*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s\n",
-                   filepath_width, "Filepath",
-                   min_col_width, "TotSeqs",
-                   min_col_width, "TotLen",
-                   min_col_width, "N50",
-                   min_col_width, "N75",
-                   min_col_width, "N90",
-                   min_col_width, "I50",
-                   min_col_width, "GC",
-                   min_col_width, "Avg",
-                   min_col_width, "Min",
-                   min_col_width, "Max",
-                   min_col_width, "AuN",
-                   min_col_width, "AvgQual",
-                   min_col_width, "Q20",
-                   min_col_width, "Q30");
-        } else {
-            printf("Filepath\tTotSeqs\tTotLen\tN50\tN75\tN90\tI50\tGC\tAvg\tMin\tMax\tAuN\tAvgQual\tQ20\tQ30\n");
+    // Every column by default, the totals before filtering only with a filter
+    fields_t fields;
+    if (fields_arg) {
+        if (parse_fields(fields_arg, &fields) != 0) return 1;
+    } else {
+        fields.n = 0;
+        for (int c = 0; c < COLS; c++) {
+            if (filtered || (c != COL_ALLSEQS && c != COL_ALLLEN)) fields.col[fields.n++] = (column_t)c;
+        }
+    }
+    int compose = fields_has(&fields, COL_GC);
+    int error_probs = fields_has(&fields, COL_AVGQUAL) || output_file;
+    int quals = error_probs || fields_has(&fields, COL_Q20) || fields_has(&fields, COL_Q30);
+
+    if (output_format == TSV) print_header(&fields, nice_output);
+
+    profile_report_t report;
+    if (profile && profile_open(&report, profile_path) != 0) {
+        fprintf(stderr, "Error creating profile %s\n", profile_path);
+        return 1;
+    }
+
+    hwcount_sum_t hw_total;
+    memset(&hw_total, 0, sizeof(hw_total));
+    if (hwcounters) {
+        hwcount_t probe;
+        if (hwcount_open(&probe) != 0) {
+            fprintf(stderr, "Warning: hardware counters are not available (%s)\n", strerror(errno));
+            hwcounters = 0;
+        }
+        hwcount_close(&probe);
+    }
+
+    if (progress) {
+        // Percentages need the size of every input, unknown as soon as one is not a regular file
+        uint64_t total = 0;
+        for (int i = optind; i < argc; i++) {
+            struct stat st;
+            if (strcmp(argv[i], "-") == 0 || stat(argv[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+                total = 0;
+                break;
+            }
+            total += st.st_size;
         }
+        if (progress_start(total, files, progress) != 0) fprintf(stderr, "Warning: cannot start the progress reporter\n");
     }
 
     result_t **all_results = NULL;
     int total_results = 0;
+    int failed = 0;     // inputs that could not be opened, were rejected or not read to the end
 
     if (output_format == JSON) {
         all_results = malloc(files * sizeof(result_t*));
@@ -416,6 +748,10 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // Cores left over when there are fewer files than cores
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int file_threads = cores > files ? (int)(cores / files) : 1;
+
     pthread_t threads[MAX_THREADS];
     int running_threads = 0;
     for (int i = optind; i < argc; i++) {
@@ -427,6 +763,14 @@ int main(int argc, char *argv[]) {
         t->nice_output = nice_output;
         t->qual_offset = qual_offset;
         t->output_file = output_file;
+        t->threads = file_threads;
+        t->profile = profile;
+        t->hwcounters = hwcounters;
+        t->min_len = min_len;
+        t->max_len = max_len;
+        t->compose = compose;
+        t->quals = quals;
+        t->error_probs = error_probs;
 
         pthread_mutex_lock(&thread_mutex);
         while (num_threads >= MAX_THREADS) {
@@ -442,13 +786,23 @@ int main(int argc, char *argv[]) {
             for (int j = 0; j < running_threads; j++) {
                 void *res;
                 pthread_join(threads[j], &res);
-                if (res) {
-                    if (output_format == JSON) {
-                        all_results[total_results++] = (result_t *)res;
-                    } else {
-                        print_result((result_t *)res, output_format, nice_output);
-                        free(res);
+                if (!res) {
+                    failed++;
+                    continue;
+                }
+                failed += ((result_t *)res)->failed;
+                if (hwcounters) hwcount_add(&hw_total, &((result_t *)res)->hw);
+                if (output_format == JSON) {
+                    all_results[total_results++] = (result_t *)res;
+                } else {
+                    result_t *r = (result_t *)res;
+                    double format_start = profile ? profile_now() : 0.0;
+                    print_result(r, &fields, output_format, nice_output);
+                    if (profile) {
+                        r->prof.wall += profile_lap(&r->prof, PROF_FORMAT, format_start) - format_start;
+                        profile_file(&report, r->filepath, &r->prof);
                     }
+                    free(res);
                 }
             }
             running_threads = 0;
@@ -458,12 +812,28 @@ int main(int argc, char *argv[]) {
     if (output_format == JSON) {
         printf("[\n");
         for (int i = 0; i < total_results; i++) {
-            print_json_result(all_results[i], i == 0);
-            free(all_results[i]);
+            result_t *r = all_results[i];
+            double format_start = profile ? profile_now() : 0.0;
+            print_json_result(r, &fields, i == 0);
+            if (profile) {
+                r->prof.wall += profile_lap(&r->prof, PROF_FORMAT, format_start) - format_start;
+                profile_file(&report, r->filepath, &r->prof);
+            }
+            free(r);
         }
         printf("\n]\n");
         free(all_results);
     }
+    fflush(stdout);
+    progress_stop();
+    if (profile) {
+        fflush(stdout);
+        profile_close(&report);
+    }
+    if (hwcounters) {
+        fflush(stdout);
+        hwcount_print(stderr, &hw_total);
+    }
 
-    return 0;
+    return failed ? 1 : 0;
 }
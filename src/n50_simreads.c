@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <limits.h>
+#include <stdint.h>
 
 #define MAX_ARGS 100 // Maximum number of arguments
 #define MAX_PATH 1024 // Maximum path length
@@ -26,12 +27,12 @@ const char bases[] = "ACGTactAC";
     Filename format: N50_TOTALSEQS_TOTLENGTH.fasta/fastq
 */
 // Function to generate a random DNA sequence
-void generate_sequence(char *seq, int length) {
-    if (!seq || length < 0) {
+void generate_sequence(char *seq, size_t length) {
+    if (!seq) {
         return;
     }
     
-    for (int i = 0; i < length; i++) {
+    for (size_t i = 0; i < length; i++) {
         seq[i] = bases[rand() % (sizeof(bases) - 1)];  // -1 to exclude null terminator
     }
     seq[length] = '\0';
@@ -39,8 +40,8 @@ void generate_sequence(char *seq, int length) {
 
 
 // Function to generate a random quality string
-void generate_quality(char *qual, int length) {
-    for (int i = 0; i < length; i++) {
+void generate_quality(char *qual, size_t length) {
+    for (size_t i = 0; i < length; i++) {
         qual[i] = 33 + (rand() % 41); // ASCII 33 to 73
     }
     qual[length] = '\0';
@@ -247,9 +248,18 @@ int main(int argc, char *argv[]) {
             continue;
         }
 
-        long long count = atoll(count_str);
+        char *endptr;
+        long long count = strtoll(count_str, &endptr, 10);
+        if (endptr == count_str || *endptr != '\0' || count <= 0) {
+            fprintf(stderr, "Invalid count: %s\n", count_str);
+            free(arg);
+            goto cleanup;
+        }
         long long size = parse_size(size_str);
         free(arg);
+        if (size < 0 || (size_t)size >= SIZE_MAX) {
+            goto cleanup;
+        }
 
 
     if (size > max_seq_length) {
@@ -316,24 +326,30 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    int last_length = 0;
-    for (int i = 0; i < total_seqs; i++) {
-        if (lengths[i] != last_length) {
-            last_length = lengths[i];
-        }
-
-        generate_sequence(sequence, lengths[i]);
+    for (long long i = 0; i < total_seqs; i++) {
+        size_t length = (size_t)lengths[i];
+        generate_sequence(sequence, length);
         if (verbose && i % 1000 == 0) {
-            fprintf(stderr, " Generating seq #%d (%lld bp)\r", i, lengths[i]);
+            fprintf(stderr, " Generating seq #%lld (%lld bp)\r", i, lengths[i]);
         }
         
+        // fprintf() cannot write more than INT_MAX bytes at once: the sequence
+        // and quality are written with fwrite()
+        fprintf(outfile, "%cSimulated_read_%lld len=%lld\n", is_fastq ? '@' : '>', i+1, lengths[i]);
+        fwrite(sequence, 1, length, outfile);
         if (is_fastq) {
-            generate_quality(quality, lengths[i]);
-            fprintf(outfile, "@Simulated_read_%d len=%lld\n%s\n+\n%s\n", i+1, lengths[i], sequence, quality);
-        } else {
-            fprintf(outfile, ">Simulated_read_%d len=%lld\n%s\n", i+1, lengths[i], sequence);
+            generate_quality(quality, length);
+            fputs("\n+\n", outfile);
+            fwrite(quality, 1, length, outfile);
         }
+        fputc('\n', outfile);
+    }
+    if (ferror(outfile) || fclose(outfile) != 0) {
+        outfile = NULL;
+        fprintf(stderr, "Failed to write output file: %s\n", filename);
+        goto cleanup;
     }
+    outfile = NULL;
 
     fprintf(stderr, "\n");
     printf("Output written to: %s\n", filename);
@@ -35,6 +35,10 @@
 #include <ctype.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "nxselect.h"
+#include "fxsrc.h"
 
 #define BUFFER_SIZE 1024 * 1024  // 1MB buffer
 #define MAX_THREADS 8
@@ -52,10 +56,6 @@ int length_count = 0;
 int length_capacity = INITIAL_CAPACITY;
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
-int compare(const void *a, const void *b) {
-    return (*(int*)b - *(int*)a);
-}
-
 void *process_chunk(void *arg) {
     ThreadData *data = (ThreadData*)arg;
     for (int i = data->start; i < data->end; i++) {
@@ -71,7 +71,7 @@ void *process_chunk(void *arg) {
     return NULL;
 }
 
-void process_fasta(gzFile fp) {
+void process_fasta(fxsrc_t *src) {
     char buffer[BUFFER_SIZE];
     long long *chunk_lengths = NULL;
     int chunk_count = 0;
@@ -80,7 +80,7 @@ void process_fasta(gzFile fp) {
 
     chunk_lengths = malloc(chunk_capacity * sizeof(long long));
 
-    while (gzgets(fp, buffer, BUFFER_SIZE) != NULL) {
+    while (fxsrc_gets(src, buffer, BUFFER_SIZE) != NULL) {
         if (buffer[0] == '>') {
             if (current_length > 0) {
                 if (chunk_count == chunk_capacity) {
@@ -127,7 +127,7 @@ void process_fasta(gzFile fp) {
     free(chunk_lengths);
 }
 
-void process_fastq(gzFile fp) {
+void process_fastq(fxsrc_t *src) {
     char buffer[BUFFER_SIZE];
     int line_count = 0;
     long long *chunk_lengths = NULL;
@@ -136,7 +136,7 @@ void process_fastq(gzFile fp) {
 
     chunk_lengths = malloc(chunk_capacity * sizeof(long long));
 
-    while (gzgets(fp, buffer, BUFFER_SIZE) != NULL) {
+    while (fxsrc_gets(src, buffer, BUFFER_SIZE) != NULL) {
         line_count++;
         if (line_count % 4 == 2) {  // Sequence line
             int len = strcspn(buffer, "\n");  // Count characters until newline
@@ -188,7 +188,7 @@ bool is_fastq_filename(const char *filename) {
 }
 
 int main(int argc, char *argv[]) {
-      gzFile fp;
+      fxsrc_t src;
     bool is_fastq = false;
     bool opt_header = false;
     bool opt_n50 = false;
@@ -233,39 +233,27 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (filename) {
-        fp = gzopen(filename, "r");
-        if (!fp) {
-            fprintf(stderr, "Error: Cannot open file %s\n", filename);
-            return 1;
-        }
-    } else {
-        fp = gzdopen(fileno(stdin), "r");
+    if (fxsrc_open(&src, filename ? filename : "-", 1) != 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", filename ? filename : "STDIN");
+        return 1;
     }
 
     lengths = malloc(length_capacity * sizeof(int));
 
     if (is_fastq) {
-        process_fastq(fp);
+        process_fastq(&src);
     } else {
-        process_fasta(fp);
+        process_fasta(&src);
     }
 
-    gzclose(fp);
-
-    // Sort lengths in descending order
-    qsort(lengths, length_count, sizeof(int), compare);
+    fxsrc_close(&src);
 
-    // Calculate N50
-    long long cumulative_length = 0;
-    long long half_total_length = total_length / 2;
+    // Calculate N50 by selection, without sorting (lengths are never negative)
+    double half_total_length = (double)(total_length / 2);
+    nx_hit_t hit;
     int n50 = 0;
-    for (int i = 0; i < length_count; i++) {
-        cumulative_length += lengths[i];
-        if (cumulative_length >= half_total_length) {
-            n50 = lengths[i];
-            break;
-        }
+    if (nx_select_u32((uint32_t *)lengths, length_count, &half_total_length, &hit, 1) == 1) {
+        n50 = (int)hit.len;
     }
     
     if (opt_header && !opt_n50) {
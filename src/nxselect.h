@@ -0,0 +1,94 @@
+/*
+ * nxselect.h - Nx statistics without sorting the lengths
+ *
+ * N50 only needs the length at which the cumulative sum of the lengths,
+ * taken longest first, reaches half of the total. A weighted quickselect
+ * finds it in expected O(n): partition around a pivot into longer, equal
+ * and shorter lengths, and keep only the side where the cumulative sum
+ * crosses the target, carrying the sum of everything known to be longer.
+ *
+ * Several targets (e.g. 50%, 75%, 90% of the total) are resolved in one
+ * call, in ascending order: each search resumes where the previous one
+ * stopped, since everything on its left is longer than what is left.
+ * Results are identical to a descending sort followed by a cumulative scan
+ * with `sum >= target`. The array is reordered.
+ */
+#ifndef N50_NXSELECT_H
+#define N50_NXSELECT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "lenhist.h"
+
+typedef struct {
+    uint64_t len;       // Nx value
+    uint64_t index;     // number of sequences needed to reach the target (e.g. I50)
+} nx_hit_t;
+
+static inline void nx_swap_u32(uint32_t *a, size_t i, size_t j) {
+    uint32_t t = a[i];
+    a[i] = a[j];
+    a[j] = t;
+}
+
+// Median of three spread out candidates, the segment is [lo, hi)
+static inline uint32_t nx_pivot_u32(const uint32_t *a, size_t lo, size_t hi, uint64_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    uint32_t x = a[lo], y = a[lo + *seed % (hi - lo)], z = a[hi - 1];
+    if (x > y) { uint32_t t = x; x = y; y = t; }
+    if (y > z) y = z;
+    return x > y ? x : y;
+}
+
+// `targets` must be sorted ascending. Returns the number of targets resolved
+// (all of them unless a target exceeds the total length).
+static inline int nx_select_u32(uint32_t *a, size_t n, const double *targets, nx_hit_t *hits, int ntargets) {
+    size_t lo = 0;
+    uint64_t above = 0;        // sum of a[0, lo), all longer than anything in a[lo, n)
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    int found = 0;
+
+    for (int t = 0; t < ntargets; t++) {
+        double target = targets[t];
+        size_t hi = n;
+        int done = 0;
+        while (lo < hi && !done) {
+            uint32_t p = nx_pivot_u32(a, lo, hi, &seed);
+            // Three-way partition: [lo, gt) > p, [gt, lt) == p, [lt, hi) < p
+            size_t gt = lo, i = lo, lt = hi;
+            uint64_t sum_gt = 0;
+            while (i < lt) {
+                if (a[i] > p) {
+                    sum_gt += a[i];
+                    nx_swap_u32(a, gt++, i++);
+                } else if (a[i] < p) {
+                    nx_swap_u32(a, i, --lt);
+                } else {
+                    i++;
+                }
+            }
+            uint64_t neq = lt - gt;
+            if (gt > lo && (double)(above + sum_gt) >= target) {
+                hi = gt;
+            } else if (neq && (double)(above + sum_gt + neq * p) >= target) {
+                hits[t].len = p;
+                hits[t].index = gt + lenhist_reach(above + sum_gt, p, neq, target);
+                // The next target resumes from the run of equal lengths
+                lo = gt;
+                above += sum_gt;
+                done = 1;
+            } else {
+                above += sum_gt + neq * p;
+                lo = lt;
+            }
+        }
+        if (!done) break;
+        found++;
+    }
+    return found;
+}
+
+#endif
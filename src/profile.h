@@ -0,0 +1,176 @@
+/*
+ * profile.h - where the time of a run goes (--profile)
+ *
+ * A slow run can be slow in very different places: inflating, finding
+ * records, counting bases, sorting lengths or printing. With --profile every
+ * file gets the seconds spent in each phase, its size on disk and
+ * decompressed, its throughput and the peak resident memory of the process
+ * so far, as a table on stderr or as JSON in a file. Phases are timed with
+ * the monotonic clock around each stage; the reads of the input are timed
+ * by a read callback wrapped around the real one, so decompression (and
+ * disk I/O) is told apart from parsing without touching the parsers. The
+ * same wrapper records the reads as spans when tracing (trace.h).
+ *
+ * When a file is read by several threads, the stages overlap: decompress is
+ * then the time the reader thread spent waiting for data, and parse is the
+ * wall time of the whole pipeline, with compute included.
+ *
+ *   profile_now()       monotonic clock, in seconds
+ *   profile_lap()       add the time since `t` to a phase, return the time now
+ *   profile_read()      fxscan_read_fn that times another one
+ *   profile_kread()     the same with the signature kseq expects
+ *   profile_peak_rss()  peak resident memory of the process, in KB
+ *   profile_open()      start a report, on stderr or as JSON in a file
+ *   profile_file()      add the row of one file to a report
+ *   profile_close()     add the totals and finish the report
+ */
+#ifndef N50_PROFILE_H
+#define N50_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "fxscan.h"
+#include "trace.h"
+
+typedef enum {
+    PROF_OPEN,
+    PROF_DECOMPRESS,
+    PROF_PARSE,
+    PROF_COMPUTE,
+    PROF_SORT,
+    PROF_FORMAT,
+    PROF_PHASES
+} profile_phase_t;
+
+static const char *const profile_phase_names[PROF_PHASES] = {
+    "open", "decompress", "parse", "compute", "sort", "format"
+};
+
+typedef struct {
+    double seconds[PROF_PHASES];
+    double wall;            // elapsed, less than the sum of phases that overlap
+    uint64_t in_bytes;      // size on disk, compressed for gzip (0 for STDIN)
+    uint64_t bytes;         // bytes parsed, after decompression
+    uint64_t seqs;
+    uint64_t bases;
+} profile_t;
+
+typedef struct {
+    FILE *fp;
+    int json;
+    int rows;
+    double start;
+    profile_t total;
+} profile_report_t;
+
+static inline double profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline double profile_lap(profile_t *p, profile_phase_t phase, double t) {
+    double now = profile_now();
+    p->seconds[phase] += now - t;
+    return now;
+}
+
+// A read callback and its context; with `prof` NULL and tracing off reads are only passed on
+typedef struct {
+    fxscan_read_fn read;
+    void *ctx;
+    profile_t *prof;
+} profile_reader_t;
+
+static inline long profile_read(void *arg, char *buf, size_t cap) {
+    profile_reader_t *r = (profile_reader_t *)arg;
+    if (!r->prof && !trace_on) return r->read(r->ctx, buf, cap);
+    uint64_t span = trace_now();
+    double t = r->prof ? profile_now() : 0.0;
+    long n = r->read(r->ctx, buf, cap);
+    trace_span("read", span);
+    if (r->prof) {
+        profile_lap(r->prof, PROF_DECOMPRESS, t);
+        if (n > 0) r->prof->bytes += n;
+    }
+    return n;
+}
+
+static inline int profile_kread(profile_reader_t *r, void *buf, int size) {
+    return (int)profile_read(r, (char *)buf, size);
+}
+
+static inline long profile_peak_rss(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;     // bytes on macOS
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+static inline void profile_row(profile_report_t *r, const char *name, const profile_t *p, double wall) {
+    double mb_s = wall > 0 ? p->bytes / wall / 1e6 : 0.0;
+    double seqs_s = wall > 0 ? p->seqs / wall : 0.0;
+    long rss = profile_peak_rss();
+    if (r->json) {
+        fprintf(r->fp, "{\"file\":\"%s\"", name);
+        for (int i = 0; i < PROF_PHASES; i++) fprintf(r->fp, ",\"%s\":%.6f", profile_phase_names[i], p->seconds[i]);
+        fprintf(r->fp, ",\"wall\":%.6f,\"in_bytes\":%llu,\"bytes\":%llu,\"seqs\":%llu,\"bases\":%llu,\"mb_per_s\":%.2f,\"seqs_per_s\":%.0f,\"peak_rss_kb\":%ld}",
+                wall, (unsigned long long)p->in_bytes, (unsigned long long)p->bytes, (unsigned long long)p->seqs,
+                (unsigned long long)p->bases, mb_s, seqs_s, rss);
+    } else {
+        fprintf(r->fp, "%s", name);
+        for (int i = 0; i < PROF_PHASES; i++) fprintf(r->fp, "\t%.6f", p->seconds[i]);
+        fprintf(r->fp, "\t%.6f\t%llu\t%llu\t%.2f\t%.0f\t%ld\n", wall, (unsigned long long)p->in_bytes,
+                (unsigned long long)p->bytes, mb_s, seqs_s, rss);
+    }
+}
+
+// Report to `path`, or to stderr as a table if `path` is NULL. Returns 0, or -1 if it cannot be created.
+static inline int profile_open(profile_report_t *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->start = profile_now();
+    r->json = path != NULL;
+    r->fp = path ? fopen(path, "w") : stderr;
+    if (!r->fp) return -1;
+    if (r->json) {
+        fprintf(r->fp, "{\"files\":[\n");
+    } else {
+        fprintf(r->fp, "Profile\tOpen\tDecompress\tParse\tCompute\tSort\tFormat\tWall\tInBytes\tBytes\tMB/s\tSeqs/s\tPeakRSS_KB\n");
+    }
+    return 0;
+}
+
+static inline void profile_file(profile_report_t *r, const char *name, const profile_t *p) {
+    if (r->json && r->rows) fprintf(r->fp, ",\n");
+    if (r->json) fprintf(r->fp, "  ");
+    profile_row(r, name, p, p->wall);
+    r->rows++;
+    for (int i = 0; i < PROF_PHASES; i++) r->total.seconds[i] += p->seconds[i];
+    r->total.in_bytes += p->in_bytes;
+    r->total.bytes += p->bytes;
+    r->total.seqs += p->seqs;
+    r->total.bases += p->bases;
+}
+
+// Totals add up the phases of all files; their wall time and throughput are those of the run
+static inline void profile_close(profile_report_t *r) {
+    double wall = profile_now() - r->start;
+    if (r->json) {
+        fprintf(r->fp, "%s],\n\"total\":", r->rows ? "\n" : "");
+        profile_row(r, "total", &r->total, wall);
+        fprintf(r->fp, "}\n");
+    } else {
+        profile_row(r, "total", &r->total, wall);
+    }
+    if (r->fp != stderr) fclose(r->fp);
+    else fflush(stderr);
+}
+
+#endif
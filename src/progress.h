@@ -0,0 +1,223 @@
+/*
+ * progress.h - live progress of a long run on stderr (--progress)
+ *
+ * A 200 GB gzip file takes an hour, and until now said nothing meanwhile.
+ * With --progress a reporter thread wakes up at a fixed interval and prints
+ * how much of the input is consumed (bytes on disk, so compressed bytes for
+ * gzip) out of the total size of the inputs, the throughput since the last
+ * report (decompressed MB/s, reads/s, bases/s) and the time left at the
+ * average rate so far. A run stuck on slow storage shows 0 MB/s, which a
+ * scheduler can act on.
+ *
+ * The counters are relaxed atomics, added to per block read, per batch of
+ * records and per file, never per record: the read callback wrapped around
+ * a source publishes its position in the file (fxsrc_offset()), the record
+ * loops publish their counts every PROGRESS_BATCH records, and fxpipe.h
+ * publishes them per batch it merges. With progress off every call returns
+ * at once.
+ *
+ *   progress_start()  start the reporter for inputs of `total` bytes (0 if unknown)
+ *   progress_add()    add input consumed, bytes, records and bases to the run
+ *   progress_file()   start publishing the progress of one source
+ *   progress_update() publish what a source consumed and counted so far
+ *   progress_read()   fxscan_read_fn that publishes the position of the source
+ *   progress_kread()  the same with the signature kseq expects
+ *   progress_done()   a file is finished or skipped, the rest of it is consumed
+ *   progress_stop()   print the last report and stop the reporter
+ */
+#ifndef N50_PROGRESS_H
+#define N50_PROGRESS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "fxsrc.h"
+
+#define PROGRESS_BATCH 4096     // records between updates of a record loop (a power of 2)
+
+typedef struct {
+    _Atomic uint64_t in;        // bytes of the files on disk consumed
+    _Atomic uint64_t bytes;     // bytes parsed, after decompression
+    _Atomic uint64_t seqs;
+    _Atomic uint64_t bases;
+    _Atomic int done;           // files finished
+    uint64_t total;             // size of all the inputs, 0 if unknown
+    int files;
+    double interval;            // seconds between reports
+    double start;
+    int tty;                    // stderr is a terminal: rewrite one line
+    int quit;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} progress_t;
+
+// What one source has published so far
+typedef struct {
+    fxsrc_t *src;
+    uint64_t in, bytes, seqs, bases;
+} progress_file_t;
+
+// Set by progress_start() before threads exist, only read afterwards
+static int progress_on;
+static progress_t progress_run;
+
+static inline double progress_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void progress_add(uint64_t in, uint64_t bytes, uint64_t seqs, uint64_t bases) {
+    if (!progress_on) return;
+    if (in) atomic_fetch_add_explicit(&progress_run.in, in, memory_order_relaxed);
+    if (bytes) atomic_fetch_add_explicit(&progress_run.bytes, bytes, memory_order_relaxed);
+    if (seqs) atomic_fetch_add_explicit(&progress_run.seqs, seqs, memory_order_relaxed);
+    if (bases) atomic_fetch_add_explicit(&progress_run.bases, bases, memory_order_relaxed);
+}
+
+static inline void progress_file(progress_file_t *f, fxsrc_t *src) {
+    memset(f, 0, sizeof(*f));
+    f->src = src;
+}
+
+// Values below those published before are ignored
+static inline void progress_update(progress_file_t *f, uint64_t in, uint64_t bytes, uint64_t seqs, uint64_t bases) {
+    if (!progress_on) return;
+    progress_add(in > f->in ? in - f->in : 0, bytes > f->bytes ? bytes - f->bytes : 0,
+                 seqs > f->seqs ? seqs - f->seqs : 0, bases > f->bases ? bases - f->bases : 0);
+    if (in > f->in) f->in = in;
+    if (bytes > f->bytes) f->bytes = bytes;
+    if (seqs > f->seqs) f->seqs = seqs;
+    if (bases > f->bases) f->bases = bases;
+}
+
+static inline long progress_read(void *arg, char *buf, size_t cap) {
+    progress_file_t *f = (progress_file_t *)arg;
+    long n = fxsrc_read(f->src, buf, cap);
+    if (n > 0) progress_update(f, fxsrc_offset(f->src), f->bytes + n, f->seqs, f->bases);
+    return n;
+}
+
+static inline int progress_kread(progress_file_t *f, void *buf, int size) {
+    return (int)progress_read(f, (char *)buf, size);
+}
+
+// `size` is the size of the file on disk; `f` may be NULL for a file that was not read
+static inline void progress_done(progress_file_t *f, uint64_t size) {
+    if (!progress_on) return;
+    uint64_t in = f ? f->in : 0;
+    progress_add(size > in ? size - in : 0, 0, 0, 0);
+    if (f && size > f->in) f->in = size;
+    atomic_fetch_add_explicit(&progress_run.done, 1, memory_order_relaxed);
+}
+
+static inline void progress_size(char *buf, size_t len, double bytes) {
+    if (bytes >= 1e9) snprintf(buf, len, "%.2f GB", bytes / 1e9);
+    else snprintf(buf, len, "%.1f MB", bytes / 1e6);
+}
+
+// One report: rates over `dt` seconds since the counts in `last`, and the time left at the average rate
+static inline void progress_print(progress_t *p, uint64_t last[4], double dt, double elapsed, int final) {
+    uint64_t now[4] = {
+        atomic_load_explicit(&p->in, memory_order_relaxed),
+        atomic_load_explicit(&p->bytes, memory_order_relaxed),
+        atomic_load_explicit(&p->seqs, memory_order_relaxed),
+        atomic_load_explicit(&p->bases, memory_order_relaxed)
+    };
+    int done = atomic_load_explicit(&p->done, memory_order_relaxed);
+    char in[32], total[32];
+    progress_size(in, sizeof(in), now[0]);
+    progress_size(total, sizeof(total), p->total);
+    if (p->tty) fputs("\r\033[K", stderr);
+    if (p->total) {
+        fprintf(stderr, "Progress: %5.1f%% of %s", now[0] >= p->total ? 100.0 : 100.0 * now[0] / p->total, total);
+    } else {
+        fprintf(stderr, "Progress: %s", in);
+    }
+    if (p->files > 1) fprintf(stderr, ", %d/%d files", done, p->files);
+    if (dt > 0) {
+        fprintf(stderr, ", %.1f MB/s, %.0f reads/s, %.0f bases/s", (now[1] - last[1]) / dt / 1e6,
+                (now[2] - last[2]) / dt, (now[3] - last[3]) / dt);
+    }
+    if (final) {
+        fprintf(stderr, ", %.1f s\n", elapsed);
+    } else if (p->total && now[0] > 0 && now[0] < p->total) {
+        long eta = (long)((p->total - now[0]) * elapsed / now[0] + 0.5);
+        fprintf(stderr, ", ETA %ld:%02ld:%02ld", eta / 3600, eta / 60 % 60, eta % 60);
+    } else {
+        fprintf(stderr, ", ETA -");
+    }
+    if (!final && !p->tty) fprintf(stderr, "\n");
+    fflush(stderr);
+    memcpy(last, now, sizeof(now));
+}
+
+static void *progress_reporter(void *arg) {
+    progress_t *p = (progress_t *)arg;
+    uint64_t last[4] = {0, 0, 0, 0};
+    double prev = p->start;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    double deadline = tv.tv_sec + tv.tv_usec * 1e-6;
+    pthread_mutex_lock(&p->mutex);
+    while (!p->quit) {
+        // Condition variables wait on the real-time clock
+        deadline += p->interval;
+        struct timespec ts;
+        ts.tv_sec = (time_t)deadline;
+        ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1e9);
+        while (!p->quit && pthread_cond_timedwait(&p->cond, &p->mutex, &ts) == 0) {}
+        if (p->quit) break;
+        double now = progress_clock();
+        progress_print(p, last, now - prev, now - p->start, 0);
+        prev = now;
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return NULL;
+}
+
+// Returns 0, or -1 if the reporter thread cannot be started
+static inline int progress_start(uint64_t total, int files, double interval) {
+    progress_t *p = &progress_run;
+    memset(p, 0, sizeof(*p));
+    p->total = total;
+    p->files = files;
+    p->interval = interval > 0 ? interval : 1.0;
+    p->start = progress_clock();
+    p->tty = isatty(STDERR_FILENO);
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    if (pthread_create(&p->thread, NULL, progress_reporter, p) != 0) {
+        pthread_mutex_destroy(&p->mutex);
+        pthread_cond_destroy(&p->cond);
+        return -1;
+    }
+    progress_on = 1;
+    return 0;
+}
+
+// The last report gives the average rates of the whole run
+static inline void progress_stop(void) {
+    progress_t *p = &progress_run;
+    if (!progress_on) return;
+    pthread_mutex_lock(&p->mutex);
+    p->quit = 1;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+    pthread_join(p->thread, NULL);
+    uint64_t zero[4] = {0, 0, 0, 0};
+    double elapsed = progress_clock() - p->start;
+    progress_print(p, zero, elapsed, elapsed, 1);
+    pthread_mutex_destroy(&p->mutex);
+    pthread_cond_destroy(&p->cond);
+    progress_on = 0;
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * qualstat.h - per-read quality and length helpers of n50_qual
+ *
+ * Kept apart from n50_qual.c so that the kernels can be timed on their own
+ * (see microbench.c).
+ *
+ *   qualstat_read()  add the quality string of one read to running totals
+ *   qualstat_count() the same without the error probabilities, which cost a pow() per base
+ *   calculate_auN()  area under the Nx curve of lengths sorted longest first
+ */
+#ifndef N50_QUALSTAT_H
+#define N50_QUALSTAT_H
+
+#include <math.h>
+
+typedef struct {
+    unsigned long total_quality;    // sum of Phred scores
+    unsigned long q20_count;        // bases with Q >= 20
+    unsigned long q30_count;
+} qualstat_t;
+
+// Add the `len` scores of `qual` (Phred + `offset`) to `s`. Returns the sum
+// of their error probabilities, P = 10^(-Q/10).
+static inline double qualstat_read(const char *qual, unsigned len, int offset, qualstat_t *s) {
+    double error_prob_sum = 0.0;
+    for (unsigned i = 0; i < len; i++) {
+        int q = (int)qual[i] - offset;
+        error_prob_sum += pow(10.0, -q / 10.0);
+        s->total_quality += q;
+        if (q >= 20) s->q20_count++;
+        if (q >= 30) s->q30_count++;
+    }
+    return error_prob_sum;
+}
+
+// Add the `len` scores of `qual` (Phred + `offset`) to `s`, as qualstat_read() does
+static inline void qualstat_count(const char *qual, unsigned len, int offset, qualstat_t *s) {
+    unsigned long total = 0, q20 = 0, q30 = 0;
+    for (unsigned i = 0; i < len; i++) {
+        int q = (int)qual[i] - offset;
+        total += q;
+        q20 += q >= 20;
+        q30 += q >= 30;
+    }
+    s->total_quality += total;
+    s->q20_count += q20;
+    s->q30_count += q30;
+}
+
+static inline unsigned long calculate_auN(const unsigned *lengths, unsigned long n, unsigned long limit) {
+    double aun = 0.0;
+    unsigned long cumulative = 0;
+    for (unsigned long i = 0; i < n && cumulative < limit; i++) {
+        unsigned long eff_len = (cumulative + lengths[i] <= limit) ? lengths[i] : (limit - cumulative);
+        aun += eff_len * ((double)eff_len / limit);
+        cumulative += lengths[i];
+    }
+    return (unsigned long)(aun + 0.5);
+}
+
+#endif
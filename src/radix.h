@@ -0,0 +1,178 @@
+/*
+ * radix.h - descending LSD radix sort for sequence lengths
+ *
+ * Replaces qsort() with a comparator: 8-bit digits, one counting pass and
+ * one scatter pass per digit, and digits on which every key agrees (the high
+ * bytes of read lengths, most of the time) are skipped. Large arrays are
+ * split among threads: each thread counts its slice, offsets are computed
+ * thread by thread within each bucket so the sort stays stable, and each
+ * thread scatters its own slice.
+ *
+ *   radix_sort_u32_desc(uint32_t *a, size_t n, int threads)
+ *   radix_sort_u64_desc(uint64_t *a, size_t n, int threads)
+ *
+ * `threads` <= 0 picks a count from the array size and the online cores.
+ * Both return 0 on success and -1 if the temporary buffer cannot be allocated.
+ */
+#ifndef N50_RADIX_H
+#define N50_RADIX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define RADIX_MIN_PARALLEL (1 << 20)   // elements, below this one thread is faster
+#define RADIX_MIN_SLICE    (1 << 18)   // elements per thread
+#define RADIX_MAX_THREADS  64
+
+// Reusable barrier (pthread_barrier_t is not available on macOS)
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int count;
+    int waiting;
+    unsigned generation;
+} radix_barrier_t;
+
+static inline void radix_barrier_init(radix_barrier_t *b, int count) {
+    pthread_mutex_init(&b->mutex, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    b->count = count;
+    b->waiting = 0;
+    b->generation = 0;
+}
+
+static inline void radix_barrier_destroy(radix_barrier_t *b) {
+    pthread_mutex_destroy(&b->mutex);
+    pthread_cond_destroy(&b->cond);
+}
+
+static inline void radix_barrier_wait(radix_barrier_t *b) {
+    pthread_mutex_lock(&b->mutex);
+    unsigned gen = b->generation;
+    if (++b->waiting == b->count) {
+        b->waiting = 0;
+        b->generation++;
+        pthread_cond_broadcast(&b->cond);
+    } else {
+        while (gen == b->generation) pthread_cond_wait(&b->cond, &b->mutex);
+    }
+    pthread_mutex_unlock(&b->mutex);
+}
+
+static inline int radix_pick_threads(size_t n, int threads) {
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    if (n < RADIX_MIN_PARALLEL) return 1;
+    if ((size_t)threads > n / RADIX_MIN_SLICE) threads = (int)(n / RADIX_MIN_SLICE);
+    if (threads > RADIX_MAX_THREADS) threads = RADIX_MAX_THREADS;
+    return threads < 1 ? 1 : threads;
+}
+
+#define RADIX_INIT(SFX, key_t)                                                            \
+    typedef struct {                                                                      \
+        key_t *src, *dst;                                                                 \
+        size_t n;                                                                         \
+        int nthreads;                                                                     \
+        int ready;                                                                        \
+        size_t (*counts)[256];        /* counts[thread][bucket] */                        \
+        radix_barrier_t barrier;                                                          \
+    } radix_job_##SFX##_t;                                                                \
+                                                                                          \
+    typedef struct {                                                                      \
+        radix_job_##SFX##_t *job;                                                         \
+        int id;                                                                           \
+    } radix_arg_##SFX##_t;                                                                \
+                                                                                          \
+    static void *radix_worker_##SFX(void *arg) {                                          \
+        radix_job_##SFX##_t *job = ((radix_arg_##SFX##_t *)arg)->job;                     \
+        int id = ((radix_arg_##SFX##_t *)arg)->id;                                        \
+        /* Wait until every thread is started and nthreads is final */                    \
+        pthread_mutex_lock(&job->barrier.mutex);                                          \
+        while (!job->ready) pthread_cond_wait(&job->barrier.cond, &job->barrier.mutex);   \
+        pthread_mutex_unlock(&job->barrier.mutex);                                        \
+        int T = job->nthreads;                                                            \
+        size_t lo = job->n * id / T, hi = job->n * (id + 1) / T;                          \
+        key_t *src = job->src, *dst = job->dst;                                           \
+        for (unsigned shift = 0; shift < 8 * sizeof(key_t); shift += 8) {                 \
+            size_t *cnt = job->counts[id];                                                \
+            memset(cnt, 0, 256 * sizeof(size_t));                                         \
+            for (size_t i = lo; i < hi; i++) cnt[(src[i] >> shift) & 0xff]++;             \
+            if (T > 1) radix_barrier_wait(&job->barrier);                                 \
+            /* Skip the digit if every key has the same value */                          \
+            int skip = 0;                                                                 \
+            for (int b = 0; b < 256; b++) {                                               \
+                size_t total = 0;                                                         \
+                for (int t = 0; t < T; t++) total += job->counts[t][b];                   \
+                if (total) { skip = (total == job->n); break; }                           \
+            }                                                                             \
+            if (skip) {                                                                   \
+                /* Nobody may reset its counts while others still read them */            \
+                if (T > 1) radix_barrier_wait(&job->barrier);                             \
+                continue;                                                                 \
+            }                                                                             \
+            /* Buckets from 255 down give descending order; within a bucket */            \
+            /* the slices of lower threads come first to keep it stable.   */             \
+            size_t pos = 0, offset[256];                                                  \
+            for (int b = 255; b >= 0; b--) {                                              \
+                for (int t = 0; t < T; t++) {                                             \
+                    if (t == id) offset[b] = pos;                                         \
+                    pos += job->counts[t][b];                                             \
+                }                                                                         \
+            }                                                                             \
+            for (size_t i = lo; i < hi; i++) dst[offset[(src[i] >> shift) & 0xff]++] = src[i]; \
+            if (T > 1) radix_barrier_wait(&job->barrier);                                 \
+            key_t *swap = src;                                                            \
+            src = dst;                                                                    \
+            dst = swap;                                                                   \
+        }                                                                                 \
+        if (id == 0) job->src = src;                                                      \
+        return NULL;                                                                      \
+    }                                                                                     \
+                                                                                          \
+    static inline int radix_sort_##SFX##_desc(key_t *a, size_t n, int threads) {          \
+        if (n < 2) return 0;                                                              \
+        int T = radix_pick_threads(n, threads);                                           \
+        key_t *tmp = malloc(n * sizeof(key_t));                                           \
+        size_t (*counts)[256] = malloc(T * sizeof(*counts));                              \
+        if (!tmp || !counts) {                                                            \
+            free(tmp);                                                                    \
+            free(counts);                                                                 \
+            return -1;                                                                    \
+        }                                                                                 \
+        radix_job_##SFX##_t job = { .src = a, .dst = tmp, .n = n, .counts = counts };     \
+        radix_arg_##SFX##_t args[RADIX_MAX_THREADS];                                      \
+        pthread_t tids[RADIX_MAX_THREADS];                                                \
+        radix_barrier_init(&job.barrier, T);                                              \
+        int started = 1;                                                                  \
+        for (int t = 1; t < T; t++) {                                                     \
+            args[t].job = &job;                                                           \
+            args[t].id = t;                                                               \
+            if (pthread_create(&tids[t], NULL, radix_worker_##SFX, &args[t]) != 0) break; \
+            started++;                                                                    \
+        }                                                                                 \
+        /* Threads that could not be created are left out of the split */                 \
+        pthread_mutex_lock(&job.barrier.mutex);                                           \
+        job.nthreads = job.barrier.count = started;                                       \
+        job.ready = 1;                                                                    \
+        pthread_cond_broadcast(&job.barrier.cond);                                        \
+        pthread_mutex_unlock(&job.barrier.mutex);                                         \
+        args[0].job = &job;                                                               \
+        args[0].id = 0;                                                                   \
+        radix_worker_##SFX(&args[0]);                                                     \
+        for (int t = 1; t < started; t++) pthread_join(tids[t], NULL);                    \
+        if (job.src != a) memcpy(a, job.src, n * sizeof(key_t));                          \
+        radix_barrier_destroy(&job.barrier);                                              \
+        free(counts);                                                                     \
+        free(tmp);                                                                        \
+        return 0;                                                                         \
+    }
+
+RADIX_INIT(u32, uint32_t)
+RADIX_INIT(u64, uint64_t)
+
+#endif
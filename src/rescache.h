@@ -0,0 +1,216 @@
+/*
+ * rescache.h - on-disk cache of per-file statistics
+ *
+ * Dashboards and QC pipelines ask for the statistics of the same files over
+ * and over. With a cache, the result of every file is stored under the
+ * identity of the file (device and inode) and the size, modification time
+ * and status change time it had when it was read, both to the nanosecond; a
+ * later run that finds the same values takes the result from the cache and
+ * never opens the file. A file that was rewritten, appended to or touched no
+ * longer matches and is read again, even within the same second and with its
+ * modification time set back, which changes its status change time.
+ * Options that change the statistics are part of the key as well.
+ *
+ * The cache is a single file of fixed-size entries sorted by key, loaded
+ * whole at the start. New entries are kept in memory and merged into the
+ * file at the end: the file is read again, so that entries saved meanwhile
+ * by another run are kept, and replaced with rename() so that readers never
+ * see half of it.
+ *
+ *   rescache_key()   key of a file from its stat()
+ *   rescache_open()  load the cache at `path` (a missing file is an empty cache)
+ *   rescache_get()   statistics for a key, if cached
+ *   rescache_put()   add the statistics of a file that was read
+ *   rescache_save()  merge the new entries into the file
+ *   rescache_close() free everything
+ */
+#ifndef N50_RESCACHE_H
+#define N50_RESCACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define RESCACHE_MAGIC "N50RC003"
+
+typedef struct {
+    uint64_t dev, ino;
+    uint64_t size;
+    int64_t mtime, mtime_ns;
+    int64_t ctime, ctime_ns;
+    uint64_t opts;              // options that change the statistics
+} rescache_key_t;
+
+typedef struct {
+    uint64_t total_seqs, total_len;
+    uint64_t n50, n75, n90, i50;
+    uint64_t min_len, max_len, aun;
+    double gc_content, n_content, masked_content, avg_len;
+    uint64_t all_seqs, all_len;     // before a length filter
+} rescache_stats_t;
+
+typedef struct {
+    rescache_key_t key;
+    rescache_stats_t stats;
+} rescache_entry_t;
+
+typedef struct {
+    char *path;
+    rescache_entry_t *entries;  // loaded from the file, sorted
+    size_t n;
+    rescache_entry_t *added;    // read in this run, in no order
+    size_t nadded, cap;
+} rescache_t;
+
+static inline void rescache_key(const struct stat *st, uint64_t opts, rescache_key_t *key) {
+    memset(key, 0, sizeof(*key));
+    key->dev = (uint64_t)st->st_dev;
+    key->ino = (uint64_t)st->st_ino;
+    key->size = (uint64_t)st->st_size;
+#ifdef __APPLE__
+    key->mtime = (int64_t)st->st_mtimespec.tv_sec;
+    key->mtime_ns = (int64_t)st->st_mtimespec.tv_nsec;
+    key->ctime = (int64_t)st->st_ctimespec.tv_sec;
+    key->ctime_ns = (int64_t)st->st_ctimespec.tv_nsec;
+#else
+    key->mtime = (int64_t)st->st_mtim.tv_sec;
+    key->mtime_ns = (int64_t)st->st_mtim.tv_nsec;
+    key->ctime = (int64_t)st->st_ctim.tv_sec;
+    key->ctime_ns = (int64_t)st->st_ctim.tv_nsec;
+#endif
+    key->opts = opts;
+}
+
+// Entries are sorted by file and options; size and times are checked on lookup
+static inline int rescache_cmp(const void *a, const void *b) {
+    const rescache_key_t *x = &((const rescache_entry_t *)a)->key;
+    const rescache_key_t *y = &((const rescache_entry_t *)b)->key;
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino) return x->ino < y->ino ? -1 : 1;
+    if (x->opts != y->opts) return x->opts < y->opts ? -1 : 1;
+    return 0;
+}
+
+// Read the entries of the cache file, sorted. A missing or damaged file
+// reads as empty. Returns -1 if memory ran out.
+static inline int rescache_load(const char *path, rescache_entry_t **entries, size_t *n) {
+    *entries = NULL;
+    *n = 0;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    char magic[8];
+    uint64_t count = 0;
+    struct stat st;
+    int ok = fread(magic, 8, 1, fp) == 1 && memcmp(magic, RESCACHE_MAGIC, 8) == 0;
+    ok = ok && fread(&count, 8, 1, fp) == 1 && fstat(fileno(fp), &st) == 0;
+    ok = ok && count > 0 && (uint64_t)st.st_size == 16 + count * sizeof(rescache_entry_t);
+    rescache_entry_t *e = ok ? malloc(count * sizeof(rescache_entry_t)) : NULL;
+    if (ok && !e) {
+        fclose(fp);
+        return -1;
+    }
+    ok = ok && fread(e, sizeof(rescache_entry_t), count, fp) == count;
+    fclose(fp);
+    if (!ok) {
+        free(e);
+        return 0;
+    }
+    qsort(e, count, sizeof(rescache_entry_t), rescache_cmp);
+    *entries = e;
+    *n = count;
+    return 0;
+}
+
+static inline int rescache_open(rescache_t *c, const char *path) {
+    memset(c, 0, sizeof(*c));
+    c->path = strdup(path);
+    if (!c->path) return -1;
+    return rescache_load(path, &c->entries, &c->n);
+}
+
+static inline void rescache_close(rescache_t *c) {
+    free(c->path);
+    free(c->entries);
+    free(c->added);
+    memset(c, 0, sizeof(*c));
+}
+
+static inline int rescache_get(const rescache_t *c, const rescache_key_t *key, rescache_stats_t *stats) {
+    rescache_entry_t probe;
+    probe.key = *key;
+    const rescache_entry_t *e = c->n ? bsearch(&probe, c->entries, c->n, sizeof(rescache_entry_t), rescache_cmp) : NULL;
+    if (!e || e->key.size != key->size || e->key.mtime != key->mtime || e->key.mtime_ns != key->mtime_ns ||
+        e->key.ctime != key->ctime || e->key.ctime_ns != key->ctime_ns) {
+        return 0;
+    }
+    *stats = e->stats;
+    return 1;
+}
+
+static inline int rescache_put(rescache_t *c, const rescache_key_t *key, const rescache_stats_t *stats) {
+    if (c->nadded == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 64;
+        rescache_entry_t *p = realloc(c->added, cap * sizeof(rescache_entry_t));
+        if (!p) return -1;
+        c->added = p;
+        c->cap = cap;
+    }
+    c->added[c->nadded].key = *key;
+    c->added[c->nadded].stats = *stats;
+    c->nadded++;
+    return 0;
+}
+
+// Returns 0, or -1 if the file cannot be written
+static inline int rescache_save(rescache_t *c) {
+    if (!c->nadded) return 0;
+    rescache_entry_t *disk;
+    size_t ndisk;
+    if (rescache_load(c->path, &disk, &ndisk) != 0) return -1;
+
+    // Entries of this run replace those of the same file and options
+    qsort(c->added, c->nadded, sizeof(rescache_entry_t), rescache_cmp);
+    rescache_entry_t *out = malloc((ndisk + c->nadded) * sizeof(rescache_entry_t));
+    if (!out) {
+        free(disk);
+        return -1;
+    }
+    size_t i = 0, j = 0, n = 0;
+    while (i < ndisk || j < c->nadded) {
+        int cmp = i == ndisk ? 1 : j == c->nadded ? -1 : rescache_cmp(&disk[i], &c->added[j]);
+        if (cmp < 0) {
+            out[n++] = disk[i++];
+        } else {
+            // A file given twice in this run has the same key and the same
+            // statistics: keep one of them (qsort() is not stable, any will do)
+            while (j + 1 < c->nadded && rescache_cmp(&c->added[j], &c->added[j + 1]) == 0) j++;
+            out[n++] = c->added[j++];
+            if (cmp == 0) i++;
+        }
+    }
+    free(disk);
+
+    char *tmp = malloc(strlen(c->path) + 32);
+    FILE *fp = NULL;
+    if (tmp) {
+        sprintf(tmp, "%s.%ld", c->path, (long)getpid());
+        fp = fopen(tmp, "wb");
+    }
+    uint64_t count = n;
+    int ok = fp != NULL;
+    ok = ok && fwrite(RESCACHE_MAGIC, 8, 1, fp) == 1;
+    ok = ok && fwrite(&count, 8, 1, fp) == 1;
+    ok = ok && fwrite(out, sizeof(rescache_entry_t), n, fp) == n;
+    if (fp && fclose(fp) != 0) ok = 0;
+    if (ok && rename(tmp, c->path) != 0) ok = 0;
+    if (!ok && fp) unlink(tmp);
+    free(tmp);
+    free(out);
+    if (ok) c->nadded = 0;
+    return ok ? 0 : -1;
+}
+
+#endif
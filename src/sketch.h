@@ -0,0 +1,108 @@
+/*
+ * sketch.h - mergeable statistics of a FASTA/FASTQ file
+ *
+ * N50 and friends cannot be combined from the N50 of each part, but the
+ * length histogram can: a sketch is the exact histogram of an input
+ * (distinct lengths with their counts) with its base composition counts.
+ * Adding sketches together gives the histogram of the concatenated inputs,
+ * in any order and grouping, so the pooled statistics of many lanes or
+ * shards are exact without reading their sequences again.
+ *
+ * File layout, in native byte order like gzidx.h:
+ *   "N50SKT01", sequences, total length, gc, at, n, lower, eol, bins,
+ *   then (length, count) for every bin, all 64-bit.
+ *
+ *   sketch_path()  FILE.n50sketch for FILE
+ *   sketch_save()  write the sketch of a histogram and composition
+ *   sketch_load()  add the sketch in a file to a histogram and composition
+ */
+#ifndef N50_SKETCH_H
+#define N50_SKETCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "lenhist.h"
+#include "compose.h"
+
+#define SKETCH_SUFFIX ".n50sketch"
+#define SKETCH_MAGIC  "N50SKT01"
+
+static inline char *sketch_path(const char *path) {
+    char *spath = malloc(strlen(path) + sizeof(SKETCH_SUFFIX));
+    if (spath) sprintf(spath, "%s%s", path, SKETCH_SUFFIX);
+    return spath;
+}
+
+// Returns 0, or -1 if the file cannot be written
+static inline int sketch_save(const char *spath, const lenhist_t *hist, const compose_t *comp) {
+    size_t nbins;
+    lenhist_bin_t *bins = lenhist_bins(hist, &nbins);
+    if (!bins) return -1;
+    char *tmp = malloc(strlen(spath) + 32);
+    FILE *fp = NULL;
+    if (tmp) {
+        sprintf(tmp, "%s.%ld", spath, (long)getpid());
+        fp = fopen(tmp, "wb");
+    }
+    uint64_t head[8] = {hist->n, hist->total, comp->gc, comp->at, comp->n, comp->lower, comp->eol, nbins};
+    int ok = fp != NULL;
+    ok = ok && fwrite(SKETCH_MAGIC, 8, 1, fp) == 1;
+    ok = ok && fwrite(head, sizeof(head), 1, fp) == 1;
+    for (size_t i = 0; ok && i < nbins; i++) {
+        ok = fwrite(&bins[i].len, 8, 1, fp) == 1 && fwrite(&bins[i].count, 8, 1, fp) == 1;
+    }
+    if (fp && fclose(fp) != 0) ok = 0;
+    if (ok && rename(tmp, spath) != 0) ok = 0;
+    if (!ok && fp) unlink(tmp);
+    free(tmp);
+    free(bins);
+    return ok ? 0 : -1;
+}
+
+// Returns 0, -1 if the file cannot be read or is not a sketch, -2 if memory
+// ran out. Nothing is added from a file that fails its checks.
+static inline int sketch_load(const char *spath, lenhist_t *hist, compose_t *comp) {
+    FILE *fp = fopen(spath, "rb");
+    if (!fp) return -1;
+    char magic[8];
+    uint64_t head[8];
+    int ok = fread(magic, 8, 1, fp) == 1 && memcmp(magic, SKETCH_MAGIC, 8) == 0;
+    ok = ok && fread(head, sizeof(head), 1, fp) == 1 && head[7] <= head[0];
+    // Both counts come from the file: the bins must also fit in what is left of it
+    struct stat st;
+    ok = ok && fstat(fileno(fp), &st) == 0 && st.st_size >= 72 && head[7] <= ((uint64_t)st.st_size - 72) / 16;
+    lenhist_bin_t *bins = ok ? malloc((head[7] ? head[7] : 1) * sizeof(lenhist_bin_t)) : NULL;
+    if (ok && !bins) {
+        fclose(fp);
+        return -2;
+    }
+    uint64_t n = 0, total = 0;
+    for (uint64_t i = 0; ok && i < head[7]; i++) {
+        ok = fread(&bins[i].len, 8, 1, fp) == 1 && fread(&bins[i].count, 8, 1, fp) == 1;
+        n += bins[i].count;
+        total += bins[i].len * bins[i].count;
+    }
+    ok = ok && fgetc(fp) == EOF && n == head[0] && total == head[1];
+    fclose(fp);
+
+    int ret = ok ? 0 : -1;
+    for (uint64_t i = 0; ok && i < head[7]; i++) {
+        if (lenhist_add_n(hist, bins[i].len, bins[i].count) != 0) {
+            ret = -2;
+            break;
+        }
+    }
+    if (ok) {
+        compose_t c = {head[2], head[3], head[4], head[5], head[6]};
+        compose_add(comp, &c);
+    }
+    free(bins);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * trace.h - timeline of thread activity as Chrome trace events (--trace)
+ *
+ * Picking thread counts needs more than totals: which threads were busy,
+ * which ones waited on a queue or a join, and how full the queues were.
+ * With tracing on, every thread records spans (open, read, scan, stats,
+ * output, waits) and counters (queue depths) into a buffer of its own, so
+ * recording takes no lock and no atomic; a thread only takes the lock once,
+ * to add its buffer to the list. The buffers are written at the end as
+ * Chrome trace-event JSON, which chrome://tracing and ui.perfetto.dev open.
+ *
+ * Spans are recorded per file, block or batch, never per record. With
+ * tracing off, trace_now() returns 0 and the other calls return at once.
+ *
+ *   trace_start()   turn tracing on for a process, before any thread is started
+ *   trace_thread()  name the calling thread, unless it has a name already
+ *   trace_now()     start of a span, 0 if tracing is off
+ *   trace_span()    record a span from `start` to now on the calling thread
+ *   trace_count()   record the value of a counter
+ *   trace_write()   write the events as JSON, after the threads are joined
+ */
+#ifndef N50_TRACE_H
+#define N50_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#define TRACE_CHUNK 4096        // events per buffer allocation
+
+typedef struct {
+    const char *name;           // a string literal
+    char phase;                 // 'X' span, 'C' counter
+    uint64_t ts;                // ns since trace_start()
+    uint64_t dur;               // ns, spans only
+    int64_t value;              // counters only
+} trace_event_t;
+
+typedef struct trace_chunk {
+    struct trace_chunk *next;
+    int n;
+    trace_event_t ev[TRACE_CHUNK];
+} trace_chunk_t;
+
+typedef struct trace_buf {
+    struct trace_buf *next;     // in the list of all threads
+    const char *name;
+    int tid;
+    trace_chunk_t *head, *tail;
+} trace_buf_t;
+
+// Set by trace_start() before threads exist, only read afterwards
+static int trace_on;
+static const char *trace_process;
+static uint64_t trace_t0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trace_buf_t *trace_bufs;
+static int trace_tids;
+static __thread trace_buf_t *trace_self;
+
+static inline uint64_t trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static inline void trace_start(const char *process) {
+    trace_process = process;
+    trace_t0 = trace_clock() - 1;   // so that no timestamp is 0
+    trace_on = 1;
+}
+
+static inline void trace_thread(const char *name) {
+    if (!trace_on || trace_self) return;
+    trace_buf_t *b = calloc(1, sizeof(trace_buf_t));
+    if (!b) return;
+    b->name = name;
+    pthread_mutex_lock(&trace_mutex);
+    b->tid = ++trace_tids;
+    b->next = trace_bufs;
+    trace_bufs = b;
+    pthread_mutex_unlock(&trace_mutex);
+    trace_self = b;
+}
+
+static inline uint64_t trace_now(void) {
+    return trace_on ? trace_clock() - trace_t0 : 0;
+}
+
+// Room for one more event of the calling thread, NULL if memory ran out (the event is dropped)
+static inline trace_event_t *trace_event(void) {
+    if (!trace_self) trace_thread("thread");
+    trace_buf_t *b = trace_self;
+    if (!b) return NULL;
+    if (!b->tail || b->tail->n == TRACE_CHUNK) {
+        trace_chunk_t *c = malloc(sizeof(trace_chunk_t));
+        if (!c) return NULL;
+        c->next = NULL;
+        c->n = 0;
+        if (b->tail) b->tail->next = c;
+        else b->head = c;
+        b->tail = c;
+    }
+    return &b->tail->ev[b->tail->n++];
+}
+
+static inline void trace_span(const char *name, uint64_t start) {
+    if (!start) return;
+    uint64_t end = trace_now();
+    trace_event_t *e = trace_event();
+    if (!e) return;
+    e->name = name;
+    e->phase = 'X';
+    e->ts = start;
+    e->dur = end - start;
+}
+
+static inline void trace_count(const char *name, int64_t value) {
+    if (!trace_on) return;
+    uint64_t now = trace_now();
+    trace_event_t *e = trace_event();
+    if (!e) return;
+    e->name = name;
+    e->phase = 'C';
+    e->ts = now;
+    e->value = value;
+}
+
+// Returns 0, or -1 if the file cannot be written. Frees the events either way.
+static inline int trace_write(const char *path) {
+    FILE *fp = fopen(path, "w");
+    int ret = fp ? 0 : -1;
+    if (fp) {
+        fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"%s\"}}", trace_process);
+    }
+    while (trace_bufs) {
+        trace_buf_t *b = trace_bufs;
+        trace_bufs = b->next;
+        if (fp) {
+            fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    b->tid, b->name);
+        }
+        while (b->head) {
+            trace_chunk_t *c = b->head;
+            b->head = c->next;
+            for (int i = 0; fp && i < c->n; i++) {
+                trace_event_t *e = &c->ev[i];
+                if (e->phase == 'X') {
+                    fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                            e->name, b->tid, e->ts / 1e3, e->dur / 1e3);
+                } else {
+                    fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"%s\":%lld}}",
+                            e->name, b->tid, e->ts / 1e3, e->name, (long long)e->value);
+                }
+            }
+            free(c);
+        }
+        free(b);
+    }
+    trace_tids = 0;
+    trace_self = NULL;
+    trace_on = 0;
+    if (fp) {
+        fprintf(fp, "\n]}\n");
+        if (ferror(fp)) ret = -1;
+        if (fclose(fp) != 0) ret = -1;
+    }
+    return ret;
+}
+
+#endif
@@ -69,6 +69,17 @@ else
     exit 1
 fi
 
+# Thread pool must not change the output or its order
+header "Checking thread pool output..."
+OUT_T1=$(./bin/n50 -t 1 ./test/test.fa ./test/54.fa ./test/54.fq.gz)
+OUT_T4=$(./bin/n50 -t 4 ./test/test.fa ./test/54.fa ./test/54.fq.gz)
+if [ "$OUT_T1" == "$OUT_T4" ]; then
+    success "Same output with 1 and 4 threads"
+else
+    fail "Output differs between 1 and 4 threads"
+    exit 1
+fi
+
 # Simulate data
 header "Generating synthetic sequences..."
 OUTDIR="test-data"
@@ -115,6 +126,265 @@ for FILE in ${OUTDIR}/*.{fasta,fastq}*; do
     [[ "$SIZE" == "$TEST_SIZE" ]] && success "OK total size in $X" || fail "Wrong total size in $X: expected $SIZE, got $TEST_SIZE"
 done
 
+header "Checking parallel reading..."
+for FILE in ${OUTDIR}/test_251_*.fastq; do
+    EXPECTED=$(bin/n50 -t 1 "$FILE" | tail -n 1 | cut -f 2-)
+    # Uncompressed input is split in byte ranges
+    GOT=$(bin/n50 -t 4 "$FILE" | tail -n 1 | cut -f 2-)
+    [[ "$EXPECTED" == "$GOT" ]] && success "Same stats from byte ranges" || fail "Wrong stats from byte ranges: $GOT"
+    split -l 40000 "$FILE" "${OUTDIR}/member_"
+    for PART in ${OUTDIR}/member_*; do gzip -c "$PART"; done > "${OUTDIR}/multi.fq.gz"
+    rm -f ${OUTDIR}/member_*
+    for T in 1 4; do
+        GOT=$(bin/n50 -t $T "${OUTDIR}/multi.fq.gz" | tail -n 1 | cut -f 2-)
+        [[ "$EXPECTED" == "$GOT" ]] && success "Same stats from $T thread(s)" || fail "Wrong stats from $T thread(s): $GOT"
+    done
+    rm -f "${OUTDIR}/multi.fq.gz"
+    # A single member is inflated from guessed block starts
+    gzip -c "$FILE" > "${OUTDIR}/single.fq.gz"
+    GOT=$(bin/n50 -t 4 "${OUTDIR}/single.fq.gz" | tail -n 1 | cut -f 2-)
+    [[ "$EXPECTED" == "$GOT" ]] && success "Same stats from a single member" || fail "Wrong stats from a single member: $GOT"
+    # Build an index, then read from its access points
+    bin/n50 -x -t 1 "${OUTDIR}/single.fq.gz" > /dev/null
+    [[ -s "${OUTDIR}/single.fq.gz.gzidx" ]] && success "Index saved" || fail "No index saved"
+    GOT=$(bin/n50 -t 4 "${OUTDIR}/single.fq.gz" | tail -n 1 | cut -f 2-)
+    [[ "$EXPECTED" == "$GOT" ]] && success "Same stats from the index" || fail "Wrong stats from the index: $GOT"
+    # A fresh index is kept; after a status change of the file it is built again
+    INODE=$(ls -i "${OUTDIR}/single.fq.gz.gzidx")
+    bin/n50 -x -t 4 "${OUTDIR}/single.fq.gz" > /dev/null
+    [[ "$(ls -i "${OUTDIR}/single.fq.gz.gzidx")" == "$INODE" ]] && success "Fresh index kept" || fail "Fresh index built again"
+    chmod u+w "${OUTDIR}/single.fq.gz"
+    bin/n50 -x -t 4 "${OUTDIR}/single.fq.gz" > /dev/null
+    [[ "$(ls -i "${OUTDIR}/single.fq.gz.gzidx")" != "$INODE" ]] && success "Stale index built again" || fail "Stale index kept"
+    # A file cut short is a read error and gets no index
+    head -c $(( $(wc -c < "${OUTDIR}/single.fq.gz") / 2 )) "${OUTDIR}/single.fq.gz" > "${OUTDIR}/trunc.fq.gz"
+    MSG=$(bin/fqc "${OUTDIR}/trunc.fq.gz" 4 2>&1 > /dev/null || true)
+    [[ "$MSG" == *"unexpected end of file"* ]] && success "fqc reports a truncated gzip" || fail "fqc does not report a truncated gzip"
+    ! bin/countfx --fastq "${OUTDIR}/trunc.fq.gz" > /dev/null 2>&1 && success "countfx fails on a truncated gzip" || fail "countfx succeeds on a truncated gzip"
+    for T in 1 4; do
+        ! MSG=$(bin/n50 -t $T "${OUTDIR}/trunc.fq.gz" 2>&1 > /dev/null) && [[ "$MSG" == *"unexpected end of file"* ]] && success "n50 -t $T fails on a truncated gzip" || fail "n50 -t $T on a truncated gzip: $MSG"
+    done
+    MSG=$(bin/fqc -x "${OUTDIR}/trunc.fq.gz" 1 2>&1 > /dev/null || true)
+    [[ "$MSG" == *"may be incomplete"* && ! -e "${OUTDIR}/trunc.fq.gz.gzidx" ]] && success "No index of a truncated gzip" || fail "Truncated gzip indexed quietly"
+    rm -f "${OUTDIR}/trunc.fq.gz" "${OUTDIR}/trunc.fq.gz.gzidx"
+    # A BGZF member with a bad CRC is never counted, whatever the thread count
+    if command -v python3 > /dev/null; then
+        python3 - "$FILE" "${OUTDIR}/badcrc.fq.gz" <<'PY'
+import struct, sys, zlib
+data = open(sys.argv[1], 'rb').read()
+starts = range(0, len(data), 65280)
+with open(sys.argv[2], 'wb') as out:
+    for i in starts:
+        block = data[i:i + 65280]
+        z = zlib.compressobj(6, zlib.DEFLATED, -15)
+        cdata = z.compress(block) + z.flush()
+        crc = zlib.crc32(block) ^ (0xffffffff if i == starts[-1] else 0)
+        out.write(struct.pack('<4BI2BH2BHH', 31, 139, 8, 4, 0, 0, 255, 6, 66, 67, 2, len(cdata) + 25))
+        out.write(cdata + struct.pack('<II', crc, len(block)))
+PY
+        LAST=$(( ($(wc -c < "$FILE") - 1) / 65280 * 65280 ))
+        KEPT=$(( $(head -c $LAST "$FILE" | wc -l) / 4 ))
+        MSG1=$(bin/n50 -t 1 "${OUTDIR}/badcrc.fq.gz" 2>&1 > /dev/null || true)
+        for T in 1 4; do
+            RC=0
+            OUT=$(bin/n50 -t $T "${OUTDIR}/badcrc.fq.gz" 2> "${OUTDIR}/badcrc.err") || RC=$?
+            MSG=$(cat "${OUTDIR}/badcrc.err")
+            GOT=$(echo "$OUT" | tail -n 1 | cut -f 2)
+            [[ $RC == 1 && "$MSG" == *"incorrect data check"* && "$MSG" == "$MSG1" && "$GOT" -le "$KEPT" ]] && success "n50 -t $T drops a BGZF member with a bad CRC" || fail "n50 -t $T on a bad BGZF CRC: $MSG ($GOT seqs, at most $KEPT)"
+        done
+        rm -f "${OUTDIR}/badcrc.fq.gz" "${OUTDIR}/badcrc.err"
+    fi
+    rm -f "${OUTDIR}/single.fq.gz" "${OUTDIR}/single.fq.gz.gzidx"
+done
+# A quality shorter than its sequence stops the scan with an error
+printf "@a\nACGT\n+\nIIII\n@b\nACGT\n+\nII\n" > "${OUTDIR}/short_qual.fq"
+! MSG=$(bin/n50 "${OUTDIR}/short_qual.fq" 2>&1 > /dev/null) && [[ "$MSG" == *"malformed record"* ]] && success "n50 fails on a malformed FASTQ" || fail "n50 on a malformed FASTQ: $MSG"
+rm -f "${OUTDIR}/short_qual.fq"
+# A read error before the first byte is an error on every path
+printf '\x1f\x8b\x08\x00garbagegarbage' > "${OUTDIR}/garbage.gz"
+for T in 1 4; do
+    RC=0
+    MSG=$(bin/n50 -t $T "${OUTDIR}/garbage.gz" 2>&1 > /dev/null) || RC=$?
+    [[ $RC == 1 && "$MSG" == *"invalid code lengths set"* ]] && success "n50 -t $T fails on a corrupt deflate stream" || fail "n50 -t $T on a corrupt deflate stream: $MSG"
+done
+rm -f "${OUTDIR}/garbage.gz"
+! bin/n50 ./test/test.fa "${OUTDIR}/missing.fa" > /dev/null 2>&1 && success "n50 fails on a missing file" || fail "n50 succeeds on a missing file"
+! bin/n50_qual ./test/54.fq "${OUTDIR}/missing.fq" > /dev/null 2>&1 && success "n50_qual fails on a missing file" || fail "n50_qual succeeds on a missing file"
+! bin/n50_qual ./test/test.fa > /dev/null 2>&1 && success "n50_qual fails on a FASTA file" || fail "n50_qual succeeds on a FASTA file"
+printf "@a\nACGT\n+\nIIII\n@b\nACGT\n+\nII\n" > "${OUTDIR}/short_qual.fq"
+! MSG=$(bin/n50_qual "${OUTDIR}/short_qual.fq" 2>&1 > /dev/null) && [[ "$MSG" == *"malformed record"* ]] && success "n50_qual fails on a malformed FASTQ" || fail "n50_qual on a malformed FASTQ: $MSG"
+rm -f "${OUTDIR}/short_qual.fq"
+# A member stored uncompressed can hold the bytes of another one, and the
+# range guessed from them is decoded again while later ranges wait to be read
+for I in $(seq 1 20); do
+    printf ">s%d\nACGTTGCA\n" $I | gzip -nc > "${OUTDIR}/inner.gz"
+    [[ $(tr -cd '\n' < "${OUTDIR}/inner.gz" | wc -c) -eq 0 ]] && break
+done
+awk 'BEGIN { for (i = 0; i < 8000; i++) { printf ">r\n"; for (j = 0; j < 13; j++) printf "ACGTACGT"; printf "\n" } }' | gzip -9 > "${OUTDIR}/repeat.gz"
+{
+    printf ">first\nACGT\n" | gzip -c
+    { printf ">filler\n"; head -c 100000 /dev/urandom | tr -d '\n'; echo; } | gzip -1
+    { printf ">stored\n"; head -c 70000 /dev/urandom | tr -d '\n'; cat "${OUTDIR}/inner.gz"; head -c 30000 /dev/urandom | tr -d '\n'; echo; } | gzip -1
+    for I in $(seq 1 300); do cat "${OUTDIR}/repeat.gz"; done
+} > "${OUTDIR}/embedded.fa.gz"
+EXPECTED=$(bin/n50 -t 1 "${OUTDIR}/embedded.fa.gz" | tail -n 1 | cut -f 2-)
+GOT=$(timeout 60 bin/n50 -t 2 "${OUTDIR}/embedded.fa.gz" | tail -n 1 | cut -f 2- || true)
+[[ "$EXPECTED" == "$GOT" ]] && success "Same stats with a member inside a stored one" || fail "Wrong stats or hang with a member inside a stored one: $GOT"
+rm -f "${OUTDIR}/inner.gz" "${OUTDIR}/repeat.gz" "${OUTDIR}/embedded.fa.gz"
+# A record that spans many blocks is gathered once, then cut where the next one starts
+awk 'BEGIN { printf ">short\nACGT\n>long\n"; for (i = 0; i < 250000; i++) print "ACGTACGTNNacgtACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTGC"; printf ">after\nACGTA\n" }' | gzip -1 > "${OUTDIR}/long.fa.gz"
+EXPECTED=$(bin/n50 -t 1 "${OUTDIR}/long.fa.gz" | tail -n 1 | cut -f 2-)
+for T in 2 4; do
+    GOT=$(bin/n50 -t $T "${OUTDIR}/long.fa.gz" | tail -n 1 | cut -f 2-)
+    [[ "$EXPECTED" == "$GOT" ]] && success "Same stats of a multi-block record on $T threads" || fail "Wrong stats of a multi-block record on $T threads: $GOT"
+done
+[[ "$(echo "$EXPECTED" | cut -f 1,2,10)" == "$(printf "3\t15000009\t15000000")" ]] && success "Multi-block record read whole" || fail "Multi-block record: $EXPECTED"
+rm -f "${OUTDIR}/long.fa.gz"
+
+header "Checking result cache..."
+CACHE="${OUTDIR}/n50.cache"
+cp ./test/test.fa "${OUTDIR}/cached.fa"
+touch -r ./test/test.fa "${OUTDIR}/cached.fa"
+EXPECTED=$(bin/n50 -C "$CACHE" "${OUTDIR}/cached.fa" | tail -n 1)
+# A cached file is never opened, so its trace has no open span
+GOT=$(bin/n50 -C "$CACHE" --trace "${OUTDIR}/trace.json" "${OUTDIR}/cached.fa" | tail -n 1)
+[[ "$EXPECTED" == "$GOT" ]] && ! grep -q '"name":"open"' "${OUTDIR}/trace.json" && success "Result taken from the cache" || fail "Result not taken from the cache: $GOT"
+rm -f "${OUTDIR}/trace.json"
+# Same inode, size and mtime, but a new ctime: the file is read again
+tr ACGT TTTT < ./test/test.fa > "${OUTDIR}/cached.fa"
+touch -r ./test/test.fa "${OUTDIR}/cached.fa"
+GOT=$(N50_CACHE="$CACHE" bin/n50 "${OUTDIR}/cached.fa" | tail -n 1)
+[[ "$EXPECTED" != "$GOT" ]] && success "Modified file read again" || fail "Modified file not read again"
+# A file that cannot be read to the end is not cached
+printf "@a\nACGT\n+\nIIII\n@b\nACGT\n+\nII\n" > "${OUTDIR}/cached.fq"
+bin/n50 -C "$CACHE" "${OUTDIR}/cached.fq" > /dev/null 2>&1 || true
+! bin/n50 -C "$CACHE" "${OUTDIR}/cached.fq" > /dev/null 2>&1 && success "Failed scan not cached" || fail "Failed scan served from the cache"
+rm -f "$CACHE" "${OUTDIR}/cached.fa" "${OUTDIR}/cached.fq"
+
+header "Checking sketches..."
+cp ./test/test.fa ./test/54.fa "${OUTDIR}/"
+bin/n50 --sketch "${OUTDIR}/test.fa" "${OUTDIR}/54.fa" > /dev/null
+EXPECTED=$(cat ./test/test.fa ./test/54.fa | bin/n50 - | tail -n 1 | cut -f 2-)
+GOT=$(bin/n50 --merge "${OUTDIR}/test.fa.n50sketch" "${OUTDIR}/54.fa.n50sketch" | tail -n 1 | cut -f 2-)
+[[ "$EXPECTED" == "$GOT" ]] && success "Merged sketches match the pooled files" || fail "Wrong merged stats: $GOT"
+# A file that cannot be read to the end is not sketched
+printf "@a\nACGT\n+\nIIII\n@b\nACGT\n+\nII\n" > "${OUTDIR}/short_qual.fq"
+bin/n50 --sketch "${OUTDIR}/short_qual.fq" > /dev/null 2>&1 || true
+[[ ! -e "${OUTDIR}/short_qual.fq.n50sketch" ]] && success "No sketch of a failed scan" || fail "Sketch written for a failed scan"
+rm -f "${OUTDIR}"/short_qual.fq*
+# A bin count larger than the file can hold is not a sketch
+{ printf "N50SKT01\0\0\0\0\0\0\0\020"; head -c 48 /dev/zero; printf "\0\0\0\0\0\0\0\020"; head -c 65536 /dev/zero; } > "${OUTDIR}/bad.n50sketch"
+MSG=$(bin/n50 --merge "${OUTDIR}/bad.n50sketch" 2>&1 > /dev/null || true)
+[[ "$MSG" == "Error reading sketch"* ]] && success "Oversized bin count rejected" || fail "Oversized bin count: $MSG"
+rm -f "${OUTDIR}"/test.fa* "${OUTDIR}"/54.fa* "${OUTDIR}/bad.n50sketch"
+
+header "Checking libn50..."
+cat > "${OUTDIR}/libtest.c" << 'EOF'
+#include <stdio.h>
+#include "libn50.h"
+int main(int argc, char **argv) {
+    n50_acc_t *file = n50_acc_new(), *mem = n50_acc_new();
+    n50_stats_t st;
+    if (argc < 2 || !file || !mem || n50_acc_add_file(file, argv[1], 2) != N50_OK) return 1;
+    n50_acc_add_seq(mem, "ACGTNacgt", 9);
+    n50_acc_merge(file, mem);
+    n50_acc_stats(file, &st);
+    printf("%lu\t%lu\t%lu\t%.2f\n", (unsigned long)st.total_seqs, (unsigned long)st.total_len,
+           (unsigned long)st.n50, st.gc_content);
+    n50_acc_free(file);
+    n50_acc_free(mem);
+    return 0;
+}
+EOF
+if ${CC:-cc} -I src -o "${OUTDIR}/libtest" "${OUTDIR}/libtest.c" bin/libn50.a -lz -lpthread; then
+    EXPECTED=$(printf ">x\nACGTNacgt\n" | cat ./test/test.fa - | bin/n50 - | tail -n 1 | cut -f 2,3,4,8)
+    GOT=$("${OUTDIR}/libtest" ./test/test.fa)
+    [[ "$EXPECTED" == "$GOT" ]] && success "Same stats from libn50" || fail "Wrong stats from libn50: $GOT"
+else
+    fail "Cannot link against libn50"
+fi
+rm -f "${OUTDIR}/libtest" "${OUTDIR}/libtest.c"
+
+header "Checking shards..."
+ls ${OUTDIR}/*.{fasta,fastq}* > "${OUTDIR}/list.txt"
+EXPECTED=$(bin/n50 --files-from "${OUTDIR}/list.txt" | tail -n +2 | sort)
+GOT=$(for I in 1 2 3; do bin/n50 --shard $I/3 --files-from "${OUTDIR}/list.txt" | tail -n +2; done | sort)
+[[ "$EXPECTED" == "$GOT" ]] && success "Shards cover every file once" || fail "Shards do not cover every file once"
+rm -f "${OUTDIR}/list.txt"
+
+header "Checking --profile..."
+FQ=$(ls ${OUTDIR}/*.fastq | head -n 1)
+EXPECTED=$(bin/n50 "$FQ" ./test/test.fa)
+GOT=$(bin/n50 --profile="${OUTDIR}/profile.json" "$FQ" ./test/test.fa)
+[[ "$EXPECTED" == "$GOT" ]] && success "Same output with --profile" || fail "Different output with --profile"
+SEQS=$(printf "%s\n" "$EXPECTED" | awk 'NR > 1 { n += $2 } END { print n }')
+PROFILED=$(awk -F'"seqs":' 'NF > 1 { split($2, a, ","); print a[1] }' "${OUTDIR}/profile.json" | tail -n 1)
+[[ "$SEQS" == "$PROFILED" ]] && success "Profile counts every sequence" || fail "Profile counts $PROFILED sequences, not $SEQS"
+ROWS=$(bin/n50_qual --profile "$FQ" 2>&1 >/dev/null | wc -l | tr -d ' ')
+[[ "$ROWS" == 3 ]] && success "n50_qual --profile prints a row per file and the total" || fail "n50_qual --profile printed $ROWS lines"
+rm -f "${OUTDIR}/profile.json"
+
+header "Checking --trace..."
+GOT=$(bin/n50 --trace "${OUTDIR}/trace.json" -t 4 "$FQ" ./test/test.fa)
+[[ "$EXPECTED" == "$GOT" ]] && success "Same output with --trace" || fail "Different output with --trace"
+grep -q '"name":"scan","ph":"X"' "${OUTDIR}/trace.json" && success "n50 trace has scan spans" || fail "n50 trace has no scan spans"
+bin/fqc --trace "${OUTDIR}/trace.json" "$FQ" 2 > /dev/null
+grep -q '"name":"chunks","ph":"C"' "${OUTDIR}/trace.json" && success "fqc trace has queue depths" || fail "fqc trace has no queue depths"
+if command -v jq >/dev/null 2>&1; then
+    jq .traceEvents "${OUTDIR}/trace.json" > /dev/null 2>&1 && success "Trace is valid JSON" || fail "Trace is not valid JSON"
+fi
+rm -f "${OUTDIR}/trace.json"
+
+header "Checking --hwcounters..."
+# Counters may not be available (virtual machines, perf_event_paranoid): only the output is checked
+GOT=$(bin/n50 --hwcounters "$FQ" ./test/test.fa 2>/dev/null)
+[[ "$EXPECTED" == "$GOT" ]] && success "Same output with --hwcounters" || fail "Different output with --hwcounters"
+[[ "$(bin/n50_qual "$FQ")" == "$(bin/n50_qual --hwcounters "$FQ" 2>/dev/null)" ]] && success "Same n50_qual output with --hwcounters" || fail "Different n50_qual output with --hwcounters"
+[[ "$(bin/fqc "$FQ" 2)" == "$(bin/fqc --hwcounters "$FQ" 2 2>/dev/null)" ]] && success "Same fqc output with --hwcounters" || fail "Different fqc output with --hwcounters"
+
+header "Checking --progress..."
+GOT=$(bin/n50 --progress "$FQ" ./test/test.fa 2>"$OUTDIR/progress.txt")
+[[ "$EXPECTED" == "$GOT" ]] && success "Same output with --progress" || fail "Different output with --progress"
+tail -n 1 "$OUTDIR/progress.txt" | grep -q "^Progress: 100.0% of .*, 2/2 files, .* reads/s" && success "Progress reaches 100%" || fail "Progress does not reach 100%: $(tail -n 1 "$OUTDIR/progress.txt")"
+rm -f "$OUTDIR/progress.txt"
+[[ "$(bin/n50_qual "$FQ")" == "$(bin/n50_qual --progress=0.1 "$FQ" 2>/dev/null)" ]] && success "Same n50_qual output with --progress" || fail "Different n50_qual output with --progress"
+
+header "Checking --min-len and --max-len..."
+GOT=$(bin/n50 --min-len 5 --max-len 15 ./test/test.fa | tail -n 1 | cut -f 2,3,4,13,14)
+[[ "$GOT" == "$(printf "1\t12\t12\t3\t34")" ]] && success "Length filter keeps seq2 of test.fa" || fail "Length filter on test.fa: $GOT"
+gzip -c "$FQ" > "$OUTDIR/filter.fq.gz"
+EXPECTED=$(bin/n50 -t 1 --min-len 1000 "$OUTDIR/filter.fq.gz" | tail -n 1 | cut -f 2-)
+GOT=$(bin/n50 -t 4 --min-len 1000 "$OUTDIR/filter.fq.gz" | tail -n 1 | cut -f 2-)
+[[ "$EXPECTED" == "$GOT" ]] && success "Same filtered statistics on 1 and 4 threads" || fail "Filtered statistics differ with threads"
+GOT=$(bin/n50_qual --min-len 1000 "$FQ" | tail -n 1 | cut -f 2,3,16,17)
+[[ "$GOT" == "$(echo "$EXPECTED" | cut -f 1,2,12,13)" ]] && success "Same filtered counts in n50_qual" || fail "Filtered counts differ in n50_qual"
+GOT=$(bin/n50 --min-len 100000000 ./test/test.fa | tail -n 1 | cut -f 2-)
+[[ "$GOT" == "$(printf "0\t0\t0\t0\t0\t0\t0.00\t0.00\t0\t0\t0\t3\t34")" ]] && success "Zeros when every sequence is filtered out" || fail "All filtered out: $GOT"
+if command -v jq >/dev/null 2>&1; then
+    bin/n50 -j --min-len 100000000 ./test/test.fa | jq . >/dev/null 2>&1 && success "Valid JSON when every sequence is filtered out" || fail "Invalid JSON when every sequence is filtered out"
+fi
+GOT=$(bin/n50_qual --min-len 100000000 "$FQ" | tail -n 1 | cut -f 2-15)
+[[ "$GOT" == "$(printf "0\t0\t0\t0\t0\t0\t0.00\t0.00\t0\t0\t0\t0.00\t0.00\t0.00")" ]] && success "Zeros when every read is filtered out in n50_qual" || fail "All filtered out in n50_qual: $GOT"
+bin/n50 --min-len 10 --max-len 5 ./test/test.fa >/dev/null 2>&1 && fail "--min-len above --max-len accepted" || success "--min-len above --max-len rejected"
+bin/n50_qual --min-len 10 --max-len 5 "$FQ" >/dev/null 2>&1 && fail "--min-len above --max-len accepted by n50_qual" || success "--min-len above --max-len rejected by n50_qual"
+rm -f "$OUTDIR/filter.fq.gz"
+
+header "Checking --fields..."
+gzip -c "$FQ" > "$OUTDIR/fields.fq.gz"
+EXPECTED=$(bin/n50 -t 1 "$OUTDIR/fields.fq.gz" | tail -n 1 | cut -f 2,3,4,8)
+GOT=$(bin/n50 -t 1 --fields TotSeqs,TotLen,N50,GC "$OUTDIR/fields.fq.gz" | tail -n 1 | cut -f 2-)
+[[ "$EXPECTED" == "$GOT" ]] && success "Selected columns match the full output" || fail "Selected columns differ: $GOT"
+EXPECTED=$(bin/n50 -t 1 "$OUTDIR/fields.fq.gz" | tail -n 1 | awk -F'\t' '{print $4"\t"$2}')
+GOT=$(bin/n50 -t 4 --fields n50,totseqs "$OUTDIR/fields.fq.gz" | tail -n 1 | cut -f 2-)
+[[ "$EXPECTED" == "$GOT" ]] && success "Length-only columns on 4 threads, in the order asked" || fail "Length-only columns differ: $GOT"
+EXPECTED=$(bin/n50_qual "$FQ" | tail -n 1 | cut -f 2,14,15)
+GOT=$(bin/n50_qual --fields TotSeqs,Q20,Q30 "$FQ" | tail -n 1 | cut -f 2-)
+[[ "$EXPECTED" == "$GOT" ]] && success "Q20 and Q30 without error probabilities in n50_qual" || fail "n50_qual selected columns differ: $GOT"
+[[ "$(bin/n50 ./test/test.fa | head -n 1 | cut -f 2-)" == "$(printf "TotSeqs\tTotLen\tN50\tN75\tN90\tI50\tGC\tAvg\tMin\tMax\tAuN")" ]] && success "Default columns unchanged" || fail "Default columns changed"
+GOT=$(printf ">a\nACGTNNnnac\n" | bin/n50 --fields Ns,Masked - | tail -n 1 | cut -f 2-)
+[[ "$GOT" == "$(printf "40.00\t40.00")" ]] && success "Ns and Masked on request" || fail "Ns and Masked: $GOT"
+bin/n50 --fields N50,Foo ./test/test.fa >/dev/null 2>&1 && fail "Unknown field accepted" || success "Unknown field rejected"
+rm -f "$OUTDIR/fields.fq.gz"
 
 # Test JSON output if jq is available
 header "Testing JSON output..."
@@ -0,0 +1,235 @@
+#!/usr/bin/env bash
+# Strong and weak scaling of the n50 binaries on a fixed matrix of generated corpora.
+#
+# Corpora (generated once with bin/n50_simreads into test/scaling/, then reused):
+#   illumina    tiny reads, 4M x 150 bp FASTQ
+#   longreads   long reads, 10-50 kbp FASTQ
+#   chromosome  a single 3 Gbp FASTA sequence
+#   tinyfiles   100k FASTQ files of one read each
+# each as plain, gzip and BGZF (when bgzip is installed). -s scales every
+# corpus down, e.g. -s 0.01 for a quick run.
+#
+# Strong scaling runs every binary on each corpus with 1..N threads; weak
+# scaling runs n50 on T copies of the Illumina corpus with T threads. Rows go
+# to test/benchmark/scaling_strong.csv and scaling_weak.csv, with the columns
+# of the hyperfine CSVs followed by corpus, form, threads, bytes, throughput
+# and peak RSS.
+set -euo pipefail
+SELF_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+PARENT_DIR="$(dirname "$SELF_DIR")"
+BIN_DIR="$PARENT_DIR/bin"
+CORPUS_DIR="$PARENT_DIR/test/scaling"
+OUT_DIR="$PARENT_DIR/test/benchmark"
+
+MAX_THREADS=$( (nproc || sysctl -n hw.ncpu) 2>/dev/null || echo 4)
+SCALE=1
+REPEATS=3
+while getopts "t:s:r:h" OPT; do
+    case $OPT in
+        t) MAX_THREADS=$OPTARG ;;
+        s) SCALE=$OPTARG ;;
+        r) REPEATS=$OPTARG ;;
+        *) echo "Usage: $0 [-t MAX_THREADS] [-s SCALE] [-r REPEATS]"; exit 1 ;;
+    esac
+done
+
+for BIN in n50 n50_simreads n50_qual fqc; do
+    if [ ! -x "$BIN_DIR/$BIN" ]; then
+        echo "Binary not found: $BIN_DIR/$BIN (run make first)"
+        exit 1
+    fi
+done
+if ! command -v python3 >/dev/null 2>&1; then
+    echo "python3 is needed to measure wall time and peak RSS"
+    exit 1
+fi
+HAVE_BGZIP=0
+command -v bgzip >/dev/null 2>&1 && HAVE_BGZIP=1 || echo "bgzip not found: skipping the BGZF form"
+
+# Thread counts: powers of two up to MAX_THREADS, and MAX_THREADS itself
+THREADS=""
+for ((T = 1; T < MAX_THREADS; T *= 2)); do THREADS="$THREADS $T"; done
+THREADS="$THREADS $MAX_THREADS"
+
+# COUNT*SIZE scaled by SCALE: fewer sequences, or a shorter one if there is only one
+scaled() {
+    awk -v n="${1%%\**}" -v l="${1##*\*}" -v s="$SCALE" 'BEGIN {
+        if (n * s >= 1) printf "%d*%d\n", n * s, l
+        else printf "%d*%d\n", n, (l * s < 1 ? 1 : l * s)
+    }'
+}
+
+# Run a command REPEATS times: prints mean,stddev,median,user,system,min,max,max_rss_kb
+measure() {
+    python3 - "$REPEATS" "$@" <<'PY'
+import os, statistics, subprocess, sys, time
+repeats, cmd = int(sys.argv[1]), sys.argv[2:]
+walls, users, systems, rss = [], [], [], 0
+for _ in range(repeats):
+    start = time.perf_counter()
+    p = subprocess.Popen(cmd, stdout=subprocess.DEVNULL)
+    _, status, ru = os.wait4(p.pid, 0)
+    walls.append(time.perf_counter() - start)
+    users.append(ru.ru_utime)
+    systems.append(ru.ru_stime)
+    # ru_maxrss is in bytes on macOS, in KB elsewhere
+    rss = max(rss, ru.ru_maxrss // 1024 if sys.platform == "darwin" else ru.ru_maxrss)
+    if status != 0:
+        sys.exit("failed: " + " ".join(cmd))
+sd = statistics.stdev(walls) if len(walls) > 1 else 0.0
+print(",".join(str(v) for v in (statistics.mean(walls), sd, statistics.median(walls),
+      statistics.mean(users), statistics.mean(systems), min(walls), max(walls), rss)))
+PY
+}
+
+# Generate one corpus: NAME FORMAT COUNT*SIZE...
+generate() {
+    local NAME=$1 FORMAT=$2
+    shift 2
+    local DIR="$CORPUS_DIR/$NAME"
+    if [ -f "$DIR/.scale" ] && [ "$(cat "$DIR/.scale")" == "$SCALE" ]; then
+        return
+    fi
+    echo "Generating $NAME"
+    rm -rf "$DIR"
+    mkdir -p "$DIR/tmp"
+    local ARGS=()
+    for SPEC in "$@"; do
+        ARGS+=("$(scaled "$SPEC")")
+    done
+    "$BIN_DIR/n50_simreads" --"$FORMAT" -o "$DIR/tmp" "${ARGS[@]}" > /dev/null
+    mv "$DIR"/tmp/*."$FORMAT" "$DIR/$NAME.$FORMAT"
+    rmdir "$DIR/tmp"
+    # The file holds at least every base asked for (twice in FASTQ, with the qualities)
+    local BASES
+    BASES=$(printf "%s\n" "${ARGS[@]}" | awk -F'*' -v q="$([ "$FORMAT" == fastq ] && echo 2 || echo 1)" '{ n += $1 * $2 } END { printf "%.0f\n", n * q }')
+    local BYTES
+    BYTES=$(wc -c < "$DIR/$NAME.$FORMAT" | tr -d ' ')
+    if [ "$BYTES" -lt "$BASES" ]; then
+        echo "Corpus $NAME is $BYTES bytes, expected at least $BASES"
+        rm -rf "$DIR"
+        exit 1
+    fi
+    gzip -k "$DIR/$NAME.$FORMAT"
+    if [ $HAVE_BGZIP == 1 ]; then
+        bgzip -c "$DIR/$NAME.$FORMAT" > "$DIR/$NAME.bgzf.$FORMAT.gz"
+    fi
+    echo "$SCALE" > "$DIR/.scale"
+}
+
+generate_tinyfiles() {
+    local DIR="$CORPUS_DIR/tinyfiles"
+    if [ -f "$DIR/.scale" ] && [ "$(cat "$DIR/.scale")" == "$SCALE" ]; then
+        return
+    fi
+    echo "Generating tinyfiles"
+    rm -rf "$DIR"
+    mkdir -p "$DIR/tmp" "$DIR/plain" "$DIR/gzip"
+    "$BIN_DIR/n50_simreads" --fastq -o "$DIR/tmp" "$(scaled "100000*150")" > /dev/null
+    split -l 4 -a 6 "$DIR"/tmp/*.fastq "$DIR/plain/r_"
+    rm -rf "$DIR/tmp"
+    (cd "$DIR/plain" && find . -type f -print0 | xargs -0 -n 1000 sh -c 'for F; do mv "$F" "$F.fastq"; done' sh)
+    (cd "$DIR/plain" && find . -type f -print0 | xargs -0 -n 1000 sh -c 'for F; do gzip -c "$F" > "../gzip/$F.gz"; done' sh)
+    if [ $HAVE_BGZIP == 1 ]; then
+        mkdir -p "$DIR/bgzf"
+        (cd "$DIR/plain" && find . -type f -print0 | xargs -0 -n 1000 sh -c 'for F; do bgzip -c "$F" > "../bgzf/$F.gz"; done' sh)
+    fi
+    echo "$SCALE" > "$DIR/.scale"
+}
+
+mkdir -p "$CORPUS_DIR" "$OUT_DIR"
+generate illumina fastq 4000000*150
+generate longreads fastq 5000*50000 20000*20000 20000*10000
+generate chromosome fasta 1*3000000000
+generate_tinyfiles
+
+HEADER="command,mean,stddev,median,user,system,min,max,binary,corpus,form,threads,bytes,mb_per_s,max_rss_kb"
+STRONG="$OUT_DIR/scaling_strong.csv"
+WEAK="$OUT_DIR/scaling_weak.csv"
+echo "$HEADER" > "$STRONG"
+echo "$HEADER" > "$WEAK"
+
+# One row: CSV BINARY CORPUS FORM THREADS BYTES COMMAND...
+record() {
+    local CSV=$1 BINARY=$2 CORPUS=$3 FORM=$4 T=$5 BYTES=$6
+    shift 6
+    local M
+    M=$(measure "$@")
+    local MEAN=${M%%,*}
+    local RSS=${M##*,}
+    local TIMES=${M%,*}
+    local MBS
+    MBS=$(awk -v b="$BYTES" -v t="$MEAN" 'BEGIN { printf "%.1f", (t > 0 ? b / t / 1e6 : 0) }')
+    echo "\"$*\",$TIMES,$BINARY,$CORPUS,$FORM,$T,$BYTES,$MBS,$RSS" >> "$CSV"
+    printf "%-10s %-11s %-6s %3s threads  %8.3f s  %9s MB/s  %8s KB\n" "$BINARY" "$CORPUS" "$FORM" "$T" "$MEAN" "$MBS" "$RSS"
+}
+
+bytes_of() {
+    # Sum of the file sizes, without following the argument list limit
+    find "$@" -type f -print0 | xargs -0 cat | wc -c | tr -d ' '
+}
+
+header_line() {
+    echo -e "\n== $1"
+}
+
+header_line "Strong scaling"
+for CORPUS in illumina longreads chromosome; do
+    DIR="$CORPUS_DIR/$CORPUS"
+    for FILE in "$DIR"/*.fast?; do :; done
+    EXT=${FILE##*.}
+    for FORM in plain gzip bgzf; do
+        case $FORM in
+            plain) INPUT="$DIR/$CORPUS.$EXT" ;;
+            gzip)  INPUT="$DIR/$CORPUS.$EXT.gz" ;;
+            bgzf)  INPUT="$DIR/$CORPUS.bgzf.$EXT.gz" ;;
+        esac
+        [ -f "$INPUT" ] || continue
+        BYTES=$(bytes_of "$INPUT")
+        for T in $THREADS; do
+            record "$STRONG" n50 "$CORPUS" "$FORM" "$T" "$BYTES" "$BIN_DIR/n50" -t "$T" "$INPUT"
+            if [ "$EXT" == "fastq" ]; then
+                record "$STRONG" fqc "$CORPUS" "$FORM" "$T" "$BYTES" "$BIN_DIR/fqc" "$INPUT" "$T"
+            fi
+        done
+        # No thread option: one run with the default
+        if [ "$EXT" == "fastq" ]; then
+            record "$STRONG" n50_qual "$CORPUS" "$FORM" default "$BYTES" "$BIN_DIR/n50_qual" "$INPUT"
+        fi
+    done
+done
+
+# Many small files: n50 spreads them over its thread pool
+for FORM in plain gzip bgzf; do
+    DIR="$CORPUS_DIR/tinyfiles/$FORM"
+    [ -d "$DIR" ] || continue
+    LIST="$CORPUS_DIR/tinyfiles/$FORM.txt"
+    find "$DIR" -type f > "$LIST"
+    BYTES=$(bytes_of "$DIR")
+    for T in $THREADS; do
+        record "$STRONG" n50 tinyfiles "$FORM" "$T" "$BYTES" "$BIN_DIR/n50" -t "$T" --files-from "$LIST"
+    done
+done
+
+header_line "Weak scaling (T copies of the Illumina corpus on T threads)"
+for FORM in plain gzip; do
+    case $FORM in
+        plain) INPUT="$CORPUS_DIR/illumina/illumina.fastq" ;;
+        gzip)  INPUT="$CORPUS_DIR/illumina/illumina.fastq.gz" ;;
+    esac
+    SIZE=$(bytes_of "$INPUT")
+    for T in $THREADS; do
+        INPUTS=()
+        for ((I = 0; I < T; I++)); do INPUTS+=("$INPUT"); done
+        record "$WEAK" n50 illumina "$FORM" "$T" $((SIZE * T)) "$BIN_DIR/n50" -t "$T" "${INPUTS[@]}"
+    done
+done
+
+header_line "Speedup over 1 thread"
+awk -F, 'NR > 1 && $12 != "default" {
+    key = $9 " " $10 " " $11
+    if ($12 == 1) base[key] = $2
+    if (key in base) printf "%-30s %3s threads  %6.2fx\n", key, $12, base[key] / $2
+}' "$STRONG"
+
+echo -e "\nResults: $STRONG $WEAK"